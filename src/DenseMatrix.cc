@@ -0,0 +1,76 @@
+//
+// file DenseMatrix.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+
+#include "DenseMatrix.H"
+
+#include <algorithm>
+
+using namespace std;
+
+static const int FLOATS_PER_ALIGN = DENSE_ALIGN / sizeof( float );
+
+// ****************************************************************************
+void DenseMatrix::resize( int num_rows , int num_cols , float init_val ) {
+
+  num_rows_ = num_rows;
+  num_cols_ = num_cols;
+  // a matrix with no columns still gets some space in each row, so row() is
+  // always a valid pointer
+  stride_ = std::max( 1 , ( num_cols + FLOATS_PER_ALIGN - 1 ) / FLOATS_PER_ALIGN ) * FLOATS_PER_ALIGN;
+  data_.assign( size_t( num_rows_ ) * stride_ , 0.0F );
+  if( 0.0F != init_val ) {
+    for( int i = 0 ; i < num_rows_ ; ++i ) {
+      fill( row( i ) , row( i ) + num_cols_ , init_val );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void DenseMatrix::append_row( const float *vals ) {
+
+  data_.resize( size_t( num_rows_ + 1 ) * stride_ , 0.0F );
+  copy( vals , vals + num_cols_ , row( num_rows_ ) );
+  ++num_rows_;
+
+}
+
+// ****************************************************************************
+void DenseMatrix::erase_row( int i ) {
+
+  copy( data_.begin() + size_t( i + 1 ) * stride_ , data_.end() ,
+        data_.begin() + size_t( i ) * stride_ );
+  --num_rows_;
+  data_.resize( size_t( num_rows_ ) * stride_ );
+
+}
+
+// ****************************************************************************
+void DenseMatrix::erase_col( int j ) {
+
+  for( int i = 0 ; i < num_rows_ ; ++i ) {
+    float *r = row( i );
+    copy( r + j + 1 , r + num_cols_ , r + j );
+    r[num_cols_ - 1] = 0.0F;
+  }
+  --num_cols_;
+
+}
+
+// ****************************************************************************
+void DenseMatrix::swap( DenseMatrix &other ) {
+
+  std::swap( num_rows_ , other.num_rows_ );
+  std::swap( num_cols_ , other.num_cols_ );
+  std::swap( stride_ , other.stride_ );
+  data_.swap( other.data_ );
+
+}
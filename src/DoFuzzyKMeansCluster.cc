@@ -12,16 +12,29 @@
 // Takes a vector of MoleculeRec objects and produces k clusters by fuzzy k-means clustering.
 // The nature of the algorithm requires Euclidean distances
 // as the cluster centroid must be computed and that won't be a bitstring.
-
+// The centroids, coefficients and distances are all DenseMatrix objects, so
+// they're each in one block of memory. The fingerprints are only held as their
+// on bits, as they're mostly zeros: the centroids are sums over them, and the
+// distances to the centroids come from them and the centroid norms, as for
+// k-means, in KMeansKernels.H. The powers of m are done by the fuzzifier
+// classes in FuzzyKernels.H, picked to suit m at the start of each step.
+// With a lot of clusters, the molecules can keep just their top few memberships
+// in SparseCoeffs instead of the dense coefficients.
+
+#include "DenseMatrix.H"
+#include "FuzzyKernels.H"
+#include "KMeansKernels.H"
 #include "MoleculeRec.H"
 #include "SVDClusRDKitDefs.H"
 #include "SVDCluster.H"
 #include "SVDClusterMember.H"
+#include "SilhouetteDistance.H"
 
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/variate_generator.hpp>
 
@@ -36,7 +49,9 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <numeric>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -44,19 +59,202 @@ using namespace boost;
 using namespace std;
 using namespace RDKit;
 
-extern boost::random::mt19937 gen;
+// in DoKMeansCluster.cc
+unsigned int run_seed( unsigned int master_seed , int run_num );
+// in DoKMeansCluster.cc
+void calc_centroid_norms( const DenseMatrix &centroids ,
+                          vector<double> &centroid_norms );
 
 namespace bl = boost::lambda;
 typedef pair<int,float> CLUS_MEM;
 
+// number of fingerprints in each block for the fingerprint to centroid distances
+// and the centroid update
+static const int FP_BLOCK_SIZE = 64;
+// number of centroids in each block for the centroid update
+static const int CENT_BLOCK_SIZE = 8;
+// the iterations stop when no coefficient changes by more than this
+static const float COEFFS_CHANGE_TOL = 1.0e-3F;
+static const int MAX_FUZZY_ITERS = 100000;
+// the fewest memberships kept for each molecule when they're cut down to the top
+// ones, as the fuzzy silhouette score needs the top 2
+static const int MIN_TOP_MEMBERSHIPS = 2;
+
+// ****************************************************************************
+// The matrices for one fuzzy k-means run, which keep their memory from one
+// iteration to the next so that an iteration doesn't allocate anything. The new
+// coefficients go into next_coeffs_ and are swapped with coeffs_, not copied.
+class FuzzyWorkspace {
+
+public :
+
+  DenseMatrix coeffs_ , next_coeffs_; // molecules by clusters
+  DenseMatrix weights_; // clusters by molecules, coeffs_ to the power m
+  DenseMatrix centroids_; // clusters by bits
+  vector<double> centroid_norms_; // squared, for sq_dist_to_centroid
+  DenseMatrix sq_dists_; // molecules by clusters, to centroids_
+
+};
+
+// ****************************************************************************
+// The coefficients of each molecule in just the top_r() clusters it belongs to
+// most, for when the dense molecules by clusters matrices would be too big.
+// Molecule i is in cluster clus( i )[k] with coefficient vals_( i , k ), biggest
+// first. They're renormalised to add up to 1, and dropped_[i] is how much of the
+// molecule's membership was in the other clusters before that.
+class SparseCoeffs {
+
+public :
+
+  DenseMatrix vals_; // molecules by top_r
+  vector<int> clus_;
+  vector<float> dropped_;
+
+  int num_mols() const { return vals_.num_rows(); }
+  int top_r() const { return vals_.num_cols(); }
+  bool empty() const { return vals_.empty(); }
+
+  int *clus( int i ) { return &clus_[0] + i * top_r(); }
+  const int *clus( int i ) const { return &clus_[0] + i * top_r(); }
+
+  void resize( int num_mols , int top_r ) {
+    vals_.resize( num_mols , top_r );
+    clus_.resize( num_mols * top_r );
+    dropped_.resize( num_mols );
+  }
+  void swap( SparseCoeffs &other ) {
+    vals_.swap( other.vals_ );
+    clus_.swap( other.clus_ );
+    dropped_.swap( other.dropped_ );
+  }
+  void clear() {
+    vals_.clear();
+    clus_.clear();
+    dropped_.clear();
+  }
+
+};
+
+// ****************************************************************************
+// FuzzyWorkspace for the top_r_ memberships. Nothing in it is molecules by
+// clusters: the distances of the molecules to all the centroids are only held a
+// block of FP_BLOCK_SIZE at a time, by each thread.
+class SparseFuzzyWorkspace {
+
+public :
+
+  explicit SparseFuzzyWorkspace( int top_r ) : top_r_( top_r ) {}
+
+  int top_r_;
+  SparseCoeffs coeffs_ , next_coeffs_;
+  DenseMatrix weights_; // top_r_ by molecules, coeffs_.vals_ to the power m
+  DenseMatrix centroids_; // clusters by bits
+  vector<double> centroid_norms_; // squared, for sq_dist_to_centroid
+  vector<char> live_clus_; // false for a centroid that no molecule is in
+  DenseMatrix sq_dists_; // molecules by top_r_, to the centroids of coeffs_
+  // the entries of coeffs_, i * top_r_ + k, sorted by cluster, cluster j's
+  // being from clus_starts_[j] to clus_starts_[j+1]
+  vector<int> clus_starts_ , clus_entries_;
+
+};
+
+// ****************************************************************************
+// Decides which of the restarts of fuzzy k-means gives the answer. Taken one at
+// a time, the best is the one with the lowest objective function, and it stops
+// once 3 runs have come within 1e-3 of the best, assuming that's the minimum.
+// The runs are done in parallel and finish in any order, so they're held until
+// all the ones before them are in and then put through the test in run order.
+// That way the answer is the same as doing them one after another, and once
+// the test is met, the runs after that one aren't needed. Coeffs is DenseMatrix
+// or SparseCoeffs, and needs swap() and clear().
+template <class Coeffs>
+class FuzzyRestartTracker {
+
+public :
+
+  FuzzyRestartTracker( int num_runs ) :
+    pending_( num_runs ) , done_( num_runs , 0 ) , j_scores_( num_runs , 0.0F ) ,
+    next_run_( 0 ) , last_run_( num_runs - 1 ) ,
+    best_j_score_( numeric_limits<float>::max() ) , num_bests_( 0 ) {}
+
+  // false if run isn't needed, because an earlier one met the test
+  bool needed( int run ) const {
+    bool ret;
+#pragma omp critical(fuzzy_restart_tracker)
+    ret = run <= last_run_;
+    return ret;
+  }
+
+  // run has finished with objective function j_score. Its coefficients are
+  // taken by swapping with coeffs. What the test made of it is written
+  // afterwards, so no other thread waits on the output.
+  void run_done( int run , float j_score , Coeffs &coeffs ) {
+    ostringstream report;
+#pragma omp critical(fuzzy_restart_tracker)
+    if( run <= last_run_ ) {
+      pending_[run].swap( coeffs );
+      j_scores_[run] = j_score;
+      done_[run] = 1;
+      while( next_run_ <= last_run_ && done_[next_run_] ) {
+        test_run( next_run_ , report );
+        pending_[next_run_].clear();
+        ++next_run_;
+      }
+    }
+    cout << report.str();
+  }
+
+  Coeffs &best_coeffs() { return best_coeffs_; }
+
+private :
+
+  vector<Coeffs> pending_;
+  vector<char> done_;
+  vector<float> j_scores_;
+  int next_run_ , last_run_;
+  float best_j_score_;
+  int num_bests_;
+  Coeffs best_coeffs_;
+
+  // the best run's coefficients are swapped into best_coeffs_, not copied, as
+  // there's one of them for every molecule and cluster
+  void test_run( int run , ostream &report ) {
+    float this_j = j_scores_[run];
+    report << "j score = " << this_j << " best score " << best_j_score_
+           << "  discrim : " << fabs( this_j - best_j_score_ ) << endl;
+    bool keep = false;
+    if( fabs( this_j - best_j_score_ ) < 1.0e-3 ) {
+      // assume if we get the same score three times it's a minimum
+      keep = true;
+      ++num_bests_;
+      if( num_bests_ == 3 ) {
+        report << "Breaking at iteration " << run << " num_bests = " << num_bests_ << endl;
+        last_run_ = run;
+        best_coeffs_.swap( pending_[run] );
+        return;
+      }
+    }
+    if( this_j < best_j_score_ ) {
+      best_j_score_ = this_j;
+      keep = true;
+      num_bests_ = 1;
+    }
+    if( keep ) {
+      best_coeffs_.swap( pending_[run] );
+    }
+  }
+
+};
+
 // ****************************************************************************
 // each molecule's coefficients must add up to 1
 void normalise_coefficients( int num_mols ,
-                             vector<vector<float> > &clus_coeffs ) {
+                             DenseMatrix &clus_coeffs ) {
 
   for( int i = 0 ; i < num_mols ; ++i ) {
-    float sum_of_coeffs = accumulate( clus_coeffs[i].begin() , clus_coeffs[i].end() , 0.0 );
-    transform( clus_coeffs[i].begin() , clus_coeffs[i].end() , clus_coeffs[i].begin() ,
+    float *coeffs_i = clus_coeffs.row( i );
+    float sum_of_coeffs = accumulate( coeffs_i , coeffs_i + clus_coeffs.num_cols() , 0.0 );
+    transform( coeffs_i , coeffs_i + clus_coeffs.num_cols() , coeffs_i ,
                bl::bind( divides<float>() , bl::_1 , sum_of_coeffs ) );
   }
 
@@ -65,18 +263,18 @@ void normalise_coefficients( int num_mols ,
 // ****************************************************************************
 // give each molecule a random contribution to each cluster, between 0.0 and 1.0
 void initialise_clusters( int num_mols , int num_clusters ,
-                          vector<vector<float> > &clus_coeffs ) {
+                          boost::random::mt19937 &rng ,
+                          DenseMatrix &clus_coeffs ) {
 
-  clus_coeffs = vector<vector<float> >( num_mols , vector<float>() );
+  clus_coeffs.resize( num_mols , num_clusters );
 
   uniform_real<float> uni_dist( 0 , 1 );
-  variate_generator<boost::random::mt19937 &,uniform_real<float> > uni( gen , uni_dist );
+  variate_generator<boost::random::mt19937 &,uniform_real<float> > uni( rng , uni_dist );
 
-  // clus_coeffs[i][j] is the contribution of fingerprint i to cluster j
+  // clus_coeffs( i , j ) is the contribution of fingerprint i to cluster j
   for( int i = 0 ; i < num_mols ; ++i ) {
-    clus_coeffs[i].reserve( num_clusters );
     for( int j = 0 ; j < num_clusters ; ++j ) {
-      clus_coeffs[i].push_back( uni() );
+      clus_coeffs( i , j ) = uni();
     }
   }
 
@@ -85,44 +283,103 @@ void initialise_clusters( int num_mols , int num_clusters ,
 }
 
 // ****************************************************************************
-void calculate_fuzzy_centroids( const vector<vector<float> > &fps ,
-                                int num_clusters , float m ,
-                                const vector<vector<float> > &clus_coeffs ,
-                                vector<vector<float> > &centroids ) {
-
-  centroids = vector<vector<float> >( num_clusters ,
-                                      vector<float>( fps.front().size() , 0.0 ) );
-
-  // the fuzzy centroid is the weighted mean of all the fps, with the weight being
-  // the contribution of the fp to the cluster. The centroid is then normalised by
-  // the sum of the weights. There's a parameter m, that the coefficients and other
-  // things are raised to the power of, which is some measure of the degree of
-  // fuzziness. It can be between 1 and infinity, but most people use 2, which is
-  // hard-coded for now.
-  for( int i = 0 ; i < num_clusters ; ++i ) {
-    for( int j = 0 , js = fps.size() ; j < js ; ++j ) {
-      for( int k = 0 , ks = fps[j].size() ; k < ks ; ++k ) {
-        centroids[i][k] += fps[j][k] * pow( clus_coeffs[j][i] , m );
-      }
+template <class Fuzzifier>
+void fuzzy_weights_kernel( const Fuzzifier &fuzz , const DenseMatrix &clus_coeffs ,
+                           DenseMatrix &weights ) {
+
+#pragma omp parallel for schedule(static)
+  for( int j = 0 ; j < clus_coeffs.num_cols() ; ++j ) {
+    float *weights_j = weights.row( j );
+    for( int i = 0 , is = clus_coeffs.num_rows() ; i < is ; ++i ) {
+      weights_j[i] = fuzz.weight( clus_coeffs( i , j ) );
     }
   }
 
-  for( int i = 0 ; i < num_clusters ; ++i ) {
-    float norm_i = 0.0;
-    for( int j = 0 , js = fps.size() ; j < js ; ++j ) {
-      norm_i += pow( clus_coeffs[j][i] , m );
+}
+
+// ****************************************************************************
+// The weight of each fingerprint in each centroid, its coefficient raised to the
+// power m, is worked out once per iteration, not once per bit. weights is the
+// transpose of clus_coeffs, so the weights for a centroid are together.
+void calculate_fuzzy_weights( const DenseMatrix &clus_coeffs , float m ,
+                              DenseMatrix &weights ) {
+
+  if( weights.num_rows() != clus_coeffs.num_cols() || weights.num_cols() != clus_coeffs.num_rows() ) {
+    weights.resize( clus_coeffs.num_cols() , clus_coeffs.num_rows() );
+  }
+
+  int n = fuzzifier_power( m );
+  switch( n ) {
+  case 0 :
+    fuzzy_weights_kernel( GenericFuzzifier( m ) , clus_coeffs , weights );
+    break;
+  case 1 :
+    fuzzy_weights_kernel( FixedFuzzifier<1>() , clus_coeffs , weights );
+    break;
+  case 2 :
+    fuzzy_weights_kernel( FixedFuzzifier<2>() , clus_coeffs , weights );
+    break;
+  default :
+    fuzzy_weights_kernel( IntegerFuzzifier( n ) , clus_coeffs , weights );
+    break;
+  }
+
+}
+
+// ****************************************************************************
+// The fuzzy centroid is the weighted mean of all the fps, with the weight being
+// the contribution of the fp to the cluster raised to the power m, which is some
+// measure of the degree of fuzziness. It can be between 1 and infinity, but most
+// people use 2. That's the matrix product of the transposed weights and the
+// fingerprints, but as the fingerprints are 0 or 1 it's just a sum of the weights
+// over the on bits in fp_bits. The centroids are done in blocks of CENT_BLOCK_SIZE
+// in parallel, each block going through the fingerprints FP_BLOCK_SIZE at a
+// time so their bits stay in cache for all the centroids in the block. weights is
+// workspace.
+void calculate_fuzzy_centroids( const vector<vector<int> > &fp_bits , int num_bits ,
+                                int num_clusters , float m ,
+                                const DenseMatrix &clus_coeffs ,
+                                DenseMatrix &weights ,
+                                DenseMatrix &centroids ) {
+
+  calculate_fuzzy_weights( clus_coeffs , m , weights );
+  centroids.resize( num_clusters , num_bits );
+
+  int num_fps = fp_bits.size();
+  int num_blocks = ( num_clusters + CENT_BLOCK_SIZE - 1 ) / CENT_BLOCK_SIZE;
+
+#pragma omp parallel for schedule(dynamic)
+  for( int b = 0 ; b < num_blocks ; ++b ) {
+    int first_cent = b * CENT_BLOCK_SIZE;
+    int last_cent = std::min( first_cent + CENT_BLOCK_SIZE , num_clusters );
+    for( int start = 0 ; start < num_fps ; start += FP_BLOCK_SIZE ) {
+      int stop = std::min( start + FP_BLOCK_SIZE , num_fps );
+      for( int j = first_cent ; j < last_cent ; ++j ) {
+        float *cent_j = centroids.row( j );
+        const float *weights_j = weights.row( j );
+        for( int i = start ; i < stop ; ++i ) {
+          float weight = weights_j[i];
+          for( int k = 0 , ks = fp_bits[i].size() ; k < ks ; ++k ) {
+            cent_j[fp_bits[i][k]] += weight;
+          }
+        }
+      }
     }
+
+    for( int j = first_cent ; j < last_cent ; ++j ) {
+      float norm_j = accumulate( weights.row( j ) , weights.row( j ) + num_fps , 0.0 );
 #ifdef NOTYET
-    cout << i << " : norm_i = " << norm_i << endl;
+      cout << j << " : norm_j = " << norm_j << endl;
 #endif
-    transform( centroids[i].begin() , centroids[i].end() , centroids[i].begin() ,
-               bl::bind( divides<float>() , bl::_1 , norm_i ) );
+      transform( centroids.row( j ) , centroids.row( j ) + num_bits , centroids.row( j ) ,
+                 bl::bind( divides<float>() , bl::_1 , norm_j ) );
+    }
   }
 
 #ifdef NOTYET
   cout << "New centroids" << endl;
-  BOOST_FOREACH( vector<float> c , centroids ) {
-    for_each( c.begin() , c.end() , cout << bl::_1 << " " );
+  for( int i = 0 ; i < num_clusters ; ++i ) {
+    for_each( centroids.row( i ) , centroids.row( i ) + centroids.num_cols() , cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
@@ -130,52 +387,80 @@ void calculate_fuzzy_centroids( const vector<vector<float> > &fps ,
 }
 
 // ****************************************************************************
-void calculate_fp_to_centroid_sq_dists( const vector<vector<float> > &fps ,
-                                        const vector<vector<float> > &centroids ,
-                                        vector<vector<float> > &sq_dists ) {
-
-  sq_dists.clear();
-  int num_cents = centroids.size();
-  sq_dists.reserve( fps.size() );
-  BOOST_FOREACH( const vector<float> fp , fps ) {
-    sq_dists.push_back( vector<float>() );
-    sq_dists.back().reserve( num_cents );
-    BOOST_FOREACH( const vector<float> c , centroids ) {
-      float dist = inner_product( fp.begin() , fp.end() , c.begin() ,
-                                  0.0 , plus<float>() ,
-                                  ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
-      sq_dists.back().push_back( dist );
+// The fingerprints are done in blocks of FP_BLOCK_SIZE, each block against all
+// the centroids in turn, so that a centroid stays in cache while it's needed.
+// The distances are from the on bits and the centroids' squared norms, which go
+// in centroid_norms, so they take time in proportion to the bits that are set.
+void calculate_fp_to_centroid_sq_dists( const vector<vector<int> > &fp_bits ,
+                                        const DenseMatrix &centroids ,
+                                        vector<double> &centroid_norms ,
+                                        DenseMatrix &sq_dists ) {
+
+  int num_fps = fp_bits.size() , num_cents = centroids.num_rows();
+  if( sq_dists.num_rows() != num_fps || sq_dists.num_cols() != num_cents ) {
+    sq_dists.resize( num_fps , num_cents );
+  }
+  calc_centroid_norms( centroids , centroid_norms );
+  int num_blocks = ( num_fps + FP_BLOCK_SIZE - 1 ) / FP_BLOCK_SIZE;
+
+#pragma omp parallel for schedule(dynamic)
+  for( int b = 0 ; b < num_blocks ; ++b ) {
+    int start = b * FP_BLOCK_SIZE;
+    int stop = std::min( start + FP_BLOCK_SIZE , num_fps );
+    for( int j = 0 ; j < num_cents ; ++j ) {
+      const float *cent = centroids.row( j );
+      for( int i = start ; i < stop ; ++i ) {
+        sq_dists( i , j ) = sq_dist_to_centroid( fp_bits[i] , cent , centroid_norms[j] );
+      }
     }
   }
 
 }
 
 // ****************************************************************************
-void update_coefficients( const vector<vector<float> > &fps ,
-                          int num_clusters , float m ,
-                          const vector<vector<float> > &centroids ,
-                          vector<vector<float> > &clus_coeffs ) {
+template <class Fuzzifier>
+void coefficients_kernel( const Fuzzifier &fuzz , const DenseMatrix &sq_dists ,
+                          int num_clusters , DenseMatrix &clus_coeffs ) {
 
-  vector<vector<float> > sq_dists;
-  calculate_fp_to_centroid_sq_dists( fps , centroids , sq_dists );
+#pragma omp parallel for schedule(static)
+  for( int i = 0 ; i < sq_dists.num_rows() ; ++i ) {
+    molecule_coefficients( fuzz , sq_dists.row( i ) , num_clusters , clus_coeffs.row( i ) );
+  }
 
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    for( int j = 0 ; j < num_clusters ; ++j ) {
+}
 
-      clus_coeffs[i][j] = 0.0;
-      for( int k = 0 ; k < num_clusters ; ++k ) {
-        // raise distances to power 2 / ( m - 1 ) but the distances are already squared
-        clus_coeffs[i][j] += pow( sq_dists[i][j] / sq_dists[i][k] , float( 1.0 / ( m - 1.0 ) ) );
-      }
-      clus_coeffs[i][j] = 1.0 / clus_coeffs[i][j];
-    }
+// ****************************************************************************
+// centroid_norms and sq_dists are workspace, for the distances of the fps to
+// the centroids.
+void update_coefficients( const vector<vector<int> > &fp_bits ,
+                          int num_clusters , float m ,
+                          const DenseMatrix &centroids ,
+                          vector<double> &centroid_norms ,
+                          DenseMatrix &sq_dists ,
+                          DenseMatrix &clus_coeffs ) {
+
+  calculate_fp_to_centroid_sq_dists( fp_bits , centroids , centroid_norms , sq_dists );
+
+  int n = fuzzifier_power( m );
+  switch( n ) {
+  case 0 :
+    coefficients_kernel( GenericFuzzifier( m ) , sq_dists , num_clusters , clus_coeffs );
+    break;
+  case 1 :
+    coefficients_kernel( FixedFuzzifier<1>() , sq_dists , num_clusters , clus_coeffs );
+    break;
+  case 2 :
+    coefficients_kernel( FixedFuzzifier<2>() , sq_dists , num_clusters , clus_coeffs );
+    break;
+  default :
+    coefficients_kernel( IntegerFuzzifier( n ) , sq_dists , num_clusters , clus_coeffs );
+    break;
   }
 
 #ifdef NOTYET
-  int i = 0;
-  BOOST_FOREACH( vector<float> c , clus_coeffs ) {
-    cout << "coeffs for " << i++ << " : ";
-    for_each( c.begin() , c.end() , cout << bl::_1 << " " );
+  for( int i = 0 , is = clus_coeffs.num_rows() ; i < is ; ++i ) {
+    cout << "coeffs for " << i << " : ";
+    for_each( clus_coeffs.row( i ) , clus_coeffs.row( i ) + num_clusters , cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
@@ -183,100 +468,430 @@ void update_coefficients( const vector<vector<float> > &fps ,
 }
 
 // ****************************************************************************
-float coeffs_difference( const vector<vector<float> > &coeffs1 ,
-                         const vector<vector<float> > &coeffs2 ) {
+// true if no coefficient differs by more than tol, stopping at the first that does
+bool coeffs_converged( const DenseMatrix &coeffs1 ,
+                       const DenseMatrix &coeffs2 , float tol ) {
+
+  for( int i = 0 , is = coeffs1.num_rows() ; i < is ; ++i ) {
+    const float *c1 = coeffs1.row( i ) , *c2 = coeffs2.row( i );
+    for( int j = 0 , js = coeffs1.num_cols() ; j < js ; ++j ) {
+      if( fabs( c1[j] - c2[j] ) > tol ) {
+#ifdef NOTYET
+        cout << "coeffs change at " << i << " , " << j << " : " << c1[j] - c2[j] << endl;
+#endif
+        return false;
+      }
+    }
+  }
+
+  return true;
 
-  float diff = 0.0;
+}
+
+// ****************************************************************************
+// the objective function, sum of coeff^m times squared distance to the centroid.
+// weights are the transposed coeff^m that made the centroids.
+float calc_j_score( const DenseMatrix &weights , const DenseMatrix &sq_dists ) {
 
-  for( int i = 0 , is = coeffs1.size() ; i < is ; ++i ) {
-    diff += inner_product( coeffs1[i].begin() , coeffs1[i].end() ,
-                           coeffs2[i].begin() , 0.0 , plus<float>() ,
-                           ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
+  float j_score = 0.0;
+  for( int i = 0 , is = sq_dists.num_rows() ; i < is ; ++i ) {
+    for( int j = 0 , js = sq_dists.num_cols() ; j < js ; ++j ) {
+      j_score += weights( j , i ) * sq_dists( i , j );
+    }
   }
 
+  return j_score;
+
+}
+
+// ****************************************************************************
+// Iterate from the coefficients in ws.coeffs_ until they settle down, returning
+// the objective function in j_score. The coefficients, centroids and distances
+// to them that go together are left in ws.coeffs_, ws.centroids_ and ws.sq_dists_,
+// so the last distances do for the objective function as well. Returns false if
+// the tracker decides part way through that run isn't needed after all.
+bool generate_fuzzy_clusters( const vector<vector<int> > &fp_bits , int num_bits ,
+                              int num_clusters , float m ,
+                              const FuzzyRestartTracker<DenseMatrix> &tracker , int run ,
+                              FuzzyWorkspace &ws , float &j_score ) {
+
+  ws.next_coeffs_.resize( ws.coeffs_.num_rows() , ws.coeffs_.num_cols() );
+  for( int i = 0 ; i < MAX_FUZZY_ITERS ; ++i ) {
 #ifdef NOTYET
-  cout << "coeffs diff = " << diff << endl;
+    cout << "Clustering ITERATION " << i << endl;
 #endif
+    if( !tracker.needed( run ) ) {
+      return false;
+    }
+    calculate_fuzzy_centroids( fp_bits , num_bits , num_clusters , m , ws.coeffs_ ,
+                               ws.weights_ , ws.centroids_ );
+    update_coefficients( fp_bits , num_clusters , m , ws.centroids_ , ws.centroid_norms_ ,
+                         ws.sq_dists_ , ws.next_coeffs_ );
+    if( coeffs_converged( ws.coeffs_ , ws.next_coeffs_ , COEFFS_CHANGE_TOL ) ) {
+      break;
+    }
+    ws.coeffs_.swap( ws.next_coeffs_ );
+  }
 
-  return diff;
+  j_score = calc_j_score( ws.weights_ , ws.sq_dists_ );
+  return true;
 
 }
 
 // ****************************************************************************
-float calc_j_score( float m , const vector<vector<float> > &fps ,
-                    const vector<vector<float> > &centroids ,
-                    const vector<vector<float> > &clus_coeffs ) {
+// orders cluster numbers by their coefficients, biggest first, the lower number
+// first if they're the same
+class CoeffGreater {
 
-  vector<vector<float> > sq_dists;
-  calculate_fp_to_centroid_sq_dists( fps , centroids , sq_dists );
-  float j_score = 0.0;
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    for( int j = 0 , js = centroids.size() ; j < js ; ++j ) {
-      j_score += pow( clus_coeffs[i][j] , m ) * sq_dists[i][j];
+public :
+
+  explicit CoeffGreater( const float *coeffs ) : coeffs_( coeffs ) {}
+
+  bool operator()( int a , int b ) const {
+    return coeffs_[a] > coeffs_[b] || ( coeffs_[a] == coeffs_[b] && a < b );
+  }
+
+private :
+
+  const float *coeffs_;
+
+};
+
+// ****************************************************************************
+// Put the top_r() biggest of the num_clusters coefficients of molecule i into
+// row i of sparse_coeffs, biggest first, renormalised, and the sum of the rest
+// into sparse_coeffs.dropped_[i]. order is workspace, num_clusters long.
+void keep_top_coefficients( const float *coeffs , int num_clusters , int i ,
+                            int *order , SparseCoeffs &sparse_coeffs ) {
+
+  int top_r = sparse_coeffs.top_r();
+  for( int j = 0 ; j < num_clusters ; ++j ) {
+    order[j] = j;
+  }
+  partial_sort( order , order + top_r , order + num_clusters , CoeffGreater( coeffs ) );
+
+  float kept = 0.0F;
+  for( int k = 0 ; k < top_r ; ++k ) {
+    kept += coeffs[order[k]];
+  }
+
+  // the biggest coefficient is at least 1 / num_clusters, so kept isn't 0
+  float *vals_i = sparse_coeffs.vals_.row( i );
+  int *clus_i = sparse_coeffs.clus( i );
+  for( int k = 0 ; k < top_r ; ++k ) {
+    clus_i[k] = order[k];
+    vals_i[k] = coeffs[order[k]] / kept;
+  }
+  sparse_coeffs.dropped_[i] = std::max( 1.0F - kept , 0.0F );
+
+}
+
+// ****************************************************************************
+// random coefficients as for the dense ones, cut down to the top ws.top_r_
+void initialise_clusters( int num_mols , int num_clusters ,
+                          boost::random::mt19937 &rng ,
+                          SparseFuzzyWorkspace &ws ) {
+
+  ws.coeffs_.resize( num_mols , ws.top_r_ );
+
+  uniform_real<float> uni_dist( 0 , 1 );
+  variate_generator<boost::random::mt19937 &,uniform_real<float> > uni( rng , uni_dist );
+
+  vector<float> coeffs( num_clusters );
+  vector<int> order( num_clusters );
+  for( int i = 0 ; i < num_mols ; ++i ) {
+    for( int j = 0 ; j < num_clusters ; ++j ) {
+      coeffs[j] = uni();
     }
+    float sum_of_coeffs = accumulate( coeffs.begin() , coeffs.end() , 0.0 );
+    transform( coeffs.begin() , coeffs.end() , coeffs.begin() ,
+               bl::bind( divides<float>() , bl::_1 , sum_of_coeffs ) );
+    keep_top_coefficients( &coeffs[0] , num_clusters , i , &order[0] , ws.coeffs_ );
   }
 
-  return j_score;
+}
+
+// ****************************************************************************
+// the entries of coeffs, i * top_r + k, sorted by cluster with a counting sort,
+// molecule order within each cluster
+void sort_entries_by_cluster( const SparseCoeffs &coeffs , int num_clusters ,
+                              vector<int> &clus_starts ,
+                              vector<int> &clus_entries ) {
+
+  clus_starts.assign( num_clusters + 1 , 0 );
+  for( int e = 0 , es = coeffs.clus_.size() ; e < es ; ++e ) {
+    ++clus_starts[coeffs.clus_[e] + 1];
+  }
+  partial_sum( clus_starts.begin() , clus_starts.end() , clus_starts.begin() );
+
+  // use the starts as the next free place for each cluster, which leaves them
+  // one cluster along at the end
+  clus_entries.resize( coeffs.clus_.size() );
+  for( int e = 0 , es = coeffs.clus_.size() ; e < es ; ++e ) {
+    clus_entries[clus_starts[coeffs.clus_[e]]++] = e;
+  }
+  for( int j = num_clusters ; j > 0 ; --j ) {
+    clus_starts[j] = clus_starts[j - 1];
+  }
+  clus_starts[0] = 0;
 
 }
 
 // ****************************************************************************
-float generate_fuzzy_clusters( const vector<vector<float> > &fps ,
-                               int num_clusters , float m ,
-                               vector<vector<float> > &centroids ,
-                               vector<vector<float> > &clus_coeffs ) {
+// As calculate_fuzzy_centroids, but each centroid is only summed over the
+// molecules that have it in their top memberships. A centroid that none of them
+// has is left out of the next coefficients by ws.live_clus_.
+void calculate_sparse_fuzzy_centroids( const vector<vector<int> > &fp_bits , int num_bits ,
+                                       int num_clusters , float m ,
+                                       SparseFuzzyWorkspace &ws ) {
+
+  // weights_( k , i ) goes with vals_( i , k )
+  calculate_fuzzy_weights( ws.coeffs_.vals_ , m , ws.weights_ );
+  sort_entries_by_cluster( ws.coeffs_ , num_clusters , ws.clus_starts_ , ws.clus_entries_ );
+  ws.centroids_.resize( num_clusters , num_bits );
+  ws.live_clus_.assign( num_clusters , 0 );
+
+  int top_r = ws.top_r_;
+#pragma omp parallel for schedule(dynamic)
+  for( int j = 0 ; j < num_clusters ; ++j ) {
+    float *cent_j = ws.centroids_.row( j );
+    double norm_j = 0.0;
+    for( int e = ws.clus_starts_[j] ; e < ws.clus_starts_[j + 1] ; ++e ) {
+      int i = ws.clus_entries_[e] / top_r , k = ws.clus_entries_[e] % top_r;
+      float weight = ws.weights_( k , i );
+      for( int b = 0 , bs = fp_bits[i].size() ; b < bs ; ++b ) {
+        cent_j[fp_bits[i][b]] += weight;
+      }
+      norm_j += weight;
+    }
+    if( norm_j > 0.0 ) {
+      ws.live_clus_[j] = 1;
+      transform( cent_j , cent_j + num_bits , cent_j ,
+                 bl::bind( divides<float>() , bl::_1 , float( norm_j ) ) );
+    }
+  }
+
+}
+
+// ****************************************************************************
+template <class Fuzzifier>
+void sparse_coefficients_kernel( const Fuzzifier &fuzz ,
+                                 const vector<vector<int> > &fp_bits ,
+                                 SparseFuzzyWorkspace &ws ) {
+
+  int num_fps = fp_bits.size() , num_cents = ws.centroids_.num_rows();
+  int num_blocks = ( num_fps + FP_BLOCK_SIZE - 1 ) / FP_BLOCK_SIZE;
+
+#pragma omp parallel
+  {
+    DenseMatrix block_dists( FP_BLOCK_SIZE , num_cents );
+    vector<float> coeffs( num_cents );
+    vector<int> order( num_cents );
+#pragma omp for schedule(dynamic)
+    for( int b = 0 ; b < num_blocks ; ++b ) {
+      int start = b * FP_BLOCK_SIZE;
+      int block_size = std::min( FP_BLOCK_SIZE , num_fps - start );
+      for( int j = 0 ; j < num_cents ; ++j ) {
+        const float *cent = ws.centroids_.row( j );
+        for( int i = 0 ; i < block_size ; ++i ) {
+          block_dists( i , j ) = ws.live_clus_[j] ?
+                sq_dist_to_centroid( fp_bits[start + i] , cent , ws.centroid_norms_[j] ) :
+                numeric_limits<float>::max();
+        }
+      }
+      for( int i = 0 ; i < block_size ; ++i ) {
+        // the distances for the clusters in coeffs_, for the objective function
+        const int *clus_i = ws.coeffs_.clus( start + i );
+        for( int k = 0 ; k < ws.top_r_ ; ++k ) {
+          ws.sq_dists_( start + i , k ) = block_dists( i , clus_i[k] );
+        }
+        molecule_coefficients( fuzz , block_dists.row( i ) , num_cents , &coeffs[0] );
+        keep_top_coefficients( &coeffs[0] , num_cents , start + i , &order[0] ,
+                               ws.next_coeffs_ );
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// The new top coefficients go into ws.next_coeffs_. Each molecule's
+// coefficients in all the clusters are worked out as usual, then cut down.
+void update_sparse_coefficients( const vector<vector<int> > &fp_bits , float m ,
+                                 SparseFuzzyWorkspace &ws ) {
+
+  int num_fps = fp_bits.size();
+  ws.next_coeffs_.resize( num_fps , ws.top_r_ );
+  if( ws.sq_dists_.num_rows() != num_fps || ws.sq_dists_.num_cols() != ws.top_r_ ) {
+    ws.sq_dists_.resize( num_fps , ws.top_r_ );
+  }
+  calc_centroid_norms( ws.centroids_ , ws.centroid_norms_ );
+
+  int n = fuzzifier_power( m );
+  switch( n ) {
+  case 0 :
+    sparse_coefficients_kernel( GenericFuzzifier( m ) , fp_bits , ws );
+    break;
+  case 1 :
+    sparse_coefficients_kernel( FixedFuzzifier<1>() , fp_bits , ws );
+    break;
+  case 2 :
+    sparse_coefficients_kernel( FixedFuzzifier<2>() , fp_bits , ws );
+    break;
+  default :
+    sparse_coefficients_kernel( IntegerFuzzifier( n ) , fp_bits , ws );
+    break;
+  }
+
+}
+
+// ****************************************************************************
+// As for the dense coefficients, with a cluster that isn't in a molecule's top
+// ones counting as a coefficient of 0.
+bool coeffs_converged( const SparseCoeffs &coeffs1 ,
+                       const SparseCoeffs &coeffs2 , float tol ) {
+
+  int top_r = coeffs1.top_r();
+  for( int i = 0 , is = coeffs1.num_mols() ; i < is ; ++i ) {
+    const int *clus1 = coeffs1.clus( i ) , *clus2 = coeffs2.clus( i );
+    const float *c1 = coeffs1.vals_.row( i ) , *c2 = coeffs2.vals_.row( i );
+    for( int k = 0 ; k < top_r ; ++k ) {
+      const int *in2 = find( clus2 , clus2 + top_r , clus1[k] );
+      float c1_in_2 = in2 == clus2 + top_r ? 0.0F : c2[in2 - clus2];
+      if( fabs( c1[k] - c1_in_2 ) > tol ) {
+        return false;
+      }
+      if( clus1 + top_r == find( clus1 , clus1 + top_r , clus2[k] ) && c2[k] > tol ) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+// generate_fuzzy_clusters for the top memberships. ws.weights_ and ws.sq_dists_
+// are both by the entries of ws.coeffs_, so calc_j_score works on them as is.
+bool generate_fuzzy_clusters( const vector<vector<int> > &fp_bits , int num_bits ,
+                              int num_clusters , float m ,
+                              const FuzzyRestartTracker<SparseCoeffs> &tracker , int run ,
+                              SparseFuzzyWorkspace &ws , float &j_score ) {
+
+  for( int i = 0 ; i < MAX_FUZZY_ITERS ; ++i ) {
+    if( !tracker.needed( run ) ) {
+      return false;
+    }
+    calculate_sparse_fuzzy_centroids( fp_bits , num_bits , num_clusters , m , ws );
+    update_sparse_coefficients( fp_bits , m , ws );
+    if( coeffs_converged( ws.coeffs_ , ws.next_coeffs_ , COEFFS_CHANGE_TOL ) ) {
+      break;
+    }
+    ws.coeffs_.swap( ws.next_coeffs_ );
+  }
+
+  j_score = calc_j_score( ws.weights_ , ws.sq_dists_ );
+  return true;
+
+}
+
+// ****************************************************************************
+// so that run_fuzzy_restarts can start either sort of workspace
+void initialise_clusters( int num_mols , int num_clusters ,
+                          boost::random::mt19937 &rng ,
+                          FuzzyWorkspace &ws ) {
+
+  initialise_clusters( num_mols , num_clusters , rng , ws.coeffs_ );
+
+}
+
+// ****************************************************************************
+// The num_iters restarts, in parallel, each thread working in its own copy of
+// proto_ws. Workspace is FuzzyWorkspace with Coeffs DenseMatrix or
+// SparseFuzzyWorkspace with Coeffs SparseCoeffs.
+template <class Workspace , class Coeffs>
+void run_fuzzy_restarts( const vector<vector<int> > &fp_bits , int num_bits ,
+                         int num_clusters , int num_iters , float m ,
+                         unsigned int random_seed , const Workspace &proto_ws ,
+                         FuzzyRestartTracker<Coeffs> &tracker ) {
+
+#pragma omp parallel if( num_iters > 1 )
+  {
+    // one lot of work space does for all the runs in a thread
+    Workspace ws( proto_ws );
+#pragma omp for schedule(dynamic)
+    for( int i = 0 ; i < num_iters ; ++i ) {
 
-  for( int i = 0 ; i < 100000 ; ++i ) {
 #ifdef NOTYET
-    cout << "Clustering ITERATION " << i << endl;
+      cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << endl;
+      cout << "Clustering Iteration " << i << endl;
 #endif
-    calculate_fuzzy_centroids( fps , num_clusters , m , clus_coeffs , centroids );
-    vector<vector<float> > new_coeffs = clus_coeffs;
-    update_coefficients( fps , num_clusters , m , centroids , new_coeffs );
-    if( coeffs_difference( clus_coeffs , new_coeffs ) < 1.0e-6 ) {
-      break;
+      if( !tracker.needed( i ) ) {
+        continue;
+      }
+
+      // ws.coeffs_ comes back with rows as molecules, so that ws.coeffs_ has the
+      // contributions of molecule i to the clusters in row i.
+      boost::random::mt19937 rng( run_seed( random_seed , i ) );
+      initialise_clusters( fp_bits.size() , num_clusters , rng , ws );
+      float this_j;
+      if( generate_fuzzy_clusters( fp_bits , num_bits , num_clusters , m , tracker , i , ws ,
+                                   this_j ) ) {
+        tracker.run_done( i , this_j , ws.coeffs_ );
+      }
+
     }
-    clus_coeffs = new_coeffs;
   }
 
-  return calc_j_score( m , fps , centroids , clus_coeffs );
+}
+
+// ****************************************************************************
+// how much of their memberships the molecules lost to the truncation
+void report_truncation_error( const SparseCoeffs &coeffs ) {
+
+  double sum_dropped = accumulate( coeffs.dropped_.begin() , coeffs.dropped_.end() , 0.0 );
+  cout << "Top " << coeffs.top_r() << " fuzzy memberships : truncation error mean "
+       << sum_dropped / coeffs.num_mols() << " max "
+       << *max_element( coeffs.dropped_.begin() , coeffs.dropped_.end() ) << endl;
 
 }
 
 // *************************************************************************
-void get_top_pairs( const vector<vector<float> > &coeffs ,
+void get_top_pairs( const DenseMatrix &coeffs ,
                     vector<TOP_PAIR> &top_pairs ) {
 
-  top_pairs = vector<TOP_PAIR>( coeffs.size() ,
+  top_pairs = vector<TOP_PAIR>( coeffs.num_rows() ,
                                 make_tuple( -numeric_limits<float>::max() , -1 ,
                                             -numeric_limits<float>::max() , -1 ) );
 
-  int rank = coeffs.front().size();
+  int rank = coeffs.num_cols();
 
 #ifdef NOTYET
-  cout << "coeffs.size() : " << coeffs.size() << " by rank = " << rank << endl;
+  cout << "coeffs.num_rows() : " << coeffs.num_rows() << " by rank = " << rank << endl;
 #endif
 
-  for( int i = 0 , is = coeffs.size() ; i < is ; ++i ) {
-    if( coeffs[i][0] > coeffs[i][1] ) {
-      top_pairs[i].get<0>() = coeffs[i][0];
+  for( int i = 0 , is = coeffs.num_rows() ; i < is ; ++i ) {
+    const float *coeffs_i = coeffs.row( i );
+    if( coeffs_i[0] > coeffs_i[1] ) {
+      top_pairs[i].get<0>() = coeffs_i[0];
       top_pairs[i].get<1>() = 0;
-      top_pairs[i].get<2>() = coeffs[i][1];
+      top_pairs[i].get<2>() = coeffs_i[1];
       top_pairs[i].get<3>() = 1;
     } else {
-      top_pairs[i].get<0>() = coeffs[i][1];
+      top_pairs[i].get<0>() = coeffs_i[1];
       top_pairs[i].get<1>() = 1;
-      top_pairs[i].get<2>() = coeffs[i][0];
+      top_pairs[i].get<2>() = coeffs_i[0];
       top_pairs[i].get<3>() = 0;
     }
     for( int j = 2 ; j < rank ; ++j ) {
-      if( coeffs[i][j] >= top_pairs[i].get<0>() ) {
+      if( coeffs_i[j] >= top_pairs[i].get<0>() ) {
         top_pairs[i].get<2>() = top_pairs[i].get<0>();
         top_pairs[i].get<3>() = top_pairs[i].get<1>();
-        top_pairs[i].get<0>() = coeffs[i][j];
+        top_pairs[i].get<0>() = coeffs_i[j];
         top_pairs[i].get<1>() = j;
-      } else if( coeffs[i][j] > top_pairs[i].get<2>() ) {
-        top_pairs[i].get<2>() = coeffs[i][j];
+      } else if( coeffs_i[j] > top_pairs[i].get<2>() ) {
+        top_pairs[i].get<2>() = coeffs_i[j];
         top_pairs[i].get<3>() = j;
       }
     }
@@ -291,90 +906,219 @@ void get_top_pairs( const vector<vector<float> > &coeffs ,
 
 }
 
+// *************************************************************************
+// the top memberships are already in order, biggest first
+void get_top_pairs( const SparseCoeffs &coeffs ,
+                    vector<TOP_PAIR> &top_pairs ) {
+
+  top_pairs.resize( coeffs.num_mols() );
+  for( int i = 0 , is = coeffs.num_mols() ; i < is ; ++i ) {
+    const float *vals_i = coeffs.vals_.row( i );
+    const int *clus_i = coeffs.clus( i );
+    top_pairs[i] = make_tuple( vals_i[0] , clus_i[0] , vals_i[1] , clus_i[1] );
+  }
+
+}
+
 // ****************************************************************************
-// for each fingerprint, calculate the mean distance for it to each cluster, for
-// use calculating the crisp silhouette score
+// The mean squared distance from a fingerprint to the members of a cluster. The
+// bits are 0 or 1, so that's the Hamming distance, and the sum over a cluster
+// comes apart: with c_b members of cluster C having bit b on,
+// sum_{y in C} |x - y|^2 = sum_b c_b + sum_{b on in x} ( |C| - 2 c_b ). So the
+// mean is the mean number of on bits in C plus, for each on bit of x, 1 - 2 f_b,
+// f_b being the fraction of C with bit b on. calc_cluster_bit_fracs gets the f_b,
+// in bit_fracs( j , b ) for cluster j, and the mean numbers of on bits.
+void calc_cluster_bit_fracs( const vector<vector<int> > &clus ,
+                             const vector<vector<int> > &fp_bits , int num_bits ,
+                             DenseMatrix &bit_fracs , vector<double> &mean_on_bits ) {
+
+  int num_clus = clus.size();
+  bit_fracs.resize( num_clus , num_bits );
+  mean_on_bits = vector<double>( num_clus , 0.0 );
+
+#pragma omp parallel for schedule(dynamic)
+  for( int j = 0 ; j < num_clus ; ++j ) {
+    if( clus[j].empty() ) {
+      continue;
+    }
+    float *fracs_j = bit_fracs.row( j );
+    for( int k = 0 , ks = clus[j].size() ; k < ks ; ++k ) {
+      const vector<int> &mem_bits = fp_bits[clus[j][k]];
+      for( int b = 0 , bs = mem_bits.size() ; b < bs ; ++b ) {
+        fracs_j[mem_bits[b]] += 1.0F;
+      }
+      mean_on_bits[j] += mem_bits.size();
+    }
+    transform( fracs_j , fracs_j + num_bits , fracs_j ,
+               bl::bind( divides<float>() , bl::_1 , float( clus[j].size() ) ) );
+    mean_on_bits[j] /= clus[j].size();
+  }
+
+}
+
+// ****************************************************************************
+float mean_dist_to_cluster( const vector<int> &bits , const float *fracs ,
+                            double mean_on_bits ) {
+
+  double dist = mean_on_bits;
+  for( int b = 0 , bs = bits.size() ; b < bs ; ++b ) {
+    dist += 1.0 - 2.0 * fracs[bits[b]];
+  }
+  return dist;
+
+}
+
+// ****************************************************************************
+// For each fingerprint, the mean squared distance from it to the members of each
+// cluster, for the crisp silhouette score, from the bit fractions as above. That's
+// O(N.K.bits on), not O(N^2.D) over all the pairs. An empty cluster is
+// numeric_limits<float>::max() from everything, so it's never the nearest.
 void calc_fp_cluster_dists( const vector<vector<int> > &clus ,
-                            const vector<vector<float> > &fps ,
-                            vector<vector<float> > &fp_clus_dists ) {
+                            const vector<vector<int> > &fp_bits , int num_bits ,
+                            DenseMatrix &fp_clus_dists ) {
+
+  int num_clus = clus.size() , num_fps = fp_bits.size();
+  DenseMatrix bit_fracs;
+  vector<double> mean_on_bits;
+  calc_cluster_bit_fracs( clus , fp_bits , num_bits , bit_fracs , mean_on_bits );
+
+  fp_clus_dists.resize( num_fps , num_clus );
+
+#pragma omp parallel for schedule(dynamic,16)
+  for( int i = 0 ; i < num_fps ; ++i ) {
+    for( int j = 0 ; j < num_clus ; ++j ) {
+      if( clus[j].empty() ) {
+        fp_clus_dists( i , j ) = numeric_limits<float>::max();
+      } else {
+        fp_clus_dists( i , j ) = mean_dist_to_cluster( fp_bits[i] , bit_fracs.row( j ) ,
+                                                       mean_on_bits[j] );
+      }
+    }
+  }
 
-  fp_clus_dists = vector<vector<float> >( fps.size() ,
-                                          vector<float>( clus.size() , 0.0 ) );
+}
 
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+// ****************************************************************************
+// The crisp silhouette score of each fingerprint, as crisp_silhouette_score gives
+// from the distances calc_fp_cluster_dists makes, but with a_i and b_i worked out
+// a molecule at a time from the bit fractions, so there's nothing the size of
+// molecules by clusters. The molecules not in a cluster, and those in clusters of
+// 1, get 0.
+void calc_fp_crisp_sil_scores( const vector<vector<int> > &clus ,
+                               const vector<vector<int> > &fp_bits , int num_bits ,
+                               vector<float> &sil_scores ) {
+
+  int num_clus = clus.size() , num_fps = fp_bits.size();
+  DenseMatrix bit_fracs;
+  vector<double> mean_on_bits;
+  calc_cluster_bit_fracs( clus , fp_bits , num_bits , bit_fracs , mean_on_bits );
+
+  vector<int> mol_clus( num_fps , -1 );
+  for( int j = 0 ; j < num_clus ; ++j ) {
+    if( clus[j].size() > 1 ) {
       for( int k = 0 , ks = clus[j].size() ; k < ks ; ++k ) {
-        int mem = clus[j][k];
-        float dist = inner_product( fps[i].begin() , fps[i].end() , fps[mem].begin() ,
-                                    0.0 , plus<float>() ,
-                                    ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
-        fp_clus_dists[i][j] += dist;
+        mol_clus[clus[j][k]] = j;
       }
     }
   }
 
-  // now take the means
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
-      fp_clus_dists[i][j] /= float( clus[j].size() );
+  sil_scores = vector<float>( num_fps , 0.0F );
+#pragma omp parallel for schedule(dynamic,16)
+  for( int i = 0 ; i < num_fps ; ++i ) {
+    int own_clus = mol_clus[i];
+    if( -1 == own_clus ) {
+      continue;
+    }
+    float ai = mean_dist_to_cluster( fp_bits[i] , bit_fracs.row( own_clus ) ,
+                                     mean_on_bits[own_clus] );
+    float bi = numeric_limits<float>::max();
+    for( int j = 0 ; j < num_clus ; ++j ) {
+      if( j != own_clus && !clus[j].empty() ) {
+        bi = std::min( bi , mean_dist_to_cluster( fp_bits[i] , bit_fracs.row( j ) ,
+                                                  mean_on_bits[j] ) );
+      }
+    }
+    if( ai != bi ) {
+      sil_scores[i] = ( bi - ai ) / std::max( bi , ai );
     }
   }
 
 }
 
 // ****************************************************************************
-float calculate_fuzzy_sil_score( const vector<vector<float> > &fps ,
-                                 const vector<vector<float> > &coeffs ,
-                                 double clus_thresh ) {
+// To calculate the silhouette scores, both crisp and fuzzy, we need the
+// cluster for which each molecule has its highest coefficient, and for the fuzzy
+// score the second highest as well, which are in top_pairs. If sil_sample_tol is
+// more than 0, the score is estimated from a sample, to within a 95% confidence
+// interval that wide.
+float calculate_fuzzy_sil_score( const vector<vector<int> > &fp_bits , int num_bits ,
+                                 vector<TOP_PAIR> &top_pairs ,
+                                 int num_clusters , double clus_thresh ,
+                                 double sil_sample_tol , unsigned int random_seed ) {
 
   // this is in DoSVDCluster.cc, for historical reasons.
   void extract_crisp_clusters( vector<TOP_PAIR> &top_pairs , float clus_thresh ,
                                vector<vector<int> > &crisp_clus );
 
   // in eponymous file
-  float crisp_silhouette_score( const vector<vector<int> > &clus ,
-                                const vector<vector<float> > dists ,
-                                vector<float> &sil_scores );
-  // likewise
   float fuzzy_silhouette_score( const vector<float> &crisp_sil_scores ,
                                 const vector<TOP_PAIR> &top_pairs );
-  // to calculate the silhouette scores, both crisp and fuzzy, and also for the
-  // we need the row/molecule for which each column has its maximum
-  // value.  For the fuzzy score, we need the second highest as well.
-  vector<TOP_PAIR> top_pairs;
-  get_top_pairs( coeffs , top_pairs );
-
+  // in fuzzy_silhouette_score.cc
+  void fuzzy_silhouette_weights( const vector<TOP_PAIR> &top_pairs ,
+                                 vector<float> &weights );
+  // in eponymous file
+  float sampled_silhouette_score( const vector<vector<int> > &clus , int num_mols ,
+                                  const SilhouetteDistance &sil_dist ,
+                                  const vector<float> &weights , bool self_in_own_mean ,
+                                  double ci_tol , unsigned int random_seed ,
+                                  vector<float> &sil_scores ,
+                                  SilhouetteEstimate &estimate );
+  void report_silhouette_estimate( const SilhouetteEstimate &estimate );
   // we need the crisp clusters for the the crisp silhouette score
-  vector<vector<int> > crisp_clus( coeffs.front().size() , vector<int>() );
+  vector<vector<int> > crisp_clus( num_clusters , vector<int>() );
   extract_crisp_clusters( top_pairs , clus_thresh , crisp_clus );
 
-  // use the crisp clusters to calculated the mean distances from each molecule to each cluster
-  vector<vector<float> > mol_clus_dists;
-  calc_fp_cluster_dists( crisp_clus , fps , mol_clus_dists );
-
   vector<float> crisp_mol_sil_scores;
-  crisp_silhouette_score( crisp_clus , mol_clus_dists , crisp_mol_sil_scores );
+  if( sil_sample_tol > 0.0 ) {
+    vector<float> weights;
+    fuzzy_silhouette_weights( top_pairs , weights );
+    // calc_fp_crisp_sil_scores counts each molecule in its own cluster's mean
+    DenseMatrix bit_fracs;
+    vector<double> mean_on_bits;
+    calc_cluster_bit_fracs( crisp_clus , fp_bits , num_bits , bit_fracs , mean_on_bits );
+    ClusterBitsSilDistance sil_dist( fp_bits , crisp_clus , bit_fracs , mean_on_bits );
+    SilhouetteEstimate sil_estimate;
+    float sil_score = sampled_silhouette_score( crisp_clus , fp_bits.size() , sil_dist , weights ,
+                                                true , sil_sample_tol , random_seed ,
+                                                crisp_mol_sil_scores , sil_estimate );
+    report_silhouette_estimate( sil_estimate );
+    return sil_score;
+  }
+
+  // the crisp silhouettes from the mean distances from each molecule to each crisp
+  // cluster, a molecule at a time
+  calc_fp_crisp_sil_scores( crisp_clus , fp_bits , num_bits , crisp_mol_sil_scores );
   return fuzzy_silhouette_score( crisp_mol_sil_scores , top_pairs );
 
 }
 
 // ****************************************************************************
 float extract_fuzzy_k_means_clusters( const vector<pMolRec> &molecules ,
-                                      const vector<vector<float> > &fps ,
-                                      const vector<vector<float> > &coeffs ,
-                                      double clus_thresh ,
+                                      const vector<vector<int> > &fp_bits , int num_bits ,
+                                      const DenseMatrix &coeffs ,
+                                      double clus_thresh , double sil_sample_tol ,
+                                      unsigned int random_seed ,
                                       vector<pSVDCluster> &clusters ) {
 
 #ifdef NOTYET
-  int i = 0;
-  BOOST_FOREACH( vector<float> c , coeffs ) {
-    cout << "coeffs for " << i++ << " : ";
-    for_each( c.begin() , c.end() , cout << bl::_1 << " " );
+  for( int i = 0 , is = coeffs.num_rows() ; i < is ; ++i ) {
+    cout << "coeffs for " << i << " : ";
+    for_each( coeffs.row( i ) , coeffs.row( i ) + coeffs.num_cols() , cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
 
-  int num_clusters = coeffs.front().size();
+  int num_clusters = coeffs.num_cols();
   clusters = vector<pSVDCluster>();
   for( int i = 0 ; i < num_clusters ; i++ ) {
     clusters.push_back( pSVDCluster( new SVDCluster( 0.0 , clus_thresh ) ) );
@@ -382,12 +1126,12 @@ float extract_fuzzy_k_means_clusters( const vector<pMolRec> &molecules ,
 
   for( int j = 0 , js = molecules.size() ; j < js ; ++j ) {
     for( int i = 0 , is = num_clusters ; i < is ; ++i ) {
-      if( coeffs[j][i] > clus_thresh ) {
+      if( coeffs( j , i ) > clus_thresh ) {
 #ifdef NOTYET
         cout << "adding molecule " << molecules[j]->name() << " to cluster " << i << endl;
 #endif
         clusters[i]->add_member( pSVDClusMem( new SVDClusterMember( molecules[j] ,
-                                                                    coeffs[j][i] , 0.0 ) ) ) ;
+                                                                    coeffs( j , i ) , 0.0 ) ) ) ;
 #ifdef NOTYET
         for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
           cout << i << " :";
@@ -412,109 +1156,137 @@ float extract_fuzzy_k_means_clusters( const vector<pMolRec> &molecules ,
   }
 #endif
 
-  return calculate_fuzzy_sil_score( fps , coeffs , clus_thresh );
+  vector<TOP_PAIR> top_pairs;
+  get_top_pairs( coeffs , top_pairs );
+  return calculate_fuzzy_sil_score( fp_bits , num_bits , top_pairs , num_clusters , clus_thresh ,
+                                    sil_sample_tol , random_seed );
 
 }
 
 // ****************************************************************************
+// As above, from the top memberships, so the clusters only have the molecules
+// that have them in their top ones.
+float extract_fuzzy_k_means_clusters( const vector<pMolRec> &molecules ,
+                                      const vector<vector<int> > &fp_bits , int num_bits ,
+                                      const SparseCoeffs &coeffs ,
+                                      int num_clusters , double clus_thresh ,
+                                      double sil_sample_tol , unsigned int random_seed ,
+                                      vector<pSVDCluster> &clusters ) {
+
+  clusters = vector<pSVDCluster>();
+  for( int i = 0 ; i < num_clusters ; i++ ) {
+    clusters.push_back( pSVDCluster( new SVDCluster( 0.0 , clus_thresh ) ) );
+  }
+
+  for( int j = 0 , js = molecules.size() ; j < js ; ++j ) {
+    const float *vals_j = coeffs.vals_.row( j );
+    const int *clus_j = coeffs.clus( j );
+    for( int k = 0 , ks = coeffs.top_r() ; k < ks ; ++k ) {
+      if( vals_j[k] > clus_thresh ) {
+        clusters[clus_j[k]]->add_member( pSVDClusMem( new SVDClusterMember( molecules[j] ,
+                                                                            vals_j[k] , 0.0 ) ) );
+      }
+    }
+  }
+
+  vector<TOP_PAIR> top_pairs;
+  get_top_pairs( coeffs , top_pairs );
+  return calculate_fuzzy_sil_score( fp_bits , num_bits , top_pairs , num_clusters , clus_thresh ,
+                                    sil_sample_tol , random_seed );
+
+}
+
+// ****************************************************************************
+// Only the fingerprint bits that vary are used, and only the max_bits most
+// variable of them if max_bits is more than 0. The num_iters restarts are done in
+// parallel, each with its own random numbers from random_seed and the run number,
+// and FuzzyRestartTracker picks the answer as if they'd been done in order, so it
+// only depends on random_seed. If there's only 1 restart, the parallelism is
+// inside it instead. If top_r is more than 0, and less than num_clusters, each
+// molecule only keeps its top_r biggest coefficients, at least
+// MIN_TOP_MEMBERSHIPS of them, renormalised, all the way through, so nothing the
+// size of molecules by clusters is needed. That's an approximation, and how much
+// membership was lost by it goes to cout. If sil_sample_tol is more than 0, the
+// fuzzy silhouette score is estimated from a sample of the molecules, to within a
+// 95% confidence interval that wide.
 void DoFuzzyKMeansCluster( const vector<pMolRec> &molecules ,
                            int num_clusters , int num_iters ,
-                           double clus_thresh , float m ,
+                           double clus_thresh , float m , unsigned int random_seed ,
+                           int max_bits , int top_r , double sil_sample_tol ,
                            vector<pSVDCluster> &clusters , float &sil_score ) {
 
+  // nothing, unless a clustering gets done
+  clusters.clear();
+  sil_score = 0.0F;
+
   if( molecules.empty() ) {
     return;
   }
 
-  vector<vector<float> > fps;
-  get_fingerprints_as_floats( molecules , fps );
-
-#ifdef NOTYET
-  // sneath's data
-  fps.clear();
-  fps = vector<vector<float> >( 16 , vector<float>( 2 , 0.0 ) );
-  fps[0][0] = 0; fps[0][1] = 4;
-  fps[1][0] = 0; fps[1][1] = 3;
-  fps[2][0] = 1; fps[2][1] = 5;
-  fps[3][0] = 2; fps[3][1] = 4;
-  fps[4][0] = 3; fps[4][1] = 3;
-  fps[5][0] = 2; fps[5][1] = 2;
-  fps[6][0] = 2; fps[6][1] = 1;
-  fps[7][0] = 1; fps[7][1] = 0;
-  fps[8][0] = 5; fps[8][1] = 5;
-  fps[9][0] = 6; fps[9][1] = 5;
-  fps[10][0] = 7; fps[10][1] = 6;
-  fps[11][0] = 5; fps[11][1] = 3;
-  fps[12][0] = 7; fps[12][1] = 3;
-  fps[13][0] = 6; fps[13][1] = 2;
-  fps[14][0] = 6; fps[14][1] = 1;
-  fps[15][0] = 8; fps[15][1] = 1;
-  num_clusters = 3;
-#endif
+  vector<int> bit_cols;
+  int num_bits = 0;
+  select_fingerprint_bits( molecules , max_bits , bit_cols , num_bits );
+  // the fingerprints as on bits in the selected columns, which is all the
+  // centroids and the distances to them need
+  vector<vector<int> > fp_bits;
+  int all_bits;
+  get_fingerprints_as_on_bits( molecules , fp_bits , all_bits );
+  for( int i = 0 , is = fp_bits.size() ; i < is ; ++i ) {
+    map_fingerprint_bits( bit_cols , fp_bits[i] );
+  }
 
 #ifdef NOTYET
-  cout << "Input fps " << endl;
-  BOOST_FOREACH( vector<float> cd , fps ) {
-    for_each( cd.begin() , cd.end() , cout << bl::_1 << " " );
+  cout << "Input fp bits " << endl;
+  for( int i = 0 , is = fp_bits.size() ; i < is ; ++i ) {
+    for_each( fp_bits[i].begin() , fp_bits[i].end() , cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
 
-  vector<vector<float> > best_clus_coeffs;
-  vector<vector<float> > best_centroids;
-  float best_j_score = numeric_limits<float>::max();
-
-  int num_bests = 0;
+  num_iters = std::max( num_iters , 0 );
 #ifdef NOTYET
   cout << "Number of clusters : " << num_clusters << endl;
 #endif
 
-  for( int i = 0 ; i < num_iters ; ++i ) {
-
-#ifdef NOTYET
-    cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << endl;
-    cout << "Clustering Iteration " << i << endl;
-#endif
-
-    vector<vector<float> > clus_coeffs; // coefficient of each molecule in each cluster
-    vector<vector<float> > centroids;
-    // clus_coeffs comes back with rows as molecules, columns as clusters, so that
-    // clus_coeffs[i][j] is the contribution of molecule i to cluster j.
-    initialise_clusters( fps.size() , num_clusters , clus_coeffs );
-    float this_j = generate_fuzzy_clusters( fps , num_clusters , m , centroids , clus_coeffs );
-
-    cout << "j score = " << this_j << " best score " << best_j_score
-         << "  discrim : " << fabs( this_j - best_j_score ) << endl;
-    if( fabs( this_j - best_j_score ) < 1.0e-3 ) {
-      // assume if we get the same score three times it's a minimum
-      best_clus_coeffs = clus_coeffs;
-      best_centroids = centroids;
-      ++num_bests;
-      if( num_bests == 3 ) {
-        cout << "Breaking at iteration " << i << " num_bests = " << num_bests << endl;
-        break;
-      }
-    }
-    if( this_j < best_j_score ) {
-      best_j_score = this_j;
-      best_clus_coeffs = clus_coeffs;
-      best_centroids = centroids;
-      num_bests = 1;
+  if( top_r > 0 ) {
+    top_r = std::max( top_r , MIN_TOP_MEMBERSHIPS );
+  }
+  if( top_r > 0 && top_r < num_clusters ) {
+    FuzzyRestartTracker<SparseCoeffs> tracker( num_iters );
+    run_fuzzy_restarts( fp_bits , num_bits , num_clusters , num_iters , m , random_seed ,
+                        SparseFuzzyWorkspace( top_r ) , tracker );
+    const SparseCoeffs &best_clus_coeffs = tracker.best_coeffs();
+    if( best_clus_coeffs.empty() ) {
+      return;
     }
+    report_truncation_error( best_clus_coeffs );
+    sil_score = extract_fuzzy_k_means_clusters( molecules , fp_bits , num_bits ,
+                                                best_clus_coeffs , num_clusters ,
+                                                clus_thresh , sil_sample_tol , random_seed ,
+                                                clusters );
+    return;
+  }
+
+  FuzzyRestartTracker<DenseMatrix> tracker( num_iters );
+  run_fuzzy_restarts( fp_bits , num_bits , num_clusters , num_iters , m , random_seed ,
+                      FuzzyWorkspace() , tracker );
 
+  const DenseMatrix &best_clus_coeffs = tracker.best_coeffs();
+  if( best_clus_coeffs.empty() ) {
+    return;
   }
 
 #ifdef NOTYET
-  cout << "Best j score : " << best_j_score << endl;
-  int i = 0;
-  BOOST_FOREACH( vector<float> c , best_clus_coeffs ) {
-    cout << "coeffs for " << i++ << " : ";
-    for_each( c.begin() , c.end() , cout << bl::_1 << " " );
+  for( int i = 0 , is = best_clus_coeffs.num_rows() ; i < is ; ++i ) {
+    cout << "coeffs for " << i << " : ";
+    for_each( best_clus_coeffs.row( i ) , best_clus_coeffs.row( i ) + best_clus_coeffs.num_cols() ,
+              cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
 
-  sil_score = extract_fuzzy_k_means_clusters( molecules , fps , best_clus_coeffs ,
-                                              clus_thresh , clusters );
+  sil_score = extract_fuzzy_k_means_clusters( molecules , fp_bits , num_bits ,
+                                              best_clus_coeffs , clus_thresh ,
+                                              sil_sample_tol , random_seed , clusters );
 
 }
@@ -12,17 +12,31 @@
 // Takes a vector of MoleculeRec objects and produces k clusters by k-means clustering.
 // The nature of the algorithm requires Euclidean distances
 // as the cluster centroid must be computed and that won't be a bitstring.
+// The fingerprints are kept as lists of on bits, not expanded into floats, and the
+// distances calculated as described in KMeansKernels.H. The starting centroids can
+// be random fingerprints or chosen by k-means++ or k-means||, which spread them
+// out and usually need fewer iterations and restarts. Once the clusters start to
+// settle down, most of the distances don't need calculating at all, as bounds
+// on them show that the fingerprint can't have changed cluster, and the centroids
+// are only adjusted for the fingerprints that have. The centroids are the rows
+// of a DenseMatrix.
 
+#include "DenseMatrix.H"
+#include "KMeansKernels.H"
 #include "MoleculeRec.H"
 #include "SVDClusRDKitDefs.H"
 #include "SVDCluster.H"
 #include "SVDClusterMember.H"
+#include "SilhouetteDistance.H"
 
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int.hpp>
+#include <boost/random/uniform_real.hpp>
 
 #include <GraphMol/RDKitBase.h>
 #include <GraphMol/SmilesParse/SmilesParse.h>
@@ -31,9 +45,11 @@
 #include <DataStructs/BitOps.h>
 
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <string>
 #include <vector>
@@ -60,27 +76,280 @@ public :
 
 // in eponymous file
 float crisp_silhouette_score( const vector<vector<int> > &clus ,
-                              const vector<vector<float> > dists ,
+                              const DenseMatrix &dists ,
                               vector<float> &sil_scores );
+// in DoFuzzyKMeansCluster.cc
+void calc_cluster_bit_fracs( const vector<vector<int> > &clus ,
+                             const vector<vector<int> > &fp_bits , int num_bits ,
+                             DenseMatrix &bit_fracs , vector<double> &mean_on_bits );
+// in DoFuzzyKMeansCluster.cc
+void calc_fp_cluster_dists( const vector<vector<int> > &clus ,
+                            const vector<vector<int> > &fp_bits , int num_bits ,
+                            DenseMatrix &fp_clus_dists );
+// in eponymous file
+float sampled_silhouette_score( const vector<vector<int> > &clus , int num_mols ,
+                                const SilhouetteDistance &sil_dist ,
+                                const vector<float> &weights , bool self_in_own_mean ,
+                                double ci_tol , unsigned int random_seed ,
+                                vector<float> &sil_scores ,
+                                SilhouetteEstimate &estimate );
+void report_silhouette_estimate( const SilhouetteEstimate &estimate );
+
+// Slack for rounding errors when comparing distance bounds. The distances are
+// square roots of bit counts so it's big enough.
+static const double BOUND_TOL = 1.0e-4;
+
+// ****************************************************************************
+// d as a float no bigger than it, for the lower bounds, which are kept in float
+// to halve their size but mustn't be rounded up past the distances they bound
+static inline float round_down( double d ) {
+
+  float f = float( d );
+  if( double( f ) > d ) {
+    f -= fabs( f ) * numeric_limits<float>::epsilon();
+  }
+  return f;
+
+}
+
+// for k-means|| seeding, the number of sampling rounds and the number of candidates
+// per round, as a multiple of the number of clusters
+static const int KMEANS_PAR_ROUNDS = 5;
+static const double KMEANS_PAR_OVERSAMPLING = 2.0;
+
+// ****************************************************************************
+void calc_centroid_norms( const DenseMatrix &centroids ,
+                          vector<double> &centroid_norms ) {
+
+  centroid_norms = vector<double>( centroids.num_rows() , 0.0 );
+  for( int i = 0 , is = centroids.num_rows() ; i < is ; ++i ) {
+    centroid_norms[i] = dense_dot( centroids.row( i ) , centroids.row( i ) ,
+                                   centroids.stride() );
+  }
+
+}
 
-extern boost::random::mt19937 gen;
+// ****************************************************************************
+// The seed for the random number generator of one of several runs, from the
+// master seed the user gave. It's the SplitMix64 mix of the two so that nearby
+// master seeds and run numbers give unrelated sequences.
+unsigned int run_seed( unsigned int master_seed , int run_num ) {
+
+  boost::uint64_t z = ( boost::uint64_t( master_seed ) << 32 ) + run_num;
+  z += 0x9E3779B97F4A7C15ULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return static_cast<unsigned int>( z );
+
+}
 
 // ****************************************************************************
-void initialise_centroids( int num_clusters ,
-                           const vector<vector<float> > &fps ,
-                           vector<vector<float> > &centroids ) {
+// the centroid of a cluster with just the one fingerprint in it
+void fp_as_centroid( const vector<int> &fp_bits , int num_bits ,
+                     float *centroid ) {
+
+  fill( centroid , centroid + num_bits , 0.0F );
+  for( int j = 0 , js = fp_bits.size() ; j < js ; ++j ) {
+    centroid[fp_bits[j]] = 1.0F;
+  }
+
+}
 
+// ****************************************************************************
+// pick one of the indices at random, with probability proportional to its
+// weight. Returns -1 if all the weights are 0.
+int weighted_pick( const vector<double> &weights , boost::random::mt19937 &rng ) {
+
+  vector<double> cum_weights( weights.size() , 0.0 );
+  partial_sum( weights.begin() , weights.end() , cum_weights.begin() );
+  if( cum_weights.empty() || cum_weights.back() <= 0.0 ) {
+    return -1;
+  }
+
+  boost::random::uniform_real_distribution<double> dist( 0.0 , cum_weights.back() );
+  int pick = upper_bound( cum_weights.begin() , cum_weights.end() , dist( rng ) ) - cum_weights.begin();
+  // rounding might put it off the end, or on a weight of 0
+  pick = std::min( pick , int( weights.size() ) - 1 );
+  while( pick > 0 && 0.0 == weights[pick] ) {
+    --pick;
+  }
+  return 0.0 == weights[pick] ? -1 : pick;
+
+}
 
+// ****************************************************************************
+// take the new seeds, seeds[first_new] onwards, into account in the squared
+// distances of the fingerprints listed in fps to their nearest seed, in one pass
+// through the fingerprints. nearest[j] is the number in seeds of the nearest seed
+// to fps[j], the earliest if there's a tie.
+void update_seed_dists( const vector<vector<int> > &fp_bits , int num_bits ,
+                        const vector<int> &fps , const vector<int> &seeds ,
+                        int first_new ,
+                        vector<double> &seed_dists , vector<int> &nearest ) {
+
+  int num_new = seeds.size() - first_new;
+  if( num_new < 1 ) {
+    return;
+  }
+  DenseMatrix seed_cents( num_new , num_bits );
+  vector<double> seed_norms( num_new );
+  for( int i = 0 ; i < num_new ; ++i ) {
+    fp_as_centroid( fp_bits[seeds[first_new + i]] , num_bits , seed_cents.row( i ) );
+    seed_norms[i] = fp_bits[seeds[first_new + i]].size();
+  }
+
+#pragma omp parallel for schedule(dynamic,64)
+  for( int j = 0 ; j < int( fps.size() ) ; ++j ) {
+    for( int i = 0 ; i < num_new ; ++i ) {
+      double sq_dist = sq_dist_to_centroid( fp_bits[fps[j]] , seed_cents.row( i ) , seed_norms[i] );
+      if( sq_dist < seed_dists[j] ) {
+        seed_dists[j] = sq_dist;
+        nearest[j] = first_new + i;
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// k-means++ seeding (D. Arthur and S. Vassilvitskii, Proc. 18th ACM-SIAM Symp.
+// on Discrete Algorithms, 1027-1035 (2007)): the first seed is picked at random
+// from fps and each subsequent one with probability proportional to its weight
+// times its squared distance to the nearest seed so far. The seeds are returned
+// as fingerprint numbers. There may be fewer than num_seeds if there aren't
+// enough different fingerprints.
+void kmeans_pp_seeds( const vector<vector<int> > &fp_bits , int num_bits ,
+                      const vector<int> &fps , const vector<double> &weights ,
+                      int num_seeds , boost::random::mt19937 &rng ,
+                      vector<int> &seeds ) {
+
+  seeds.clear();
+  int first = weighted_pick( weights , rng );
+  if( -1 == first ) {
+    return;
+  }
+  seeds.push_back( fps[first] );
+
+  vector<double> seed_dists( fps.size() , numeric_limits<double>::max() );
+  vector<int> nearest( fps.size() , 0 );
+  vector<double> probs( fps.size() , 0.0 );
+  while( int( seeds.size() ) < num_seeds ) {
+    update_seed_dists( fp_bits , num_bits , fps , seeds , seeds.size() - 1 ,
+                       seed_dists , nearest );
+    for( int j = 0 , js = fps.size() ; j < js ; ++j ) {
+      probs[j] = weights[j] * seed_dists[j];
+    }
+    int next = weighted_pick( probs , rng );
+    if( -1 == next ) {
+      break; // everything's on top of a seed
+    }
+    seeds.push_back( fps[next] );
+  }
+
+}
+
+// ****************************************************************************
+// k-means|| seeding (B. Bahmani et al., Proc. VLDB Endowment, 5, 622-633 (2012)).
+// Rather than one seed per pass through the fingerprints as in k-means++, each
+// round samples about KMEANS_PAR_OVERSAMPLING * num_clusters of them, independently
+// with probability proportional to their squared distance to the candidates so
+// far. After KMEANS_PAR_ROUNDS rounds the candidates are weighted by the number of
+// fingerprints nearest to them and whittled down to num_clusters by k-means++.
+// Each round's candidates are folded into the distances in a single parallel pass,
+// so there are only KMEANS_PAR_ROUNDS + 1 passes through the fingerprints rather
+// than the num_clusters that k-means++ needs.
+void kmeans_parallel_seeds( const vector<vector<int> > &fp_bits , int num_bits ,
+                            int num_clusters , boost::random::mt19937 &rng ,
+                            vector<int> &seeds ) {
+
+  int num_fps = fp_bits.size();
+  vector<int> all_fps( num_fps );
+  for( int j = 0 ; j < num_fps ; ++j ) {
+    all_fps[j] = j;
+  }
+
+  vector<double> seed_dists( num_fps , numeric_limits<double>::max() );
+  vector<int> nearest( num_fps , 0 );
+  vector<unsigned char> is_cand( num_fps , 0 );
+
+  boost::random::uniform_int_distribution<> first_dist( 0 , num_fps - 1 );
+  vector<int> cands( 1 , first_dist( rng ) );
+  is_cand[cands.front()] = 1;
+  update_seed_dists( fp_bits , num_bits , all_fps , cands , 0 , seed_dists , nearest );
+
+  boost::random::uniform_real_distribution<double> uni( 0.0 , 1.0 );
+  for( int r = 0 ; r < KMEANS_PAR_ROUNDS ; ++r ) {
+    double cost = accumulate( seed_dists.begin() , seed_dists.end() , 0.0 );
+    if( cost <= 0.0 ) {
+      break;
+    }
+    double scale = KMEANS_PAR_OVERSAMPLING * num_clusters / cost;
+    vector<int> new_cands;
+    for( int j = 0 ; j < num_fps ; ++j ) {
+      // always draw the number, so the sequence doesn't depend on the distances
+      double r_num = uni( rng );
+      if( !is_cand[j] && r_num < scale * seed_dists[j] ) {
+        new_cands.push_back( j );
+        is_cand[j] = 1;
+      }
+    }
+    if( new_cands.empty() ) {
+      break;
+    }
+    int first_new = cands.size();
+    cands.insert( cands.end() , new_cands.begin() , new_cands.end() );
+    update_seed_dists( fp_bits , num_bits , all_fps , cands , first_new , seed_dists , nearest );
+  }
+
+  vector<double> cand_weights( cands.size() , 0.0 );
+  for( int j = 0 ; j < num_fps ; ++j ) {
+    cand_weights[nearest[j]] += 1.0;
+  }
+#ifdef NOTYET
+  cout << "k-means|| : " << cands.size() << " candidates for " << num_clusters << " seeds." << endl;
+#endif
+
+  kmeans_pp_seeds( fp_bits , num_bits , cands , cand_weights , num_clusters , rng , seeds );
+
+}
+
+// ****************************************************************************
+void initialise_centroids( int num_clusters , KMEANS_SEEDING seeding ,
+                           const vector<vector<int> > &fp_bits , int num_bits ,
+                           boost::random::mt19937 &rng ,
+                           DenseMatrix &centroids ) {
+
+  vector<int> seeds;
+  if( KMEANS_PP_SEEDS == seeding ) {
+    vector<int> all_fps( fp_bits.size() );
+    for( int j = 0 , js = fp_bits.size() ; j < js ; ++j ) {
+      all_fps[j] = j;
+    }
+    kmeans_pp_seeds( fp_bits , num_bits , all_fps , vector<double>( fp_bits.size() , 1.0 ) ,
+                     num_clusters , rng , seeds );
+  } else if( KMEANS_PARALLEL_SEEDS == seeding ) {
+    kmeans_parallel_seeds( fp_bits , num_bits , num_clusters , rng , seeds );
+  }
+
+  centroids.resize( num_clusters , num_bits );
+  vector<unsigned char> selected( fp_bits.size() , 0 );
+  for( int i = 0 , is = seeds.size() ; i < is ; ++i ) {
+    fp_as_centroid( fp_bits[seeds[i]] , num_bits , centroids.row( i ) );
+    selected[seeds[i]] = 1;
+  }
+
+  // random seeds, or make up the numbers if there weren't enough different
+  // fingerprints for the others.
   // A distribution is a function object.  We generate a random
   // number by calling `dist` with the generator.
-  boost::random::uniform_int_distribution<> dist( 0 , fps.size() - 1 );
+  boost::random::uniform_int_distribution<> dist( 0 , fp_bits.size() - 1 );
 
-  vector<unsigned char> selected( fps.size() , 0 );
-  for( int i = 0 ; i < num_clusters ; ++i ) {
+  for( int i = seeds.size() ; i < num_clusters ; ++i ) {
     while( 1 ) {
-      int sel_clus = dist( gen );
+      int sel_clus = dist( rng );
       if( !selected[sel_clus] ) {
-        centroids.push_back( fps[sel_clus] );
+        fp_as_centroid( fp_bits[sel_clus] , num_bits , centroids.row( i ) );
         selected[sel_clus] = 1;
         break;
       }
@@ -90,31 +359,156 @@ void initialise_centroids( int num_clusters ,
 }
 
 // ****************************************************************************
-void rebuild_clusters( const vector<vector<float> > &centroids ,
-                       const vector<vector<float> > &fps ,
-                       vector<vector<CLUS_MEM> > &clus ) {
+// Euclidean distance between two centroids, rows of a DenseMatrix with that stride
+double centroid_separation( const float *c1 , const float *c2 , int stride ) {
+
+  return sqrt( dense_sq_dist( c1 , c2 , stride ) );
+
+}
+
+// ****************************************************************************
+// half the distances between each pair of centroids, and half the distance from
+// each one to its nearest neighbour. A fingerprint closer than half_seps[i] to
+// centroid i can't be closer to any other.
+void calc_half_separations( const DenseMatrix &centroids ,
+                            vector<vector<double> > &half_cent_dists ,
+                            vector<double> &half_seps ) {
+
+  int num_cents = centroids.num_rows();
+  half_cent_dists = vector<vector<double> >( num_cents , vector<double>( num_cents , 0.0 ) );
+#pragma omp parallel for schedule(dynamic)
+  for( int i = 0 ; i < num_cents ; ++i ) {
+    for( int j = i + 1 ; j < num_cents ; ++j ) {
+      half_cent_dists[i][j] = 0.5 * centroid_separation( centroids.row( i ) , centroids.row( j ) ,
+                                                           centroids.stride() );
+    }
+  }
+
+  half_seps = vector<double>( num_cents , numeric_limits<double>::max() );
+  for( int i = 0 ; i < num_cents ; ++i ) {
+    for( int j = i + 1 ; j < num_cents ; ++j ) {
+      half_cent_dists[j][i] = half_cent_dists[i][j];
+      half_seps[i] = std::min( half_seps[i] , half_cent_dists[i][j] );
+      half_seps[j] = std::min( half_seps[j] , half_cent_dists[i][j] );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// Put each fingerprint with its nearest centroid, using Elkan's bounds to avoid
+// most of the distance calculations (C. Elkan, Proc. ICML, 147-153 (2003)).
+// upper[j] is at least the distance from fingerprint j to its centroid assign[j]
+// and lower( j , i ) is at most the distance to centroid i. Centroid i can't be closer
+// than assign[j] if upper[j] is less than lower( j , i ) or half the distance between
+// the two centroids. The bounds are only trusted if they rule a centroid out by more
+// than BOUND_TOL, and ties go to the lowest centroid number, so the result is the
+// same as calculating all the distances. An assign value of -1 means there are no
+// bounds yet.
+void assign_fingerprints( const DenseMatrix &centroids ,
+                          const vector<double> &centroid_norms ,
+                          const vector<vector<int> > &fp_bits ,
+                          vector<int> &assign , vector<double> &upper ,
+                          DenseMatrix &lower , size_t &num_dists_calcd ) {
 
-  clus = vector<vector<CLUS_MEM> >( centroids.size() , vector<CLUS_MEM>() );
+  vector<vector<double> > half_cent_dists;
+  vector<double> half_seps;
+  calc_half_separations( centroids , half_cent_dists , half_seps );
 
-  for( int j = 0 , js = fps.size() ; j < js ; ++j ) {
+  size_t num_calcd = 0;
+  int num_cents = centroids.num_rows();
+#pragma omp parallel for schedule(dynamic,64) reduction(+:num_calcd)
+  for( int j = 0 ; j < int( fp_bits.size() ) ; ++j ) {
+    int best_centroid = assign[j];
+    if( -1 != best_centroid && upper[j] + BOUND_TOL < half_seps[best_centroid] ) {
+      continue;
+    }
+    // the squared distance to best_centroid, if it's been calculated this time
     float best_dist = numeric_limits<float>::max();
-    int best_centroid = -1;
-    for( int i = 0 , is = centroids.size() ; i < is ; ++i ) {
-      float sq_dist = inner_product( fps[j].begin() , fps[j].end() , centroids[i].begin() ,
-                                     0.0 , plus<float>() ,
-                                     ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
+    for( int i = 0 ; i < num_cents ; ++i ) {
+      if( -1 != best_centroid && i != best_centroid ) {
+        if( upper[j] + BOUND_TOL < lower( j , i )
+            || upper[j] + BOUND_TOL < half_cent_dists[best_centroid][i] ) {
+          continue;
+        }
+        if( numeric_limits<float>::max() == best_dist ) {
+          best_dist = sq_dist_to_centroid( fp_bits[j] , centroids.row( best_centroid ) ,
+                                           centroid_norms[best_centroid] );
+          ++num_calcd;
+          upper[j] = sqrt( double( best_dist ) );
+          lower( j , best_centroid ) = round_down( upper[j] );
+          if( upper[j] + BOUND_TOL < lower( j , i )
+              || upper[j] + BOUND_TOL < half_cent_dists[best_centroid][i] ) {
+            continue;
+          }
+        }
+      } else if( i == best_centroid ) {
+        continue; // dealt with as needed when looking at the others
+      }
+      float sq_dist = sq_dist_to_centroid( fp_bits[j] , centroids.row( i ) , centroid_norms[i] );
+      ++num_calcd;
+      double dist = sqrt( double( sq_dist ) );
+      lower( j , i ) = round_down( dist );
 #ifdef NOTYET
       cout << "distance from fp " << j << " to centroid " << i << " = " << sq_dist << endl;
 #endif
-      if( sq_dist < best_dist ) {
+      if( sq_dist < best_dist || ( sq_dist == best_dist && i < best_centroid ) ) {
         best_dist = sq_dist;
         best_centroid = i;
+        upper[j] = dist;
       }
     }
 #ifdef NOTYET
     cout << j << " goes into " << best_centroid << " at dist " << best_dist << endl;
 #endif
-    clus[best_centroid].push_back( make_pair( j , best_dist ) );
+    assign[j] = best_centroid;
+  }
+  num_dists_calcd += num_calcd;
+
+}
+
+#ifdef NOTYET
+// ****************************************************************************
+// check assign against the nearest centroids found by calculating all the
+// distances, with the same tie-break, as assign_fingerprints should give the
+// same result. Returns the number that differ.
+int check_assignments( const DenseMatrix &centroids ,
+                       const vector<double> &centroid_norms ,
+                       const vector<vector<int> > &fp_bits ,
+                       const vector<int> &assign ) {
+
+  int num_diffs = 0;
+  for( int j = 0 , js = fp_bits.size() ; j < js ; ++j ) {
+    int best_centroid = -1;
+    float best_dist = numeric_limits<float>::max();
+    for( int i = 0 , is = centroids.num_rows() ; i < is ; ++i ) {
+      float sq_dist = sq_dist_to_centroid( fp_bits[j] , centroids.row( i ) , centroid_norms[i] );
+      if( sq_dist < best_dist ) {
+        best_dist = sq_dist;
+        best_centroid = i;
+      }
+    }
+    if( best_centroid != assign[j] ) {
+      cout << "fp " << j << " assigned to " << assign[j] << " but nearest is "
+           << best_centroid << " at dist " << best_dist << endl;
+      ++num_diffs;
+    }
+  }
+
+  return num_diffs;
+
+}
+#endif
+
+// ****************************************************************************
+// the clusters from the centroid assignments, without the distances, ordered by
+// their first members
+void rebuild_clusters( const vector<int> &assign , int num_centroids ,
+                       vector<vector<CLUS_MEM> > &clus ) {
+
+  clus = vector<vector<CLUS_MEM> >( num_centroids , vector<CLUS_MEM>() );
+  for( int j = 0 , js = assign.size() ; j < js ; ++j ) {
+    clus[assign[j]].push_back( make_pair( j , 0.0F ) );
   }
 
   // remove any empty clusters, though I'm guessing that's not going to happen
@@ -135,45 +529,118 @@ void rebuild_clusters( const vector<vector<float> > &centroids ,
 }
 
 // ****************************************************************************
-void recalculate_centroids( const vector<vector<CLUS_MEM> > &clus ,
-                            const vector<vector<float> > &fps ,
-                            vector<vector<float> > &centroids ) {
+// Keep the sums of the bits of the fingerprints in each cluster up to date. The
+// fingerprints in moved have just gone from cluster prev_assign to assign,
+// or from nowhere if prev_assign is -1.
+void move_fingerprints( const vector<vector<int> > &fp_bits ,
+                        const vector<int> &moved , const vector<int> &prev_assign ,
+                        const vector<int> &assign ,
+                        vector<vector<int> > &bit_sums , vector<int> &counts ) {
 
-  centroids.clear();
-  for( int i = 0 , is = clus.size() ; i < is ; ++i ) {
-#ifdef NOTYET
-    cout << "Cluster " << i << " size : " << clus[i].size() << endl;
-#endif
-    // assume at least 1 cluster member, which is guaranteed by rebuild_clusters
-    centroids.push_back( fps[clus[i].front().first] );
-    for( int j = 1 , js = clus[i].size() ; j < js ; ++j ) {
-      transform( centroids[i].begin() , centroids[i].end() ,
-                 fps[clus[i][j].first].begin() , centroids[i].begin() , plus<float>() );
-    }
-    float fsize( clus[i].size() );
-    transform( centroids[i].begin() , centroids[i].end() ,
-               centroids[i].begin() , bl::bind( divides<float>() , bl::_1 , fsize ) );
+  for( int m = 0 , ms = moved.size() ; m < ms ; ++m ) {
+    int j = moved[m];
+    const vector<int> &bits = fp_bits[j];
+    if( -1 != prev_assign[j] ) {
+      vector<int> &old_sums = bit_sums[prev_assign[j]];
+      for( int b = 0 , bs = bits.size() ; b < bs ; ++b ) {
+        --old_sums[bits[b]];
+      }
+      --counts[prev_assign[j]];
+    }
+    vector<int> &new_sums = bit_sums[assign[j]];
+    for( int b = 0 , bs = bits.size() ; b < bs ; ++b ) {
+      ++new_sums[bits[b]];
+    }
+    ++counts[assign[j]];
+  }
+
+}
+
+// ****************************************************************************
+// Move the centroids of the clusters that have changed to the means of their
+// members, and the bounds with them. The upper bounds grow by the distance their
+// centroid moved and the lower bounds shrink by the distance theirs did.
+void recalculate_centroids( const vector<int> &changed ,
+                            const vector<vector<int> > &bit_sums ,
+                            const vector<int> &counts ,
+                            DenseMatrix &centroids ,
+                            vector<double> &centroid_norms ,
+                            const vector<int> &assign , vector<double> &upper ,
+                            DenseMatrix &lower ) {
+
+  vector<double> drifts( centroids.num_rows() , 0.0 );
+#pragma omp parallel for schedule(dynamic)
+  for( int c = 0 ; c < int( changed.size() ) ; ++c ) {
+    int i = changed[c];
+    if( !counts[i] ) {
+      continue; // it's about to go
+    }
+    float *cent = centroids.row( i );
+    float fsize( counts[i] );
+    double sq_drift = 0.0 , norm = 0.0;
+    for( int b = 0 , bs = centroids.num_cols() ; b < bs ; ++b ) {
+      float new_val = float( bit_sums[i][b] ) / fsize;
+      sq_drift += ( double( new_val ) - cent[b] ) * ( double( new_val ) - cent[b] );
+      norm += double( new_val ) * new_val;
+      cent[b] = new_val;
+    }
+    drifts[i] = sqrt( sq_drift );
+    centroid_norms[i] = norm;
 #ifdef NOTYET
-    cout << "New centroid : " << clus[i].size() << " : ";
-    for_each( centroids[i].begin() , centroids[i].end() ,
-              cout << bl::_1 << " " );
-    cout << endl;
+    cout << "New centroid " << i << " : " << counts[i] << " members" << endl;
 #endif
   }
 
+  if( changed.empty() ) {
+    return;
+  }
+#pragma omp parallel for schedule(static)
+  for( int j = 0 ; j < int( assign.size() ) ; ++j ) {
+    upper[j] += drifts[assign[j]];
+    for( int c = 0 , cs = changed.size() ; c < cs ; ++c ) {
+      lower( j , changed[c] ) = round_down( double( lower( j , changed[c] ) ) - drifts[changed[c]] );
+    }
+  }
+
 }
 
 // ****************************************************************************
-float compute_cluster_sum_of_squares( const vector<vector<float> > &centroids ,
+// take out any clusters that have lost all their members, though I'm guessing
+// that's not going to happen much
+void remove_empty_clusters( DenseMatrix &centroids ,
+                            vector<double> &centroid_norms ,
+                            vector<vector<int> > &bit_sums , vector<int> &counts ,
+                            vector<int> &assign , DenseMatrix &lower ) {
+
+  for( int i = centroids.num_rows() - 1 ; i >= 0 ; --i ) {
+    if( counts[i] ) {
+      continue;
+    }
+    centroids.erase_row( i );
+    centroid_norms.erase( centroid_norms.begin() + i );
+    bit_sums.erase( bit_sums.begin() + i );
+    counts.erase( counts.begin() + i );
+    for( int j = 0 , js = assign.size() ; j < js ; ++j ) {
+      if( assign[j] > i ) {
+        --assign[j];
+      }
+    }
+    lower.erase_col( i );
+  }
+
+}
+
+// ****************************************************************************
+float compute_cluster_sum_of_squares( const DenseMatrix &centroids ,
+                                      const vector<double> &centroid_norms ,
                                       vector<vector<CLUS_MEM> > &clusters ,
-                                      const vector<vector<float> > &fps ) {
+                                      const vector<vector<int> > &fp_bits ) {
 
   float css = 0.0;
   for( int i = 0 , is = clusters.size() ; i < is ; ++i ) {
     for( int j = 0 , js = clusters[i].size() ; j < js ; ++j ) {
-      clusters[i][j].second = inner_product( fps[clusters[i][j].first].begin() , fps[clusters[i][j].first].end() ,
-                                             centroids[i].begin() , 0.0 , plus<float>() ,
-                                             ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
+      clusters[i][j].second = sq_dist_to_centroid( fp_bits[clusters[i][j].first] ,
+                                                   centroids.row( i ) , centroid_norms[i] );
       css += clusters[i][j].second;
     }
   }
@@ -183,54 +650,132 @@ float compute_cluster_sum_of_squares( const vector<vector<float> > &centroids ,
 }
 
 // ****************************************************************************
-void generate_clusters( const vector<vector<float> > &fps ,
-                        vector<vector<float> > &centroids ,
-                        vector<vector<CLUS_MEM> > &clus ) {
+// Iterate until no more than max_changes fingerprints change cluster in a step.
+// The centroids are kept as sums of their members' bits, so each step only
+// needs to adjust them for the fingerprints that have moved.
+// num_dists_calcd and num_dists_poss are incremented by the number of distances
+// calculated and the number that would have been without the bounds, num_steps
+// by the number of iterations.
+void generate_clusters( const vector<vector<int> > &fp_bits , int num_bits ,
+                        int max_changes ,
+                        DenseMatrix &centroids ,
+                        vector<double> &centroid_norms ,
+                        vector<vector<CLUS_MEM> > &clus ,
+                        size_t &num_dists_calcd , size_t &num_dists_poss ,
+                        int &num_steps ) {
 
-  vector<vector<CLUS_MEM> > curr_clus , new_clus;
+  int num_fps = fp_bits.size();
+  vector<int> assign( num_fps , -1 ) , prev_assign;
+  vector<double> upper( num_fps , 0.0 );
+  // one block for the lower bounds, rather than a vector per fingerprint
+  DenseMatrix lower( num_fps , centroids.num_rows() );
+  vector<vector<int> > bit_sums( centroids.num_rows() , vector<int>( num_bits , 0 ) );
+  vector<int> counts( centroids.num_rows() , 0 );
 
+  calc_centroid_norms( centroids , centroid_norms );
   while( 1 ) {
-    rebuild_clusters( centroids , fps , new_clus );
+    ++num_steps;
+    prev_assign = assign;
+    assign_fingerprints( centroids , centroid_norms , fp_bits , assign ,
+                         upper , lower , num_dists_calcd );
+    num_dists_poss += fp_bits.size() * centroids.num_rows();
 #ifdef NOTYET
-    cout << "New Clusters" << endl;
-    for( int i = 0 , is = new_clus.size() ; i < is ; ++i ) {
-      cout << i << " : " << new_clus[i].size() << " :: ";
-      for_each( new_clus[i].begin() , new_clus[i].end() , cout << bl::bind( &CLUS_MEM::first , bl::_1 ) << " " );
-      cout << endl;
-    }
+    cout << "Step " << num_steps << " : "
+         << check_assignments( centroids , centroid_norms , fp_bits , assign )
+         << " assignments differ from the full calculation" << endl;
 #endif
-    if( new_clus == curr_clus ) {
-      clus = new_clus;
-      return;
+
+    vector<int> moved;
+    vector<char> clus_changed( centroids.num_rows() , 0 );
+    for( int j = 0 ; j < num_fps ; ++j ) {
+      if( assign[j] != prev_assign[j] ) {
+        moved.push_back( j );
+        clus_changed[assign[j]] = 1;
+        if( -1 != prev_assign[j] ) {
+          clus_changed[prev_assign[j]] = 1;
+        }
+      }
     }
-    recalculate_centroids( new_clus , fps , centroids );
-    curr_clus = new_clus;
 #ifdef NOTYET
-    curr_css = compute_cluster_sum_of_squares( centroids , curr_clus , fps );
-    cout << "Within cluster sum of squares : " << curr_css << endl;
+    cout << "Step " << num_steps << " : " << moved.size() << " fingerprints changed cluster" << endl;
 #endif
+    // the first time through, they've all moved
+    if( !num_fps || ( -1 != prev_assign.front() && int( moved.size() ) <= max_changes ) ) {
+      break;
+    }
+
+    move_fingerprints( fp_bits , moved , prev_assign , assign , bit_sums , counts );
+    vector<int> changed;
+    for( int i = 0 , is = clus_changed.size() ; i < is ; ++i ) {
+      if( clus_changed[i] ) {
+        changed.push_back( i );
+      }
+    }
+    recalculate_centroids( changed , bit_sums , counts , centroids , centroid_norms ,
+                           assign , upper , lower );
+    remove_empty_clusters( centroids , centroid_norms , bit_sums , counts ,
+                           assign , lower );
+  }
+
+  // put the clusters, and the centroids to match, into a consistent order
+  rebuild_clusters( assign , centroids.num_rows() , clus );
+  DenseMatrix clus_centroids( clus.size() , centroids.num_cols() );
+  vector<double> clus_norms( clus.size() );
+  for( int i = 0 , is = clus.size() ; i < is ; ++i ) {
+    int cent = assign[clus[i].front().first];
+    copy( centroids.row( cent ) , centroids.row( cent ) + centroids.num_cols() ,
+          clus_centroids.row( i ) );
+    clus_norms[i] = centroid_norms[cent];
   }
+  centroids.swap( clus_centroids );
+  centroid_norms.swap( clus_norms );
+  compute_cluster_sum_of_squares( centroids , centroid_norms , clus , fp_bits );
 
 }
 
 // ****************************************************************************
-void calc_mol_to_centroid_scores( const vector<vector<float> > &fps ,
-                                  const vector<vector<float> > &centroids ,
-                                  vector<vector<float> > &sil_dists ) {
-
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    for( int j = 0 , js = centroids.size() ; j < js ; ++j ) {
-      sil_dists[i][j] = inner_product( fps[i].begin() , fps[i].end() ,
-                                       centroids[j].begin() , 0.0 , plus<float>() ,
-                                       ( bl::_1 - bl::_2 ) * ( bl::_1 - bl::_2 ) );
+void calc_mol_to_centroid_scores( const vector<vector<int> > &fp_bits ,
+                                  const DenseMatrix &centroids ,
+                                  const vector<double> &centroid_norms ,
+                                  DenseMatrix &sil_dists ) {
+
+  sil_dists.resize( fp_bits.size() , centroids.num_rows() );
+  for( int i = 0 , is = fp_bits.size() ; i < is ; ++i ) {
+    for( int j = 0 , js = centroids.num_rows() ; j < js ; ++j ) {
+      sil_dists( i , j ) = sq_dist_to_centroid( fp_bits[i] , centroids.row( j ) , centroid_norms[j] );
 #ifdef NOTYET
-      cout << "mol " << i << " to centroid " << j << " : " << sil_dists[i][j] << endl;
+      cout << "mol " << i << " to centroid " << j << " : " << sil_dists( i , j ) << endl;
 #endif
     }
   }
 
 }
 
+// ****************************************************************************
+// For the exact silhouette score, rather than the one from the distances to the
+// centroids, the mean Hamming distance of each molecule to the other members of
+// each cluster. calc_fp_cluster_dists gets the means from the bit fractions of
+// the clusters in O(N.K.bits on), not from all the pairs. Those include the
+// molecule itself, at distance 0, so the means to its own cluster are scaled to
+// be over the others only, as Rousseeuw has it.
+void calc_exact_sil_dists( const vector<vector<int> > &sil_clus ,
+                           const vector<vector<int> > &fp_bits , int num_bits ,
+                           DenseMatrix &sil_dists ) {
+
+  calc_fp_cluster_dists( sil_clus , fp_bits , num_bits , sil_dists );
+  for( int j = 0 , js = sil_clus.size() ; j < js ; ++j ) {
+    int clus_size = sil_clus[j].size();
+    if( clus_size < 2 ) {
+      continue;
+    }
+    float scale = float( clus_size ) / float( clus_size - 1 );
+    for( int k = 0 ; k < clus_size ; ++k ) {
+      sil_dists( sil_clus[j][k] , j ) *= scale;
+    }
+  }
+
+}
+
 // ****************************************************************************
 void create_sil_clus( const vector<vector<CLUS_MEM> > &clus ,
                       vector<vector<int> > &sil_clus ) {
@@ -244,65 +789,249 @@ void create_sil_clus( const vector<vector<CLUS_MEM> > &clus ,
 }
 
 // ****************************************************************************
-void DoKMeansCluster( const vector<pMolRec> &molecules ,
-                      int num_clusters , int num_iters ,
-                      vector<pSVDCluster> &clusters , float &sil_score ) {
+// Starting centroids for num_clusters clusters from the centroids of an earlier
+// clustering with fewer. Each fingerprint goes with its nearest old centroid and
+// the clusters with the largest sums of squared distances are split, by adding
+// a new centroid on one of their members. This is picked at random with probability
+// proportional to its squared distance from the old centroid, as in k-means++.
+// If more new centroids are needed than there are old ones, the worst clusters
+// are split again.
+void split_centroids( int num_clusters , const vector<vector<int> > &fp_bits ,
+                      int num_bits , const DenseMatrix &old_centroids ,
+                      boost::random::mt19937 &rng ,
+                      DenseMatrix &centroids ) {
 
-  vector<vector<float> > fps;
-  get_fingerprints_as_floats( molecules , fps );
+  int num_old = old_centroids.num_rows();
+  centroids.resize( num_clusters , num_bits );
+  for( int i = 0 ; i < num_old ; ++i ) {
+    copy( old_centroids.row( i ) , old_centroids.row( i ) + num_bits , centroids.row( i ) );
+  }
+  int num_fps = fp_bits.size();
+  vector<double> centroid_norms;
+  calc_centroid_norms( centroids , centroid_norms );
 
-  vector<vector<CLUS_MEM> > best_clus;
-  vector<vector<float> > best_centroids;
-  float best_sil_score = -numeric_limits<float>::max();
-  vector<float> mol_sil_scores , best_sil_scores;
+  vector<int> nearest( num_fps , 0 );
+  vector<double> nearest_dists( num_fps , 0.0 );
+#pragma omp parallel for schedule(dynamic,64)
+  for( int j = 0 ; j < num_fps ; ++j ) {
+    float best_dist = numeric_limits<float>::max();
+    for( int i = 0 ; i < num_old ; ++i ) {
+      float sq_dist = sq_dist_to_centroid( fp_bits[j] , centroids.row( i ) , centroid_norms[i] );
+      if( sq_dist < best_dist ) {
+        best_dist = sq_dist;
+        nearest[j] = i;
+      }
+    }
+    nearest_dists[j] = best_dist;
+  }
+
+  vector<pair<double,int> > sses( num_old );
+  vector<vector<int> > members( num_old );
+  for( int i = 0 ; i < num_old ; ++i ) {
+    sses[i] = make_pair( 0.0 , i );
+  }
+  for( int j = 0 ; j < num_fps ; ++j ) {
+    sses[nearest[j]].first -= nearest_dists[j]; // so the sort puts the largest first
+    members[nearest[j]].push_back( j );
+  }
+  sort( sses.begin() , sses.end() );
+
+  vector<unsigned char> selected( num_fps , 0 );
+  boost::random::uniform_int_distribution<> dist( 0 , num_fps - 1 );
+  for( int n = 0 , ns = num_clusters - num_old ; n < ns ; ++n ) {
+    const vector<int> &mems = members[sses[n % num_old].second];
+    vector<double> weights( mems.size() , 0.0 );
+    for( int j = 0 , js = mems.size() ; j < js ; ++j ) {
+      weights[j] = selected[mems[j]] ? 0.0 : nearest_dists[mems[j]];
+    }
+    int pick = weighted_pick( weights , rng );
+    int new_fp = -1 == pick ? -1 : mems[pick];
+    while( -1 == new_fp || selected[new_fp] ) {
+      new_fp = dist( rng ); // nothing left to split it with, so anywhere will do
+    }
+    selected[new_fp] = 1;
+    fp_as_centroid( fp_bits[new_fp] , num_bits , centroids.row( num_old + n ) );
+  }
+
+}
+
+// ****************************************************************************
+// One k-means run from new seeds, or by splitting warm_centroids if there are any,
+// with the clusters, their centroids and their silhouette scores, exact ones if
+// exact_sil is true. Those are estimated from a sample if sil_sample_tol is more
+// than 0 as well, with the estimate's details in sil_estimate. The ones from the
+// centroids are cheap enough not to need it.
+void k_means_run( const vector<vector<int> > &fp_bits , int num_bits ,
+                  int num_clusters , KMEANS_SEEDING seeding , int max_changes ,
+                  bool exact_sil , double sil_sample_tol ,
+                  const DenseMatrix &warm_centroids ,
+                  boost::random::mt19937 &rng ,
+                  vector<vector<CLUS_MEM> > &clus , DenseMatrix &centroids ,
+                  vector<float> &mol_sil_scores ,
+                  float &sil_score , SilhouetteEstimate &sil_estimate ,
+                  size_t &num_dists_calcd ,
+                  size_t &num_dists_poss , int &num_steps ) {
+
+  if( warm_centroids.empty() ) {
+    initialise_centroids( num_clusters , seeding , fp_bits , num_bits , rng , centroids );
+  } else {
+    split_centroids( num_clusters , fp_bits , num_bits , warm_centroids , rng , centroids );
+  }
+
+  vector<double> centroid_norms;
+  generate_clusters( fp_bits , num_bits , max_changes , centroids , centroid_norms , clus ,
+                     num_dists_calcd , num_dists_poss , num_steps );
+
+  vector<vector<int> > sil_clus;
+  create_sil_clus( clus , sil_clus );
+
+  // the sample estimates the exact score, from the same bit fractions, so it
+  // doesn't need the distances of every molecule
+  if( exact_sil && sil_sample_tol > 0.0 ) {
+    DenseMatrix bit_fracs;
+    vector<double> mean_on_bits;
+    calc_cluster_bit_fracs( sil_clus , fp_bits , num_bits , bit_fracs , mean_on_bits );
+    ClusterBitsSilDistance sil_dist( fp_bits , sil_clus , bit_fracs , mean_on_bits );
+    sil_score = sampled_silhouette_score( sil_clus , fp_bits.size() , sil_dist , vector<float>() ,
+                                          false , sil_sample_tol , rng() , mol_sil_scores ,
+                                          sil_estimate );
+    return;
+  }
+
+  // distances of each molecule to each cluster centroid, for calculation of
+  // silhouette score, or the mean distances to the cluster members for the exact one
+  DenseMatrix sil_dists;
+  if( exact_sil ) {
+    calc_exact_sil_dists( sil_clus , fp_bits , num_bits , sil_dists );
+  } else {
+    calc_mol_to_centroid_scores( fp_bits , centroids , centroid_norms , sil_dists );
+  }
 
-  for( int i = 0 ; i < num_iters ; ++i ) {
 #ifdef NOTYET
-    cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << endl;
-    cout << "Clustering Iteration " << i << endl;
+  for( int i = 0 , is = sil_clus.size() ; i < is ; ++i ) {
+    for_each( sil_clus[i].begin() , sil_clus[i].end() , cout << bl::_1 << " " );
+    cout << endl;
+  }
+  for( int i = 0 , is = sil_dists.num_rows() ; i < is ; ++i ) {
+    cout << i << " : " << sil_dists.num_cols() << " :: ";
+    for_each( sil_dists.row( i ) , sil_dists.row( i ) + sil_dists.num_cols() , cout << bl::_1 << " " );
+    cout << endl;
+  }
 #endif
-    vector<vector<float> > centroids;
-    initialise_centroids( num_clusters , fps , centroids );
 
-    vector<vector<CLUS_MEM> > clus;
-    generate_clusters( fps , centroids , clus );
+  mol_sil_scores.clear();
+  sil_score = crisp_silhouette_score( sil_clus , sil_dists , mol_sil_scores );
+
+}
+
+// ****************************************************************************
+// Only the exact silhouette is sampled, the one from the distances to the
+// centroids being cheap already, so say if a tolerance was asked for without it.
+void warn_sil_sample_tol_ignored( bool exact_sil , double sil_sample_tol ) {
+
+  if( !exact_sil && sil_sample_tol > 0.0 ) {
+    cerr << "Warning - K-Means only samples the exact silhouette, ignoring the tolerance." << endl;
+  }
 
-    // distances of each molecule to each cluster centroid, for calculation of silhouette score
-    vector<vector<float> > sil_dists( molecules.size() , vector<float>( clus.size() , 0.0 ) );
-    calc_mol_to_centroid_scores( fps , centroids , sil_dists );
+}
 
-    vector<vector<int> > sil_clus;
-    create_sil_clus( clus , sil_clus );
+// ****************************************************************************
+// The num_iters runs are independent, so they're done in parallel, each with its
+// own random number generator seeded from random_seed and the run number. The
+// best is the one with the highest silhouette score, the earliest run winning a
+// tie, so the result only depends on random_seed, not the number of threads.
+// If there's only 1 run, the parallelism is inside it instead. Each run stops
+// when no more than a fraction change_tol of the molecules change cluster.
+// If warm_centroids has fewer than num_clusters centroids in it, from a previous
+// call with fewer clusters, the runs start from them, split as needed, rather than
+// from new seeds. Either way, on return it has the centroids of the best run, so
+// a sweep up through the numbers of clusters can start each from the last.
+// Only the fingerprint bits that vary are used, and only the max_bits most
+// variable of them if max_bits is more than 0. The silhouette scores are from
+// the distances to the centroids unless exact_sil is true, when they're from the
+// mean distances to the cluster members, as Rousseeuw intended. If sil_sample_tol
+// is more than 0 as well, those are estimated from a sample of the molecules
+// instead, to within a 95% confidence interval that wide.
+void DoKMeansCluster( const vector<pMolRec> &molecules ,
+                      int num_clusters , int num_iters , KMEANS_SEEDING seeding ,
+                      unsigned int random_seed , double change_tol ,
+                      int max_bits , bool exact_sil , double sil_sample_tol ,
+                      DenseMatrix &warm_centroids ,
+                      vector<pSVDCluster> &clusters , float &sil_score ) {
+
+  // nothing, unless a clustering gets done
+  clusters.clear();
+  sil_score = 0.0F;
+
+  vector<vector<int> > fp_bits;
+  int num_bits;
+  get_fingerprints_as_on_bits( molecules , fp_bits , num_bits );
+  if( fp_bits.empty() ) {
+    return;
+  }
+  vector<int> bit_cols;
+  select_fingerprint_bits( molecules , max_bits , bit_cols , num_bits );
+  for( int j = 0 , js = fp_bits.size() ; j < js ; ++j ) {
+    map_fingerprint_bits( bit_cols , fp_bits[j] );
+  }
+
+  num_iters = std::max( num_iters , 0 );
+  int max_changes = int( change_tol * fp_bits.size() );
+  vector<vector<vector<CLUS_MEM> > > run_clus( num_iters );
+  vector<DenseMatrix> run_centroids( num_iters );
+  if( warm_centroids.num_rows() >= num_clusters ) {
+    warm_centroids.clear();
+  }
+  vector<vector<float> > run_mol_sil_scores( num_iters );
+  vector<float> run_sil_scores( num_iters , -numeric_limits<float>::max() );
+  vector<SilhouetteEstimate> run_sil_estimates( num_iters );
+  size_t num_dists_calcd = 0 , num_dists_poss = 0;
+  int num_steps = 0;
 
+#pragma omp parallel for schedule(dynamic) if( num_iters > 1 ) reduction(+:num_dists_calcd,num_dists_poss,num_steps)
+  for( int i = 0 ; i < num_iters ; ++i ) {
 #ifdef NOTYET
-    for( int i = 0 , is = sil_clus.size() ; i < is ; ++i ) {
-      for_each( sil_clus[i].begin() , sil_clus[i].end() , cout << bl::_1 << " " );
-      cout << endl;
-    }
-    for( int i = 0 , is = sil_dists.size() ; i < is ; ++i ) {
-      cout << i << " : " << sil_dists[i].size() << " :: ";
-      for_each( sil_dists[i].begin() , sil_dists[i].end() , cout << bl::_1 << " " );
-      cout << endl;
-    }
+    cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << endl;
+    cout << "Clustering Iteration " << i << endl;
 #endif
-
-    mol_sil_scores.clear();
-    sil_score = crisp_silhouette_score( sil_clus , sil_dists , mol_sil_scores );
+    boost::random::mt19937 rng( run_seed( random_seed , i ) );
+    k_means_run( fp_bits , num_bits , num_clusters , seeding , max_changes ,
+                 exact_sil , sil_sample_tol , warm_centroids , rng , run_clus[i] , run_centroids[i] ,
+                 run_mol_sil_scores[i] , run_sil_scores[i] , run_sil_estimates[i] ,
+                 num_dists_calcd , num_dists_poss , num_steps );
 #ifdef NOTYET
-    cout << "sil_score for iteration " << i << " : " << sil_score << endl;
+    cout << "sil_score for iteration " << i << " : " << run_sil_scores[i] << endl;
 #endif
-    if( sil_score > best_sil_score ) {
+  }
+
+  int best_run = -1;
+  float best_sil_score = -numeric_limits<float>::max();
+  for( int i = 0 ; i < num_iters ; ++i ) {
+    if( run_sil_scores[i] > best_sil_score ) {
 #ifdef NOTYET
-      cout << "Best sil score " << sil_score << " for iteration " << i << endl;
+      cout << "Best sil score " << run_sil_scores[i] << " for iteration " << i << endl;
 #endif
-      best_sil_score = sil_score;
-      best_clus = clus;
-      best_sil_scores = mol_sil_scores;
-      best_centroids = centroids;
+      best_sil_score = run_sil_scores[i];
+      best_run = i;
     }
   }
+  if( -1 == best_run ) {
+    return;
+  }
+  sil_score = best_sil_score;
+  warm_centroids.swap( run_centroids[best_run] );
+  if( exact_sil && sil_sample_tol > 0.0 ) {
+    report_silhouette_estimate( run_sil_estimates[best_run] );
+  }
+
+  if( num_dists_poss ) {
+    cout << "K-Means took " << double( num_steps ) / double( num_iters )
+         << " iterations per run on average and skipped "
+         << 100.0 * double( num_dists_poss - num_dists_calcd ) / double( num_dists_poss )
+         << "% of the fingerprint to centroid distance calculations." << endl;
+  }
 
-  extract_clusters( molecules , best_clus , best_sil_scores , clusters );
+  extract_clusters( molecules , run_clus[best_run] , run_mol_sil_scores[best_run] , clusters );
   sort( clusters.begin() , clusters.end() ,
         boost::bind( greater<int>() ,
                      boost::bind( &SVDCluster::size , _1 ) ,
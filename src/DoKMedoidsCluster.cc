@@ -0,0 +1,518 @@
+//
+// File DoKMedoidsCluster.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// Takes a vector of MoleculeRec objects and produces k clusters by k-medoids
+// clustering. Unlike k-means, the cluster centres are molecules, so the distances
+// can be 1 - Tversky similarity straight from the bits, using the popcounts of
+// PackedFingerprints, and there's never anything bigger than the packed
+// fingerprints in memory, the silhouette scores included. The swaps of medoids for non-medoids are searched by
+// FasterPAM (Schubert and Rousseeuw, Information Systems, 101, 101804 (2021)),
+// which keeps the nearest and second nearest medoid of every molecule so that each
+// candidate swap is evaluated against all k medoids in one pass over the molecules.
+// For large numbers of molecules, that's still O(N^2) per pass, so it's done on
+// random samples as in CLARA (Kaufman and Rousseeuw, Finding Groups in Data (1990)),
+// each sample starting with the best medoids found so far, and all molecules then
+// assigned to the medoids of the best sample.
+
+#include "MoleculeRec.H"
+#include "PackedFingerprints.H"
+#include "SVDClusRDKitDefs.H"
+#include "SVDCluster.H"
+#include "SVDClusterMember.H"
+
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// in DoKMeansCluster.cc
+unsigned int run_seed( unsigned int master_seed , int run_num );
+int weighted_pick( const vector<double> &weights , boost::random::mt19937 &rng );
+
+// the number of candidate swaps evaluated in parallel before the best of them is
+// made. Fixed, rather than the number of threads, so the result doesn't depend on it.
+static const int SWAP_BLOCK_SIZE = 64;
+// a cap on the passes through the candidates, which are rarely more than a handful
+static const int MAX_SWAP_PASSES = 100;
+// swaps that improve the total deviation by less than this are rounding noise
+static const double SWAP_TOL = 1.0e-9;
+// further than any 1 - Tversky distance, for the second nearest of 1 medoid
+static const double NO_MEDOID_DIST = 2.0;
+
+// ****************************************************************************
+// The distances of a set of molecules to their nearest and second nearest medoids,
+// and the slot in the medoids vector of each.
+class MedoidCache {
+
+public :
+
+  vector<int> nearest_ , second_;
+  vector<double> near_dist_ , second_dist_;
+
+  void resize( int n ) {
+    nearest_.resize( n ); second_.resize( n );
+    near_dist_.resize( n ); second_dist_.resize( n );
+  }
+
+};
+
+// ****************************************************************************
+inline double medoid_dist( const PackedFingerprints &pfps , int i , int j ,
+                           double tversky_alpha , double tversky_beta ) {
+
+  return 1.0 - pfps.tversky( i , j , tversky_alpha , tversky_beta );
+
+}
+
+// ****************************************************************************
+// find the nearest and second nearest medoids to molecule mol by looking at all
+// of them. The first one wins a tie.
+void scan_medoids( const PackedFingerprints &pfps , int mol , const vector<int> &medoids ,
+                   double tversky_alpha , double tversky_beta ,
+                   int &nearest , double &near_dist , int &second , double &second_dist ) {
+
+  nearest = second = -1;
+  near_dist = second_dist = NO_MEDOID_DIST;
+  for( int k = 0 , ks = medoids.size() ; k < ks ; ++k ) {
+    double d = medoid_dist( pfps , mol , medoids[k] , tversky_alpha , tversky_beta );
+    if( d < near_dist ) {
+      second = nearest;
+      second_dist = near_dist;
+      nearest = k;
+      near_dist = d;
+    } else if( d < second_dist ) {
+      second = k;
+      second_dist = d;
+    }
+  }
+
+}
+
+// ****************************************************************************
+void fill_medoid_cache( const PackedFingerprints &pfps , const vector<int> &mols ,
+                        const vector<int> &medoids , double tversky_alpha ,
+                        double tversky_beta , MedoidCache &cache ) {
+
+  cache.resize( mols.size() );
+#pragma omp parallel for schedule(static)
+  for( int i = 0 ; i < int( mols.size() ) ; ++i ) {
+    scan_medoids( pfps , mols[i] , medoids , tversky_alpha , tversky_beta ,
+                  cache.nearest_[i] , cache.near_dist_[i] ,
+                  cache.second_[i] , cache.second_dist_[i] );
+  }
+
+}
+
+// ****************************************************************************
+// the increase in total deviation from taking each medoid away, leaving the others
+void calc_removal_loss( const MedoidCache &cache , int num_medoids ,
+                        vector<double> &removal_loss ) {
+
+  removal_loss.assign( num_medoids , 0.0 );
+  for( int i = 0 , is = cache.nearest_.size() ; i < is ; ++i ) {
+    removal_loss[cache.nearest_[i]] += cache.second_dist_[i] - cache.near_dist_[i];
+  }
+
+}
+
+// ****************************************************************************
+// The change in total deviation of the best swap of molecule mols[cand] for one
+// of the medoids, which comes back in best_slot. delta_td is workspace. One pass
+// over the molecules does all the medoids at once, as in FasterPAM.
+double evaluate_swap( const PackedFingerprints &pfps , const vector<int> &mols ,
+                      int cand , const MedoidCache &cache ,
+                      const vector<double> &removal_loss ,
+                      double tversky_alpha , double tversky_beta ,
+                      vector<double> &delta_td , int &best_slot ) {
+
+  delta_td = removal_loss;
+  double acc = 0.0;
+  for( int o = 0 , os = mols.size() ; o < os ; ++o ) {
+    double doj = medoid_dist( pfps , mols[o] , mols[cand] , tversky_alpha , tversky_beta );
+    if( doj < cache.near_dist_[o] ) {
+      // o would move to the candidate whichever medoid went, so it no longer
+      // counts towards the loss of its nearest
+      acc += doj - cache.near_dist_[o];
+      delta_td[cache.nearest_[o]] += cache.near_dist_[o] - cache.second_dist_[o];
+    } else if( doj < cache.second_dist_[o] ) {
+      // o would only move if its nearest medoid went
+      delta_td[cache.nearest_[o]] += doj - cache.second_dist_[o];
+    }
+  }
+
+  best_slot = min_element( delta_td.begin() , delta_td.end() ) - delta_td.begin();
+  return delta_td[best_slot] + acc;
+
+}
+
+// ****************************************************************************
+// medoids[slot] has been replaced, so bring the cache up to date. Only the
+// molecules whose nearest or second nearest it was need to look at all the medoids.
+void update_medoid_cache( const PackedFingerprints &pfps , const vector<int> &mols ,
+                          const vector<int> &medoids , int slot ,
+                          double tversky_alpha , double tversky_beta ,
+                          MedoidCache &cache ) {
+
+  int new_med = medoids[slot];
+#pragma omp parallel for schedule(static)
+  for( int o = 0 ; o < int( mols.size() ) ; ++o ) {
+    if( slot == cache.nearest_[o] || slot == cache.second_[o] ) {
+      scan_medoids( pfps , mols[o] , medoids , tversky_alpha , tversky_beta ,
+                    cache.nearest_[o] , cache.near_dist_[o] ,
+                    cache.second_[o] , cache.second_dist_[o] );
+      continue;
+    }
+    double d = medoid_dist( pfps , mols[o] , new_med , tversky_alpha , tversky_beta );
+    if( d < cache.near_dist_[o] ) {
+      cache.second_[o] = cache.nearest_[o];
+      cache.second_dist_[o] = cache.near_dist_[o];
+      cache.nearest_[o] = slot;
+      cache.near_dist_[o] = d;
+    } else if( d < cache.second_dist_[o] ) {
+      cache.second_[o] = slot;
+      cache.second_dist_[o] = d;
+    }
+  }
+
+}
+
+// ****************************************************************************
+// Starting medoids for the molecules in mols, as in k-means++: the first at
+// random, the rest picked with probability proportional to the squared distance
+// to the nearest already picked. Any in init_medoids, which are molecule numbers,
+// go first. medoids come back as positions in mols.
+void seed_medoids( const PackedFingerprints &pfps , const vector<int> &mols ,
+                   int num_medoids , const vector<int> &init_medoids ,
+                   double tversky_alpha , double tversky_beta ,
+                   boost::random::mt19937 &rng , vector<int> &medoids ) {
+
+  medoids.clear();
+  for( int i = 0 , is = mols.size() ; i < is ; ++i ) {
+    if( find( init_medoids.begin() , init_medoids.end() , mols[i] ) != init_medoids.end() ) {
+      medoids.push_back( i );
+    }
+  }
+  if( medoids.empty() ) {
+    boost::random::uniform_int_distribution<int> dist( 0 , mols.size() - 1 );
+    medoids.push_back( dist( rng ) );
+  }
+
+  vector<double> weights( mols.size() , numeric_limits<double>::max() );
+  for( int k = 0 , ks = medoids.size() ; k < ks ; ++k ) {
+    for( int i = 0 , is = mols.size() ; i < is ; ++i ) {
+      double d = medoid_dist( pfps , mols[i] , mols[medoids[k]] , tversky_alpha , tversky_beta );
+      weights[i] = std::min( weights[i] , d * d );
+    }
+  }
+
+  while( int( medoids.size() ) < num_medoids ) {
+    int pick = weighted_pick( weights , rng );
+    if( -1 == pick ) {
+      // everything left is a duplicate of a medoid
+      break;
+    }
+    medoids.push_back( pick );
+#pragma omp parallel for schedule(static)
+    for( int i = 0 ; i < int( mols.size() ) ; ++i ) {
+      double d = medoid_dist( pfps , mols[i] , mols[pick] , tversky_alpha , tversky_beta );
+      weights[i] = std::min( weights[i] , d * d );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// FasterPAM on the molecules in mols, improving medoids (positions in mols) until
+// a whole pass through the candidates finds no swap that helps. The candidates
+// are evaluated SWAP_BLOCK_SIZE at a time in parallel and the best swap in each
+// block made, the first candidate winning a tie, so it's deterministic.
+void pam_swaps( const PackedFingerprints &pfps , const vector<int> &mols ,
+                double tversky_alpha , double tversky_beta ,
+                vector<int> &medoids , int &num_swaps ) {
+
+  int num_mols = mols.size() , num_medoids = medoids.size();
+  vector<int> med_mols( num_medoids );
+  for( int k = 0 ; k < num_medoids ; ++k ) {
+    med_mols[k] = mols[medoids[k]];
+  }
+  vector<char> is_medoid( num_mols , 0 );
+  for( int k = 0 ; k < num_medoids ; ++k ) {
+    is_medoid[medoids[k]] = 1;
+  }
+
+  MedoidCache cache;
+  fill_medoid_cache( pfps , mols , med_mols , tversky_alpha , tversky_beta , cache );
+  vector<double> removal_loss;
+  calc_removal_loss( cache , num_medoids , removal_loss );
+
+  vector<double> block_deltas( SWAP_BLOCK_SIZE );
+  vector<int> block_slots( SWAP_BLOCK_SIZE );
+
+  // the candidates evaluated since the last swap, not counting the ones in its
+  // block, which were evaluated against the medoids from before it
+  num_swaps = 0;
+  int evals_since_swap = 0 , max_evals = MAX_SWAP_PASSES * num_mols;
+  for( int first_cand = 0 , num_evals = 0 ; num_evals < max_evals ; ) {
+    int block_size = std::min( SWAP_BLOCK_SIZE , num_mols - first_cand );
+#pragma omp parallel
+    {
+      vector<double> delta_td;
+#pragma omp for schedule(dynamic)
+      for( int b = 0 ; b < block_size ; ++b ) {
+        block_deltas[b] = numeric_limits<double>::max();
+        if( !is_medoid[first_cand + b] ) {
+          block_deltas[b] = evaluate_swap( pfps , mols , first_cand + b , cache , removal_loss ,
+                                           tversky_alpha , tversky_beta , delta_td , block_slots[b] );
+        }
+      }
+    }
+
+    int best_b = min_element( block_deltas.begin() , block_deltas.begin() + block_size ) - block_deltas.begin();
+    if( block_deltas[best_b] < -SWAP_TOL ) {
+      int slot = block_slots[best_b];
+#ifdef NOTYET
+      cout << "swap " << mols[medoids[slot]] << " for " << mols[first_cand + best_b]
+           << " : " << block_deltas[best_b] << endl;
+#endif
+      is_medoid[medoids[slot]] = 0;
+      medoids[slot] = first_cand + best_b;
+      is_medoid[medoids[slot]] = 1;
+      med_mols[slot] = mols[medoids[slot]];
+      update_medoid_cache( pfps , mols , med_mols , slot , tversky_alpha , tversky_beta , cache );
+      calc_removal_loss( cache , num_medoids , removal_loss );
+      evals_since_swap = 0;
+      ++num_swaps;
+    } else {
+      evals_since_swap += block_size;
+    }
+
+    num_evals += block_size;
+    first_cand += block_size;
+    if( first_cand == num_mols ) {
+      first_cand = 0;
+    }
+    if( evals_since_swap >= num_mols ) {
+      // every candidate has been evaluated against the current medoids
+      break;
+    }
+  }
+
+}
+
+// ****************************************************************************
+// the total deviation of all the molecules in mols from their nearest medoid,
+// which is the molecule number here.
+double total_deviation( const PackedFingerprints &pfps , const vector<int> &mols ,
+                        const vector<int> &med_mols , double tversky_alpha ,
+                        double tversky_beta ) {
+
+  double td = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:td)
+  for( int i = 0 ; i < int( mols.size() ) ; ++i ) {
+    double near_dist = numeric_limits<double>::max();
+    for( int k = 0 , ks = med_mols.size() ; k < ks ; ++k ) {
+      near_dist = std::min( near_dist , medoid_dist( pfps , mols[i] , med_mols[k] ,
+                                                     tversky_alpha , tversky_beta ) );
+    }
+    td += near_dist;
+  }
+  return td;
+
+}
+
+// ****************************************************************************
+// sample_size of the molecules in fp_mols at random, starting with the ones in
+// keep, in the order they are in fp_mols.
+void sample_molecules( const vector<int> &fp_mols , int sample_size ,
+                       const vector<int> &keep , boost::random::mt19937 &rng ,
+                       vector<int> &sample ) {
+
+  vector<char> in_sample( fp_mols.size() , 0 );
+  int num_in = 0;
+  for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+    if( find( keep.begin() , keep.end() , fp_mols[i] ) != keep.end() ) {
+      in_sample[i] = 1;
+      ++num_in;
+    }
+  }
+
+  // partial Fisher-Yates shuffle of the positions not already in
+  vector<int> rest;
+  for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+    if( !in_sample[i] ) {
+      rest.push_back( i );
+    }
+  }
+  for( int i = 0 , is = rest.size() ; i < is && num_in < sample_size ; ++i , ++num_in ) {
+    boost::random::uniform_int_distribution<int> dist( i , is - 1 );
+    swap( rest[i] , rest[dist( rng )] );
+    in_sample[rest[i]] = 1;
+  }
+
+  sample.clear();
+  for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+    if( in_sample[i] ) {
+      sample.push_back( fp_mols[i] );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// The clusters from the medoids, the similarity of each member to its medoid as
+// its value so the medoid is first, and the silhouette scores. Those are from
+// each molecule's distances to its nearest and second nearest medoids, as the
+// swaps use, so nothing the size of the molecules by the medoids is needed.
+// A medoid that gets no members, being a duplicate of another, is dropped, and
+// the molecules are looked at again without it so that it isn't anyone's second
+// nearest.
+void assign_to_medoids( const PackedFingerprints &pfps , const vector<int> &fp_mols ,
+                        const vector<int> &med_mols , double tversky_alpha ,
+                        double tversky_beta , vector<vector<CLUS_MEM> > &clus ,
+                        vector<float> &mol_sil_scores , float &sil_score ) {
+
+  vector<int> live_med_mols( med_mols );
+  MedoidCache cache;
+  while( true ) {
+    fill_medoid_cache( pfps , fp_mols , live_med_mols , tversky_alpha , tversky_beta , cache );
+    vector<char> has_mems( live_med_mols.size() , 0 );
+    for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+      has_mems[cache.nearest_[i]] = 1;
+    }
+    if( count( has_mems.begin() , has_mems.end() , 0 ) == 0 ) {
+      break;
+    }
+    vector<int> new_med_mols;
+    for( int k = 0 , ks = live_med_mols.size() ; k < ks ; ++k ) {
+      if( has_mems[k] ) {
+        new_med_mols.push_back( live_med_mols[k] );
+      }
+    }
+    live_med_mols.swap( new_med_mols );
+  }
+
+  int num_medoids = live_med_mols.size();
+  clus = vector<vector<CLUS_MEM> >( num_medoids , vector<CLUS_MEM>() );
+  for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+    clus[cache.nearest_[i]].push_back( make_pair( fp_mols[i] , float( 1.0 - cache.near_dist_[i] ) ) );
+  }
+
+  // as crisp_silhouette_score, with the distances to the medoids as the distances
+  // to the clusters. With only one medoid there's no other cluster to compare with,
+  // so the scores stay at 0.
+  mol_sil_scores = vector<float>( pfps.num_fps() , 0.0F );
+  float css = 0.0F;
+  for( int i = 0 , is = fp_mols.size() ; i < is ; ++i ) {
+    if( 1 == clus[cache.nearest_[i]].size() || -1 == cache.second_[i] ) {
+      continue;
+    }
+    float ai = cache.near_dist_[i];
+    float bi = cache.second_dist_[i];
+    float si = 0.0F;
+    if( ai != bi ) {
+      si = ( bi - ai ) / std::max( bi , ai );
+    }
+    mol_sil_scores[fp_mols[i]] = si;
+    css += si;
+  }
+  sil_score = fp_mols.empty() ? 0.0F : css / float( fp_mols.size() );
+
+}
+
+// ****************************************************************************
+// Cluster the molecules with fingerprints round num_clusters medoids, the
+// distances being 1 - Tversky similarity with the given alpha and beta. If there
+// are more than sample_size molecules, and sample_size is more than 0, the medoids
+// come from the best of num_samples CLARA samples of sample_size molecules,
+// judged by the total distance of all the molecules to their nearest medoid.
+// The random numbers are seeded from random_seed, so the same seed gives the
+// same clusters however many threads there are.
+void DoKMedoidsCluster( const vector<pMolRec> &molecules ,
+                        int num_clusters , double tversky_alpha , double tversky_beta ,
+                        int sample_size , int num_samples , unsigned int random_seed ,
+                        vector<pSVDCluster> &clusters , float &sil_score ) {
+
+  // nothing, unless a clustering gets done
+  clusters.clear();
+  sil_score = 0.0F;
+
+  PackedFingerprints pfps( molecules );
+  vector<int> fp_mols;
+  for( int i = 0 , is = pfps.num_fps() ; i < is ; ++i ) {
+    if( pfps.has_fp( i ) ) {
+      fp_mols.push_back( i );
+    }
+  }
+  num_clusters = std::min( num_clusters , int( fp_mols.size() ) );
+  if( num_clusters < 1 ) {
+    return;
+  }
+
+  if( sample_size <= 0 || sample_size >= int( fp_mols.size() ) ) {
+    sample_size = fp_mols.size();
+    num_samples = 1;
+  }
+  // the sample must have room for the medoids and some more
+  sample_size = std::min( int( fp_mols.size() ) , std::max( sample_size , 2 * num_clusters ) );
+  num_samples = std::max( num_samples , 1 );
+
+  vector<int> best_med_mols;
+  double best_td = numeric_limits<double>::max();
+  int tot_swaps = 0;
+  for( int s = 0 ; s < num_samples ; ++s ) {
+    boost::random::mt19937 rng( run_seed( random_seed , s ) );
+    vector<int> sample;
+    sample_molecules( fp_mols , sample_size , best_med_mols , rng , sample );
+
+    vector<int> medoids;
+    seed_medoids( pfps , sample , num_clusters , best_med_mols , tversky_alpha , tversky_beta ,
+                  rng , medoids );
+    int num_swaps = 0;
+    pam_swaps( pfps , sample , tversky_alpha , tversky_beta , medoids , num_swaps );
+    tot_swaps += num_swaps;
+
+    vector<int> med_mols( medoids.size() );
+    for( int k = 0 , ks = medoids.size() ; k < ks ; ++k ) {
+      med_mols[k] = sample[medoids[k]];
+    }
+    double td = num_samples > 1 ?
+          total_deviation( pfps , fp_mols , med_mols , tversky_alpha , tversky_beta ) : 0.0;
+#ifdef NOTYET
+    cout << "sample " << s << " : " << num_swaps << " swaps, total deviation " << td << endl;
+#endif
+    if( td < best_td ) {
+      best_td = td;
+      best_med_mols = med_mols;
+    }
+  }
+
+  cout << "K-Medoids made " << tot_swaps << " swaps in " << num_samples << " sample"
+       << ( 1 == num_samples ? "" : "s" ) << " of " << sample_size << " molecules." << endl;
+
+  vector<vector<CLUS_MEM> > clus;
+  vector<float> mol_sil_scores;
+  assign_to_medoids( pfps , fp_mols , best_med_mols , tversky_alpha , tversky_beta ,
+                     clus , mol_sil_scores , sil_score );
+
+  extract_clusters( molecules , clus , mol_sil_scores , clusters );
+  sort( clusters.begin() , clusters.end() ,
+        boost::bind( greater<int>() ,
+                     boost::bind( &SVDCluster::size , _1 ) ,
+                     boost::bind( &SVDCluster::size , _2 ) ) );
+
+}
@@ -0,0 +1,407 @@
+//
+// File DoMiniBatchKMeansCluster.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// Mini-batch k-means (D. Sculley, Proc. 19th Int. Conf. on World Wide Web, 1177-1178
+// (2010)) for datasets too big for a full k-means iteration over all the fingerprints
+// each time. The centroids are updated from random batches of fingerprints, taken
+// from the molecules as they're needed rather than all extracted up front. Each
+// centroid has a learning rate of 1 over the number of fingerprints that have
+// been assigned to it so far, so it's the running mean of them. It stops when no
+// centroid moves more than MINI_BATCH_SHIFT_TOL in a batch, and finally puts every
+// molecule into the cluster of its nearest centroid in one more pass. The clusters
+// are the same as DoKMeansCluster produces.
+
+#include "DenseMatrix.H"
+#include "KMeansKernels.H"
+#include "MoleculeRec.H"
+#include "SVDClusRDKitDefs.H"
+#include "SVDCluster.H"
+#include "SVDClusterMember.H"
+
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+
+#include <DataStructs/ExplicitBitVect.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// in DoKMeansCluster.cc
+void calc_centroid_norms( const DenseMatrix &centroids ,
+                          vector<double> &centroid_norms );
+void initialise_centroids( int num_clusters , KMEANS_SEEDING seeding ,
+                           const vector<vector<int> > &fp_bits , int num_bits ,
+                           boost::random::mt19937 &rng ,
+                           DenseMatrix &centroids );
+void rebuild_clusters( const vector<int> &assign , int num_centroids ,
+                       vector<vector<CLUS_MEM> > &clus );
+unsigned int run_seed( unsigned int master_seed , int run_num );
+
+// stop when no centroid moves further than this in a batch
+static const double MINI_BATCH_SHIFT_TOL = 1.0e-2;
+// or after this many batches
+static const int MAX_MINI_BATCHES = 1000;
+// the seeds are picked from a sample of at least this many times the number of clusters
+static const int SEED_SAMPLE_FACTOR = 10;
+
+// ****************************************************************************
+// the on bits of the fingerprints of the molecules given by fp_mols[batch[i]], in
+// their columns from bit_cols
+void fetch_batch_fps( const vector<pMolRec> &molecules , const vector<int> &fp_mols ,
+                      const vector<int> &bit_cols ,
+                      const vector<int> &batch , vector<vector<int> > &batch_bits ) {
+
+  batch_bits.resize( batch.size() );
+  for( int i = 0 , is = batch.size() ; i < is ; ++i ) {
+    batch_bits[i].clear();
+    molecules[fp_mols[batch[i]]]->get_fingerprint()->getOnBits( batch_bits[i] );
+    map_fingerprint_bits( bit_cols , batch_bits[i] );
+  }
+
+}
+
+// ****************************************************************************
+// the nearest centroid to each fingerprint, ties going to the lowest number
+void nearest_centroids( const vector<vector<int> > &fp_bits ,
+                        const DenseMatrix &centroids ,
+                        const vector<double> &centroid_norms ,
+                        vector<int> &nearest , vector<float> &nearest_dists ) {
+
+  nearest.resize( fp_bits.size() );
+  nearest_dists.resize( fp_bits.size() );
+#pragma omp parallel for schedule(dynamic,64)
+  for( int j = 0 ; j < int( fp_bits.size() ) ; ++j ) {
+    nearest[j] = -1;
+    nearest_dists[j] = numeric_limits<float>::max();
+    for( int i = 0 , is = centroids.num_rows() ; i < is ; ++i ) {
+      float sq_dist = sq_dist_to_centroid( fp_bits[j] , centroids.row( i ) , centroid_norms[i] );
+      if( sq_dist < nearest_dists[j] ) {
+        nearest_dists[j] = sq_dist;
+        nearest[j] = i;
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// Move each centroid to the mean of all the fingerprints assigned to it so far,
+// counts being the number before this batch. Returns the furthest any centroid
+// moved.
+double update_centroids( const vector<vector<int> > &batch_bits ,
+                         const vector<int> &nearest ,
+                         DenseMatrix &centroids ,
+                         vector<int> &counts ) {
+
+  int num_cents = centroids.num_rows();
+  vector<vector<int> > members( num_cents );
+  for( int j = 0 , js = nearest.size() ; j < js ; ++j ) {
+    members[nearest[j]].push_back( j );
+  }
+
+  double max_shift = 0.0;
+#pragma omp parallel for schedule(dynamic) reduction(max:max_shift)
+  for( int i = 0 ; i < num_cents ; ++i ) {
+    if( members[i].empty() ) {
+      continue;
+    }
+    vector<float> bit_sums( centroids.num_cols() , 0.0F );
+    for( int j = 0 , js = members[i].size() ; j < js ; ++j ) {
+      const vector<int> &mem_bits = batch_bits[members[i][j]];
+      for( int b = 0 , bs = mem_bits.size() ; b < bs ; ++b ) {
+        bit_sums[mem_bits[b]] += 1.0F;
+      }
+    }
+    // the same as moving it towards each member in turn with learning rate
+    // 1 / count, but a lot fewer passes over the centroid
+    double old_count = counts[i];
+    double new_count = old_count + members[i].size();
+    double sq_shift = 0.0;
+    float *cent = centroids.row( i );
+    for( int b = 0 , bs = centroids.num_cols() ; b < bs ; ++b ) {
+      float new_val = ( old_count * cent[b] + bit_sums[b] ) / new_count;
+      sq_shift += double( new_val - cent[b] ) * ( new_val - cent[b] );
+      cent[b] = new_val;
+    }
+    counts[i] += members[i].size();
+    max_shift = std::max( max_shift , sqrt( sq_shift ) );
+  }
+
+  return max_shift;
+
+}
+
+// ****************************************************************************
+// Pick num_picks different numbers from 0 to num_fps - 1 at random, by a partial
+// shuffle of perm, which should start off holding each of them once.
+void random_picks( int num_picks , boost::random::mt19937 &rng ,
+                   vector<int> &perm , vector<int> &picks ) {
+
+  int num_fps = perm.size();
+  num_picks = std::min( num_picks , num_fps );
+  for( int i = 0 ; i < num_picks ; ++i ) {
+    boost::random::uniform_int_distribution<> dist( i , num_fps - 1 );
+    swap( perm[i] , perm[dist( rng )] );
+  }
+  picks = vector<int>( perm.begin() , perm.begin() + num_picks );
+
+}
+
+// ****************************************************************************
+// One mini-batch run from new seeds. assign gets the cluster of each fingerprint,
+// own_dists its squared distance to that centroid and next_dists that to the
+// nearest of the others, which is all the silhouette score needs.
+void mini_batch_run( const vector<pMolRec> &molecules , const vector<int> &fp_mols ,
+                     const vector<int> &bit_cols , int num_bits , int num_clusters , int batch_size ,
+                     KMEANS_SEEDING seeding , boost::random::mt19937 &rng ,
+                     vector<int> &perm ,
+                     vector<int> &assign , vector<float> &own_dists ,
+                     vector<float> &next_dists , int &num_batches ) {
+
+  int num_fps = fp_mols.size();
+  vector<int> batch;
+  vector<vector<int> > batch_bits;
+  random_picks( std::max( batch_size , SEED_SAMPLE_FACTOR * num_clusters ) , rng , perm , batch );
+  fetch_batch_fps( molecules , fp_mols , bit_cols , batch , batch_bits );
+  DenseMatrix centroids;
+  initialise_centroids( std::min( num_clusters , int( batch.size() ) ) , seeding ,
+                        batch_bits , num_bits , rng , centroids );
+
+  vector<int> counts( centroids.num_rows() , 0 );
+  vector<double> centroid_norms;
+  vector<int> nearest;
+  vector<float> nearest_dists;
+  boost::random::uniform_int_distribution<> dist( 0 , num_fps - 1 );
+  for( num_batches = 0 ; num_batches < MAX_MINI_BATCHES ; ) {
+    batch.resize( batch_size );
+    for( int i = 0 ; i < batch_size ; ++i ) {
+      batch[i] = dist( rng );
+    }
+    fetch_batch_fps( molecules , fp_mols , bit_cols , batch , batch_bits );
+    calc_centroid_norms( centroids , centroid_norms );
+    nearest_centroids( batch_bits , centroids , centroid_norms , nearest , nearest_dists );
+    double shift = update_centroids( batch_bits , nearest , centroids , counts );
+    ++num_batches;
+#ifdef NOTYET
+    cout << "batch " << num_batches << " max centroid shift " << shift << endl;
+#endif
+    if( shift < MINI_BATCH_SHIFT_TOL ) {
+      break;
+    }
+  }
+
+  // the final assignment, a batch at a time so there's only ever one batch of
+  // fingerprints extracted. The nearest other centroid has to be one that ends
+  // up with members, so any that don't are dropped and it's done again, which
+  // doesn't change where the rest go.
+  while( true ) {
+    calc_centroid_norms( centroids , centroid_norms );
+    assign = vector<int>( num_fps , -1 );
+    own_dists = vector<float>( num_fps , numeric_limits<float>::max() );
+    next_dists = vector<float>( num_fps , numeric_limits<float>::max() );
+    for( int start = 0 ; start < num_fps ; start += batch_size ) {
+      int stop = std::min( num_fps , start + batch_size );
+      batch.resize( stop - start );
+      for( int j = start ; j < stop ; ++j ) {
+        batch[j - start] = j;
+      }
+      fetch_batch_fps( molecules , fp_mols , bit_cols , batch , batch_bits );
+#pragma omp parallel for schedule(dynamic,64)
+      for( int j = start ; j < stop ; ++j ) {
+        for( int i = 0 , is = centroids.num_rows() ; i < is ; ++i ) {
+          float sq_dist = sq_dist_to_centroid( batch_bits[j - start] , centroids.row( i ) , centroid_norms[i] );
+          if( sq_dist < own_dists[j] ) {
+            next_dists[j] = own_dists[j];
+            own_dists[j] = sq_dist;
+            assign[j] = i;
+          } else if( sq_dist < next_dists[j] ) {
+            next_dists[j] = sq_dist;
+          }
+        }
+      }
+    }
+
+    vector<int> num_mems( centroids.num_rows() , 0 );
+    for( int j = 0 ; j < num_fps ; ++j ) {
+      ++num_mems[assign[j]];
+    }
+    if( find( num_mems.begin() , num_mems.end() , 0 ) == num_mems.end() ) {
+      break;
+    }
+    for( int i = centroids.num_rows() - 1 ; i >= 0 ; --i ) {
+      if( !num_mems[i] ) {
+        centroids.erase_row( i );
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// The crisp silhouette score, as crisp_silhouette_score does it with the
+// distances to the centroids, but from each fingerprint's distances to its own
+// centroid and the nearest other one, so nothing the size of fingerprints by
+// clusters is needed. sil_scores gets s_i for each fingerprint.
+float centroid_silhouette_score( const vector<vector<CLUS_MEM> > &clus ,
+                                 const vector<float> &own_dists ,
+                                 const vector<float> &next_dists ,
+                                 vector<float> &sil_scores ) {
+
+  float css = 0.0;
+  sil_scores = vector<float>( own_dists.size() , 0.0F );
+  int num_clus_mems = 0;
+  for( int i = 0 , is = clus.size() ; i < is ; ++i ) {
+    num_clus_mems += clus[i].size();
+    if( 1 == clus[i].size() ) {
+      continue;
+    }
+    for( int j = 0 , js = clus[i].size() ; j < js ; ++j ) {
+      int mem = clus[i][j].first;
+      float ai = own_dists[mem] , bi = next_dists[mem];
+      float si = 0.0;
+      if( ai != bi ) {
+        si = ( bi - ai ) / std::max( bi , ai );
+      }
+      sil_scores[mem] = si;
+      css += si;
+    }
+  }
+
+  return num_clus_mems ? css / float( num_clus_mems ) : 0.0F;
+
+}
+
+// ****************************************************************************
+// mini-batch k-means doesn't do the warm-started sweep, exact silhouette, change
+// tolerance or sampled silhouette that DoKMeansCluster can, so say if any were
+// asked for.
+void warn_mini_batch_ignored( bool warm_sweep , bool exact_sil , double change_tol ,
+                              double sil_sample_tol ) {
+
+  if( warm_sweep ) {
+    cerr << "Warning - mini-batch K-Means doesn't do a warm-started sweep, ignoring it." << endl;
+  }
+  if( exact_sil ) {
+    cerr << "Warning - mini-batch K-Means doesn't do an exact silhouette, ignoring it." << endl;
+  }
+  if( change_tol > 0.0 ) {
+    cerr << "Warning - mini-batch K-Means stops on centroid shifts, ignoring the change tolerance." << endl;
+  }
+  if( sil_sample_tol > 0.0 ) {
+    cerr << "Warning - mini-batch K-Means doesn't sample the silhouette, ignoring the tolerance." << endl;
+  }
+
+}
+
+// ****************************************************************************
+// Each run has its own random number generator seeded from random_seed and the
+// run number, as DoKMeansCluster. The runs are done one after the other, though,
+// as each one streams through all the molecules' fingerprints. The
+// fingerprint bits are picked by max_bits as for DoKMeansCluster.
+void DoMiniBatchKMeansCluster( const vector<pMolRec> &molecules ,
+                               int num_clusters , int num_iters , int batch_size ,
+                               KMEANS_SEEDING seeding , unsigned int random_seed ,
+                               int max_bits ,
+                               vector<pSVDCluster> &clusters , float &sil_score ) {
+
+  // nothing, unless a clustering gets done
+  clusters.clear();
+  sil_score = 0.0F;
+
+  // the molecules with fingerprints
+  vector<int> fp_mols;
+  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
+    if( molecules[i]->get_fingerprint() ) {
+      fp_mols.push_back( i );
+    }
+  }
+  if( fp_mols.empty() ) {
+    return;
+  }
+  // and the bits of them that are worth using
+  vector<int> bit_cols;
+  int num_bits = 0;
+  select_fingerprint_bits( molecules , max_bits , bit_cols , num_bits );
+  int num_fps = fp_mols.size();
+  batch_size = std::max( 1 , std::min( batch_size , num_fps ) );
+
+  vector<int> perm( num_fps );
+  for( int j = 0 ; j < num_fps ; ++j ) {
+    perm[j] = j;
+  }
+
+  vector<vector<CLUS_MEM> > best_clus;
+  float best_sil_score = -numeric_limits<float>::max();
+  vector<float> best_sil_scores;
+  int tot_batches = 0;
+
+  for( int it = 0 ; it < num_iters ; ++it ) {
+    vector<int> assign;
+    vector<float> own_dists , next_dists;
+    int num_batches = 0;
+    boost::random::mt19937 rng( run_seed( random_seed , it ) );
+    mini_batch_run( molecules , fp_mols , bit_cols , num_bits , num_clusters , batch_size ,
+                    seeding , rng , perm , assign , own_dists , next_dists , num_batches );
+    tot_batches += num_batches;
+
+    // every centroid left has members, so the highest number is the last of them
+    vector<vector<CLUS_MEM> > clus;
+    rebuild_clusters( assign , *max_element( assign.begin() , assign.end() ) + 1 , clus );
+    for( int i = 0 , is = clus.size() ; i < is ; ++i ) {
+      for( int j = 0 , js = clus[i].size() ; j < js ; ++j ) {
+        clus[i][j].second = own_dists[clus[i][j].first];
+      }
+    }
+
+    vector<float> mol_sil_scores;
+    sil_score = centroid_silhouette_score( clus , own_dists , next_dists , mol_sil_scores );
+#ifdef NOTYET
+    cout << "sil_score for iteration " << it << " : " << sil_score << endl;
+#endif
+    if( sil_score > best_sil_score ) {
+      best_sil_score = sil_score;
+      best_clus = clus;
+      best_sil_scores = mol_sil_scores;
+    }
+  }
+
+  if( num_iters ) {
+    cout << "Mini-batch K-Means took " << double( tot_batches ) / double( num_iters )
+         << " batches of " << batch_size << " per run on average." << endl;
+  }
+  if( best_clus.empty() ) {
+    return;
+  }
+  sil_score = best_sil_score;
+
+  // back to molecule numbers from fingerprint numbers
+  vector<float> mol_sil_scores( molecules.size() , 0.0F );
+  for( int i = 0 , is = best_clus.size() ; i < is ; ++i ) {
+    for( int j = 0 , js = best_clus[i].size() ; j < js ; ++j ) {
+      int fp_num = best_clus[i][j].first;
+      best_clus[i][j].first = fp_mols[fp_num];
+      mol_sil_scores[fp_mols[fp_num]] = best_sil_scores[fp_num];
+    }
+  }
+
+  extract_clusters( molecules , best_clus , mol_sil_scores , clusters );
+  sort( clusters.begin() , clusters.end() ,
+        boost::bind( greater<int>() ,
+                     boost::bind( &SVDCluster::size , _1 ) ,
+                     boost::bind( &SVDCluster::size , _2 ) ) );
+
+}
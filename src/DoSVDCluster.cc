@@ -15,19 +15,24 @@
 // is true, a molecule is only put in the cluster where its contribution to the eigenvector
 // is highest.
 
+#include "DenseMatrix.H"
 #include "GetRDKitSims.H"
 #include "MoleculeRec.H"
 #include "SVDClusRDKitDefs.H"
 #include "SVDCluster.H"
 #include "SVDClusterMember.H"
+#include "SVDModel.H"
+#include "SilhouetteDistance.H"
 
 #include <cmath>
+#include <iostream>
 #include <limits>
 #include <vector>
 
 #include <boost/bind.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
 #include <boost/tuple/tuple.hpp>
 
 //SVDLIBC
@@ -43,43 +48,69 @@ namespace bl = boost::lambda;
 
 // in crisp_silhouette_score.cc
 void calc_molecule_cluster_dists( const vector<vector<int> > &clus ,
-                                  const vector<pMolRec> &molecules ,
+                                  const PackedFingerprints &packed_fps ,
                                   float tversky_alpha ,
                                   float tversky_beta ,
-                                  vector<vector<float> > &mol_clus_dists );
+                                  DenseMatrix &mol_clus_dists );
 
 // in eponymous file
 float crisp_silhouette_score( const vector<vector<int> > &clus ,
-                              const vector<vector<float> > dists ,
+                              const DenseMatrix &dists ,
                               vector<float> &sil_scores );
 
 // in eponymous file
 float fuzzy_silhouette_score( const vector<float> &crisp_sil_scores ,
                               const vector<TOP_PAIR> &top_pairs );
+// in fuzzy_silhouette_score.cc
+void fuzzy_silhouette_weights( const vector<TOP_PAIR> &top_pairs ,
+                               vector<float> &weights );
+
+// in eponymous file
+float sampled_silhouette_score( const vector<vector<int> > &clus , int num_mols ,
+                                const SilhouetteDistance &sil_dist ,
+                                const vector<float> &weights , bool self_in_own_mean ,
+                                double ci_tol , unsigned int random_seed ,
+                                vector<float> &sil_scores ,
+                                SilhouetteEstimate &estimate );
+void report_silhouette_estimate( const SilhouetteEstimate &estimate );
+
+// in DoKMeansCluster.cc
+unsigned int run_seed( unsigned int master_seed , int run_num );
+
+// in NystromSVD.cc
+SVDRec nystrom_svd( const vector<pMolRec> &molecules ,
+                    float tversky_alpha , float tversky_beta ,
+                    float gamma , double sim_thresh ,
+                    int num_clusters , int num_landmarks ,
+                    boost::random::mt19937 &rng );
+
+// in MultilevelSVD.cc
+SVDRec multilevel_svd( const vector<vector<pair<int,double> > > &sim_cols ,
+                       int num_clusters , int coarsest_size ,
+                       boost::random::mt19937 &rng );
+
+// in FloatSVD.cc
+SVDRec float_matrix_svd( const vector<vector<pair<int,float> > > &mat , int num_clusters ,
+                         boost::random::mt19937 &rng );
+void report_float_accuracy( const GetRDKitSims &sim_matrix ,
+                            int num_clusters , double clus_thresh , SVDRec float_res );
 
 
 // *************************************************************************
-SMat create_svd_matrix( int matrix_size , vector<MatrixEl> &matrix ) {
+SMat create_svd_matrix( const GetRDKitSims &sim_matrix ) {
+
+  SMat ret_val = svdNewSMat( sim_matrix.num_molecules() , sim_matrix.num_molecules() ,
+                             sim_matrix.num_sims() );
+  sim_matrix.csc_sims( ret_val->pointr , ret_val->rowind , ret_val->value );
 
 #ifdef NOTYET
   cout << "Matrix elements : " << endl;
-  for( int i = 0 , is = matrix.size() ; i < is ; ++i ) {
-    cout << matrix[i].get<0>() << " , " << matrix[i].get<1>() << " : " << matrix[i].get<2>() << endl;
-  }
-#endif
-
-  SMat ret_val = svdNewSMat( matrix_size , matrix_size , matrix.size() );
-  for( int i = 0 , n = 0 ; i < matrix_size ; ++i ) {
-    // cout << "col " << i << "  n = " << n << endl;
-    ret_val->pointr[i] = n;
-    while( n < int( matrix.size() ) && matrix[n].get<0>() == i ) {
-      ret_val->rowind[n] = matrix[n].get<1>();
-      ret_val->value[n] = matrix[n].get<2>();
-      ++n;
+  for( int i = 0 ; i < ret_val->cols ; ++i ) {
+    for( long n = ret_val->pointr[i] ; n < ret_val->pointr[i + 1] ; ++n ) {
+      cout << i << " , " << ret_val->rowind[n] << " : " << ret_val->value[n] << endl;
     }
   }
-
-  ret_val->pointr[ret_val->cols] = ret_val->vals;
+#endif
 
   return ret_val;
 
@@ -205,11 +236,16 @@ void extract_crisp_clusters( vector<TOP_PAIR> &top_pairs , float clus_thresh ,
 }
 
 // *************************************************************************
-// get the clusters out of the svd results matrix, returning the silhouette score
+// get the clusters out of the svd results matrix, returning the silhouette score.
+// packed_fps are the fingerprints of molecules, for the silhouette distances.
+// If sil_sample_tol is more than 0, the score is estimated from a sample, to
+// within a 95% confidence interval that wide.
 float extract_clusters( const vector<pMolRec> &molecules ,
+                        const PackedFingerprints &packed_fps ,
                         float tversky_alpha , float tversky_beta ,
                         int rank , DMat mat , double *S , int matrix_size , double clus_thresh ,
-                        bool overlapping_clusters ,
+                        bool overlapping_clusters , double sil_sample_tol ,
+                        unsigned int random_seed ,
                         vector<pSVDCluster> &clusters ) {
 
   clusters.clear();
@@ -225,57 +261,143 @@ float extract_clusters( const vector<pMolRec> &molecules ,
   vector<vector<int> > crisp_clus( rank , vector<int>() );
   extract_crisp_clusters( top_pairs , clus_thresh , crisp_clus );
 
-  // use the crisp clusters to calculated the mean distances from each molecule to each cluster
-  vector<vector<float> > mol_clus_dists;
-  calc_molecule_cluster_dists( crisp_clus , molecules , tversky_alpha , tversky_beta , mol_clus_dists );
-
   vector<float> crisp_mol_sil_scores;
-  float avg_crisp_sil_score = crisp_silhouette_score( crisp_clus , mol_clus_dists , crisp_mol_sil_scores );
+  float avg_crisp_sil_score = 0.0F , sampled_sil_score = 0.0F;
+  if( sil_sample_tol > 0.0 ) {
+    // the fuzzy score for overlapping clusters, the crisp one otherwise
+    vector<float> weights;
+    if( overlapping_clusters ) {
+      fuzzy_silhouette_weights( top_pairs , weights );
+    }
+    // the full scores count each molecule in the mean distance to its own cluster
+    TverskySilDistance sil_dist( packed_fps , tversky_alpha , tversky_beta );
+    SilhouetteEstimate sil_estimate;
+    sampled_sil_score = sampled_silhouette_score( crisp_clus , matrix_size , sil_dist , weights ,
+                                                  true , sil_sample_tol , random_seed ,
+                                                  crisp_mol_sil_scores , sil_estimate );
+    report_silhouette_estimate( sil_estimate );
+  } else {
+    // use the crisp clusters to calculated the mean distances from each molecule to each cluster
+    DenseMatrix mol_clus_dists;
+    calc_molecule_cluster_dists( crisp_clus , packed_fps , tversky_alpha , tversky_beta , mol_clus_dists );
+    avg_crisp_sil_score = crisp_silhouette_score( crisp_clus , mol_clus_dists , crisp_mol_sil_scores );
+  }
 
   if( overlapping_clusters ) {
     extract_overlap_clusters( molecules , rank , mat , S , matrix_size ,
                               clus_thresh , crisp_mol_sil_scores , clusters );
+    if( sil_sample_tol > 0.0 ) {
+      return sampled_sil_score;
+    }
     return fuzzy_silhouette_score( crisp_mol_sil_scores , top_pairs );
   } else {
     // we've already extracted the crisp clusters once, no need to do it all again to build the clusters
     // records
     extract_non_overlap_clusters( molecules , S , clus_thresh , crisp_clus , crisp_mol_sil_scores ,
                                   top_pairs , clusters );
-    return avg_crisp_sil_score;
+    return sil_sample_tol > 0.0 ? sampled_sil_score : avg_crisp_sil_score;
   }
 
 }
 
 // ****************************************************************************
+// if num_landmarks is more than 0 and fewer than the number of molecules, the
+// SVD is approximated by the Nystrom method using that many landmark molecules
+// rather than decomposing the full similarity matrix. Otherwise, if coarsest_size
+// is more than 0 and fewer than the number of molecules, the multilevel method is
+// used, coarsening the similarity graph down to about that many super-nodes. That
+// speeds up the decomposition, but the full similarity matrix is still built.
+// Otherwise, if float_matrix is true the matrix values are held in single
+// precision, and if float_accuracy_report is also true the results are compared
+// with the double precision ones, for which the matrix is built again in double
+// precision.
+// The random numbers for the Nystrom landmarks, the multilevel matching and the
+// single precision SVD's starting vector come from random_seed, as do those for
+// the samples of the molecules the silhouette scores are estimated from if
+// sil_sample_tol is more than 0, as in extract_clusters.
+// svd_model gets what's needed to assign new molecules to the U clusters later.
+// sim_matrix is the similarity matrix from a previous call, if there was one. If it
+// was made with the same parameters for the molecules at the start of molecules,
+// it is extended with the new ones, otherwise it is made from scratch.
 void DoSVDCluster( const vector<pMolRec> &molecules ,
                    float tversky_alpha , float tversky_beta ,
                    float gamma , int num_clusters ,
                    double clus_thresh , double sim_thresh ,
-                   bool overlapping_clusters ,
+                   bool overlapping_clusters , int num_landmarks , int coarsest_size ,
+                   bool float_matrix , bool float_accuracy_report ,
+                   double sil_sample_tol , unsigned int random_seed ,
+                   pGetRDKitSims &sim_matrix ,
                    vector<pSVDCluster> &u_clusters , float &u_sil_score ,
-                   vector<pSVDCluster> &v_clusters , float &v_sil_score ) {
-
-  GetRDKitSims grdks( molecules , tversky_alpha , tversky_beta , gamma , sim_thresh );
-  vector<MatrixEl> sims = grdks.sims();
+                   vector<pSVDCluster> &v_clusters , float &v_sil_score ,
+                   pSVDModel &svd_model ) {
 
   int matrix_size = molecules.size();
-  SMat svd_matrix = create_svd_matrix( matrix_size , sims );
+  SVDRec svdlib_results = 0;
+  boost::random::mt19937 rng( run_seed( random_seed , 0 ) );
 
-  int iterations = 0;
-  double las2end[2] = { -1.0e-30 , 1.0e-30 };
-  double kappa = 1.0e-6;
-  SVDRec svdlib_results = svdLAS2( svd_matrix , num_clusters , iterations , las2end , kappa );
+  if( num_landmarks > 0 && num_landmarks < matrix_size ) {
+    svdlib_results = nystrom_svd( molecules , tversky_alpha , tversky_beta , gamma , sim_thresh ,
+                                  num_clusters , num_landmarks , rng );
+  } else {
+    bool multilevel = coarsest_size > 0 && coarsest_size < matrix_size;
+    bool float_values = float_matrix && !multilevel;
+    if( sim_matrix && sim_matrix->can_extend( molecules , tversky_alpha , tversky_beta ,
+                                              gamma , sim_thresh , float_values ) ) {
+      sim_matrix->add_molecules( molecules );
+    } else {
+      sim_matrix = pGetRDKitSims( new GetRDKitSims( molecules , tversky_alpha , tversky_beta ,
+                                                    gamma , sim_thresh , float_values ) );
+    }
+
+    if( multilevel ) {
+      svdlib_results = multilevel_svd( sim_matrix->cols() , num_clusters , coarsest_size , rng );
+    } else if( float_values ) {
+      svdlib_results = float_matrix_svd( sim_matrix->float_cols() , num_clusters , rng );
+      if( float_accuracy_report ) {
+        GetRDKitSims double_sims( molecules , tversky_alpha , tversky_beta ,
+                                  gamma , sim_thresh );
+        report_float_accuracy( double_sims , num_clusters , clus_thresh , svdlib_results );
+      }
+    } else {
+      SMat svd_matrix = create_svd_matrix( *sim_matrix );
+
+      int iterations = 0;
+      double las2end[2] = { -1.0e-30 , 1.0e-30 };
+      double kappa = 1.0e-6;
+      svdlib_results = svdLAS2( svd_matrix , num_clusters , iterations , las2end , kappa );
+
+      svdFreeSMat( svd_matrix );
+    }
+  }
+
+  // extract_clusters needs at least 2 singular vectors to work with
+  if( svdlib_results->d < 2 ) {
+    cerr << "Error - SVD only gave " << svdlib_results->d
+         << " singular vectors, need at least 2 for clustering." << endl;
+    u_clusters.clear();
+    v_clusters.clear();
+    u_sil_score = v_sil_score = 0.0F;
+    svd_model.reset();
+    svdFreeSVDRec( svdlib_results );
+    return;
+  }
 
-  svdFreeSMat( svd_matrix );
+  // the model packs the fingerprints, which the silhouette scores use as well
+  svd_model = pSVDModel( new SVDModel( molecules , tversky_alpha , tversky_beta ,
+                                       gamma , sim_thresh , clus_thresh , svdlib_results ) );
 
-  u_sil_score = extract_clusters( molecules , tversky_alpha , tversky_beta ,
+  u_sil_score = extract_clusters( molecules , svd_model->packed_fps() ,
+                                  tversky_alpha , tversky_beta ,
                                   svdlib_results->d , svdlib_results->Ut ,
                                   svdlib_results->S , matrix_size , clus_thresh ,
-                                  overlapping_clusters , u_clusters );
-  v_sil_score = extract_clusters( molecules , tversky_alpha , tversky_beta ,
+                                  overlapping_clusters , sil_sample_tol , random_seed ,
+                                  u_clusters );
+  v_sil_score = extract_clusters( molecules , svd_model->packed_fps() ,
+                                  tversky_alpha , tversky_beta ,
                                   svdlib_results->d , svdlib_results->Vt ,
                                   svdlib_results->S , matrix_size , clus_thresh ,
-                                  overlapping_clusters , v_clusters );
+                                  overlapping_clusters , sil_sample_tol , random_seed ,
+                                  v_clusters );
 
   svdFreeSVDRec( svdlib_results );
 
@@ -0,0 +1,362 @@
+//
+// file FloatSVD.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// SVD of the similarity matrix with the matrix values held in single precision,
+// which halves the memory and bandwidth the matrix needs. The similarities come
+// from bit counts, so they don't have the precision of a double anyway. SVDLIBC
+// only works in double precision, so the top singular vectors are found here by
+// Lanczos bidiagonalisation, as svdLAS2 does, the matrix-vector products reading
+// the float values but accumulating in double. The Lanczos vectors are fully
+// reorthogonalised, which svdLAS2 avoids, so they cost a little more time and
+// memory per step, but it needs about the same number of matrix-vector products.
+// There's also a report comparing the results with the all-double path, for
+// checking that the loss of precision doesn't matter for a dataset.
+
+#include "GetRDKitSims.H"
+#include "SVDClusRDKitDefs.H"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+
+//SVDLIBC
+extern "C" {
+#include "svdlib.h"
+#include "svdutil.h"
+}
+
+using namespace std;
+
+// in DoSVDCluster.cc
+SMat create_svd_matrix( const GetRDKitSims &sim_matrix );
+
+// cols[i] holds the (row number, value) pairs of column i of a sparse matrix
+typedef vector<vector<pair<int,float> > > FloatSparseCols;
+
+// how often to check for convergence, in Lanczos steps
+static const int LANCZOS_CHECK_INTERVAL = 10;
+// a singular triplet has converged when its residual is this small relative to
+// the largest singular value
+static const double RITZ_RESID_TOL = 1.0e-8;
+// the Lanczos process has broken down, having found an invariant subspace, when a
+// new vector is this small relative to the largest seen
+static const double BREAKDOWN_TOL = 1.0e-12;
+
+// *************************************************************************
+// out = mat * in, or mat' * in if transpose.
+void float_mat_times_vec( const FloatSparseCols &mat , bool transpose ,
+                          const vector<double> &in , vector<double> &out ) {
+
+  int n = mat.size();
+  if( transpose ) {
+    // each element of out only reads its own column
+#pragma omp parallel for schedule(static)
+    for( int i = 0 ; i < n ; ++i ) {
+      double sum = 0.0;
+      for( int j = 0 , js = mat[i].size() ; j < js ; ++j ) {
+        sum += double( mat[i][j].second ) * in[mat[i][j].first];
+      }
+      out[i] = sum;
+    }
+  } else {
+    fill( out.begin() , out.end() , 0.0 );
+    for( int i = 0 ; i < n ; ++i ) {
+      double in_i = in[i];
+      for( int j = 0 , js = mat[i].size() ; j < js ; ++j ) {
+        out[mat[i][j].first] += double( mat[i][j].second ) * in_i;
+      }
+    }
+  }
+
+}
+
+// *************************************************************************
+// take the components along the orthonormal vectors in basis out of v, twice
+// because once isn't enough when v has lost most of its length. Returns the
+// length of what's left.
+double reorthogonalise( const vector<vector<double> > &basis , vector<double> &v ) {
+
+  for( int pass = 0 ; pass < 2 ; ++pass ) {
+    for( int b = 0 , bs = basis.size() ; b < bs ; ++b ) {
+      double dot = 0.0;
+      for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+        dot += v[i] * basis[b][i];
+      }
+      for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+        v[i] -= dot * basis[b][i];
+      }
+    }
+  }
+
+  double norm = 0.0;
+  for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+    norm += v[i] * v[i];
+  }
+  return sqrt( norm );
+
+}
+
+// *************************************************************************
+// SVD of the upper bidiagonal matrix with alphas on the diagonal and betas[0] to
+// betas[m-2] above it, m being the number of alphas.
+SVDRec bidiagonal_svd( const vector<double> &alphas , const vector<double> &betas ) {
+
+  int m = alphas.size();
+  DMat small_mat = svdNewDMat( m , m );
+  for( int a = 0 ; a < m ; ++a ) {
+    small_mat->value[a][a] = alphas[a];
+    if( a + 1 < m ) {
+      small_mat->value[a][a + 1] = betas[a];
+    }
+  }
+  SMat small_smat = svdConvertDtoS( small_mat );
+  svdFreeDMat( small_mat );
+
+  int iterations = 0;
+  double las2end[2] = { -1.0e-30 , 1.0e-30 };
+  double kappa = 1.0e-6;
+  SVDRec ret_val = svdLAS2( small_smat , m , iterations , las2end , kappa );
+  svdFreeSMat( small_smat );
+
+  return ret_val;
+
+}
+
+// *************************************************************************
+// mat is the similarity matrix, as GetRDKitSims::float_cols() gives it.
+// rng gives the random starting vector.
+SVDRec float_matrix_svd( const FloatSparseCols &mat , int num_clusters ,
+                         boost::random::mt19937 &rng ) {
+
+  int n = mat.size();
+  num_clusters = std::min( num_clusters , n );
+  // the whole Lanczos basis is kept, so put a limit on it
+  int max_steps = std::min( n , std::max( 20 * num_clusters , 500 ) );
+
+  // A V = U B and A' U = V B' + beta v e', where B is upper bidiagonal with the
+  // alphas on the diagonal and betas above, v is the next v vector and e the
+  // last unit vector, so if B = X S Y' the residual of the k'th singular triplet
+  // (s_k , U x_k , V y_k) is beta times the last element of x_k.
+  vector<vector<double> > u_basis , v_basis;
+  vector<double> alphas , betas;
+  SVDRec small_res = 0;
+  if( n > 0 && num_clusters > 0 ) {
+    boost::random::uniform_real_distribution<> dist( -1.0 , 1.0 );
+    vector<double> u( n ) , v( n );
+    for( int i = 0 ; i < n ; ++i ) {
+      v[i] = dist( rng );
+    }
+    double beta = reorthogonalise( v_basis , v );
+    for( int i = 0 ; i < n ; ++i ) {
+      v[i] /= beta;
+    }
+    beta = 0.0;
+
+    double max_norm = 0.0;
+    while( true ) {
+      v_basis.push_back( v );
+      float_mat_times_vec( mat , false , v , u );
+      if( !u_basis.empty() ) {
+        for( int i = 0 ; i < n ; ++i ) {
+          u[i] -= beta * u_basis.back()[i];
+        }
+      }
+      double alpha = reorthogonalise( u_basis , u );
+      if( alphas.empty() && 0.0 == alpha ) {
+        break; // it's an all-zero matrix
+      }
+      bool finished = alpha <= BREAKDOWN_TOL * max_norm;
+      max_norm = std::max( max_norm , alpha );
+      if( finished ) {
+        alpha = 0.0;
+        fill( u.begin() , u.end() , 0.0 );
+      } else {
+        for( int i = 0 ; i < n ; ++i ) {
+          u[i] /= alpha;
+        }
+      }
+      u_basis.push_back( u );
+      alphas.push_back( alpha );
+
+      beta = 0.0;
+      if( !finished ) {
+        float_mat_times_vec( mat , true , u , v );
+        for( int i = 0 ; i < n ; ++i ) {
+          v[i] -= alpha * v_basis.back()[i];
+        }
+        beta = reorthogonalise( v_basis , v );
+        finished = beta <= BREAKDOWN_TOL * max_norm;
+        max_norm = std::max( max_norm , beta );
+        if( finished ) {
+          beta = 0.0;
+        } else {
+          for( int i = 0 ; i < n ; ++i ) {
+            v[i] /= beta;
+          }
+        }
+      }
+      betas.push_back( beta );
+
+      int m = alphas.size();
+      if( !finished && m < max_steps && ( m < num_clusters || m % LANCZOS_CHECK_INTERVAL ) ) {
+        continue;
+      }
+      if( small_res ) {
+        svdFreeSVDRec( small_res );
+      }
+      small_res = bidiagonal_svd( alphas , betas );
+      double max_resid = 0.0;
+      for( int k = 0 , ks = std::min( num_clusters , small_res->d ) ; k < ks ; ++k ) {
+        max_resid = std::max( max_resid , fabs( beta * small_res->Ut->value[k][m - 1] ) );
+      }
+      bool converged = small_res->d > 0 && max_resid <= RITZ_RESID_TOL * small_res->S[0];
+      if( finished || converged ) {
+        break;
+      }
+      if( m == max_steps ) {
+        cerr << "Warning - single precision SVD not converged after " << m
+             << " Lanczos steps." << endl;
+        break;
+      }
+    }
+  }
+
+#ifdef NOTYET
+  cout << "Single precision SVD took " << alphas.size() << " Lanczos steps." << endl;
+#endif
+
+  SVDRec ret_val = svdNewSVDRec();
+  ret_val->d = small_res ? std::min( num_clusters , small_res->d ) : 0;
+  ret_val->S = static_cast<double *>( calloc( max( ret_val->d , 1 ) , sizeof( double ) ) );
+  ret_val->Ut = svdNewDMat( max( ret_val->d , 1 ) , n );
+  ret_val->Vt = svdNewDMat( max( ret_val->d , 1 ) , n );
+  for( int k = 0 ; k < ret_val->d ; ++k ) {
+    ret_val->S[k] = small_res->S[k];
+    double *u_vec = ret_val->Ut->value[k];
+    double *v_vec = ret_val->Vt->value[k];
+    for( int a = 0 , as = alphas.size() ; a < as ; ++a ) {
+      double cu = small_res->Ut->value[k][a];
+      double cv = small_res->Vt->value[k][a];
+      for( int i = 0 ; i < n ; ++i ) {
+        u_vec[i] += cu * u_basis[a][i];
+        v_vec[i] += cv * v_basis[a][i];
+      }
+    }
+  }
+  if( small_res ) {
+    svdFreeSVDRec( small_res );
+  }
+
+  return ret_val;
+
+}
+
+// *************************************************************************
+// the cluster each molecule has its largest contribution to, or -1 if it's not
+// above clus_thresh for any of them.
+void crisp_assignments( SVDRec svd_res , int matrix_size , double clus_thresh ,
+                        vector<int> &assignments ) {
+
+  assignments = vector<int>( matrix_size , -1 );
+  for( int i = 0 ; i < matrix_size ; ++i ) {
+    double best = clus_thresh;
+    for( int k = 0 ; k < svd_res->d ; ++k ) {
+      if( fabs( svd_res->Ut->value[k][i] ) > best ) {
+        best = fabs( svd_res->Ut->value[k][i] );
+        assignments[i] = k;
+      }
+    }
+  }
+
+}
+
+// *************************************************************************
+// Rand index of two partitions, the fraction of pairs of molecules that are
+// either together in both or apart in both. Doesn't care about the cluster
+// numbering.
+double rand_index( const vector<int> &part1 , const vector<int> &part2 ) {
+
+  map<pair<int,int>,double> both;
+  map<int,double> in1 , in2;
+  for( int i = 0 , is = part1.size() ; i < is ; ++i ) {
+    both[make_pair( part1[i] , part2[i] )] += 1.0;
+    in1[part1[i]] += 1.0;
+    in2[part2[i]] += 1.0;
+  }
+
+  double n = part1.size();
+  double num_pairs = n * ( n - 1.0 ) / 2.0;
+  if( 0.0 == num_pairs ) {
+    return 1.0;
+  }
+  double sum_both = 0.0 , sum1 = 0.0 , sum2 = 0.0;
+  for( map<pair<int,int>,double>::iterator p = both.begin() ; p != both.end() ; ++p ) {
+    sum_both += p->second * ( p->second - 1.0 ) / 2.0;
+  }
+  for( map<int,double>::iterator p = in1.begin() ; p != in1.end() ; ++p ) {
+    sum1 += p->second * ( p->second - 1.0 ) / 2.0;
+  }
+  for( map<int,double>::iterator p = in2.begin() ; p != in2.end() ; ++p ) {
+    sum2 += p->second * ( p->second - 1.0 ) / 2.0;
+  }
+
+  return ( num_pairs + 2.0 * sum_both - sum1 - sum2 ) / num_pairs;
+
+}
+
+// *************************************************************************
+// do the SVD again with the double precision matrix and SVDLIBC, and report
+// the differences in the singular values and the crisp cluster assignments.
+void report_float_accuracy( const GetRDKitSims &sim_matrix ,
+                            int num_clusters , double clus_thresh , SVDRec float_res ) {
+
+  int matrix_size = sim_matrix.num_molecules();
+  SMat svd_matrix = create_svd_matrix( sim_matrix );
+  int iterations = 0;
+  double las2end[2] = { -1.0e-30 , 1.0e-30 };
+  double kappa = 1.0e-6;
+  SVDRec double_res = svdLAS2( svd_matrix , num_clusters , iterations , las2end , kappa );
+  svdFreeSMat( svd_matrix );
+
+  double max_rel_diff = 0.0;
+  int num_sing_vals = std::min( float_res->d , double_res->d );
+  for( int k = 0 ; k < num_sing_vals ; ++k ) {
+    if( 0.0 != double_res->S[k] ) {
+      max_rel_diff = std::max( max_rel_diff ,
+                               fabs( float_res->S[k] - double_res->S[k] ) / double_res->S[k] );
+    }
+  }
+
+  vector<int> float_assigns , double_assigns;
+  crisp_assignments( float_res , matrix_size , clus_thresh , float_assigns );
+  crisp_assignments( double_res , matrix_size , clus_thresh , double_assigns );
+  int num_same = 0;
+  for( int i = 0 ; i < matrix_size ; ++i ) {
+    if( float_assigns[i] == double_assigns[i] ) {
+      ++num_same;
+    }
+  }
+
+  cout << "Single precision matrix accuracy : " << num_sing_vals
+       << " singular values, max relative difference from double = " << max_rel_diff << endl
+       << "  " << num_same << " of " << matrix_size
+       << " molecules in the same crisp cluster, Rand index = "
+       << rand_index( float_assigns , double_assigns ) << endl;
+
+  svdFreeSVDRec( double_res );
+
+}
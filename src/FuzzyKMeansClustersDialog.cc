@@ -14,11 +14,13 @@
 #include "SVDClusSettings.H"
 
 #include <QFormLayout>
+#include <QIntValidator>
 #include <QLabel>
 #include <QLayout>
 #include <QLineEdit>
 
 #include <iostream>
+#include <limits>
 
 using namespace std;
 
@@ -34,12 +36,20 @@ FuzzyKMeansClustersDialog::FuzzyKMeansClustersDialog( SVDClusSettings *initial_s
 // ****************************************************************************
 void FuzzyKMeansClustersDialog::get_settings( int &start_num_clus , int &stop_num_clus ,
                                               int &num_clus_step , int &num_iters ,
-                                              float &m ) const {
+                                              float &m , unsigned int &random_seed ,
+                                              int &top_r , double &sil_sample_tol ) const {
 
+  // not used
+  KMEANS_SEEDING seeding;
+  int batch_size;
+  bool warm_sweep , exact_sil;
   KMeansClustersDialog::get_settings( start_num_clus , stop_num_clus ,
-                                      num_clus_step , num_iters );
+                                      num_clus_step , num_iters , seeding , batch_size ,
+                                      random_seed , warm_sweep , exact_sil ,
+                                      sil_sample_tol );
 
   m = m_->text().toFloat();
+  top_r = top_r_->text().toInt();
 
 }
 
@@ -56,9 +66,30 @@ void FuzzyKMeansClustersDialog::build_widget( SVDClusSettings *initial_settings
     main_vbox_->addLayout( main_form_ );
   }
 
+  // fuzzy k-means starts from random memberships and uses all the molecules,
+  // so there's no seeding, mini-batch or warm start option, and its silhouette
+  // is always from the cluster members
+  seeding_->hide();
+  main_form_->labelForField( seeding_ )->hide();
+  batch_size_->hide();
+  main_form_->labelForField( batch_size_ )->hide();
+  warm_sweep_->hide();
+  main_form_->labelForField( warm_sweep_ )->hide();
+  exact_sil_->hide();
+  main_form_->labelForField( exact_sil_ )->hide();
+  // the hidden exact silhouette box mustn't grey out the sample tolerance
+  sil_sample_tol_->setEnabled( true );
+
+  num_iters_->setText( QString( "%1" ).arg( initial_settings->fuzzy_k_means_iters() ) );
+
   m_ = new QLineEdit( QString( "%1" ).arg( initial_settings->fuzzy_k_means_m() ) );
   main_form_->addRow( "M (fuzziness)" , m_ );
 
+  // 0 means keep all the memberships
+  top_r_ = new QLineEdit( QString( "%1" ).arg( initial_settings->fuzzy_k_means_top_r() ) );
+  top_r_->setValidator( new QIntValidator( 0 , std::numeric_limits<int>::max() , this ) );
+  main_form_->addRow( "Top memberships" , top_r_ );
+
   setWindowTitle( "Fuzzy K-Means Clusters" );
 
 }
@@ -12,10 +12,7 @@
 
 #include "GetRDKitSims.H"
 #include "MoleculeRec.H"
-#include "boost_tuples_and_bind.H"
 
-#include <boost/bind.hpp>
-#include <boost/foreach.hpp>
 #include <boost/tuple/tuple.hpp>
 
 #include <DataStructs/BitOps.h>
@@ -28,57 +25,139 @@ using namespace std;
 // ****************************************************************************
 GetRDKitSims::GetRDKitSims( const vector<pMolRec> &molecules ,
                             double tversky_alpha , double tversky_beta ,
-                            double gamma , double sim_thresh ) :
-  molecules_( molecules ) , tversky_alpha_( tversky_alpha ) , tversky_beta_( tversky_beta ) ,
-  gamma_( gamma ) , sim_thresh_( sim_thresh ) {
+                            double gamma , double sim_thresh , bool float_values ) :
+  tversky_alpha_( tversky_alpha ) , tversky_beta_( tversky_beta ) ,
+  gamma_( gamma ) , sim_thresh_( sim_thresh ) , float_values_( float_values ) {
 
-  build_sim_matrix();
+  add_molecules( molecules );
 
 }
 
 // ****************************************************************************
-void GetRDKitSims::build_sim_matrix() {
+size_t GetRDKitSims::num_sims() const {
 
-  sims_.clear();
+  size_t ret_val = 0;
+  for( int i = 0 , is = cols_.size() ; i < is ; ++i ) {
+    ret_val += cols_[i].size();
+  }
+  for( int i = 0 , is = float_cols_.size() ; i < is ; ++i ) {
+    ret_val += float_cols_[i].size();
+  }
+
+  return ret_val;
+
+}
+
+// ****************************************************************************
+void GetRDKitSims::csc_sims( long *pointr , long *rowind , double *values ) const {
+
+  long n = 0;
+  for( int i = 0 , is = cols_.size() ; i < is ; ++i ) {
+    pointr[i] = n;
+    for( int j = 0 , js = cols_[i].size() ; j < js ; ++j , ++n ) {
+      rowind[n] = cols_[i][j].first;
+      values[n] = cols_[i][j].second;
+    }
+  }
+  pointr[cols_.size()] = n;
+
+}
+
+// ****************************************************************************
+bool GetRDKitSims::can_extend( const vector<pMolRec> &molecules ,
+                               double tversky_alpha , double tversky_beta ,
+                               double gamma , double sim_thresh ,
+                               bool float_values ) const {
+
+  if( tversky_alpha != tversky_alpha_ || tversky_beta != tversky_beta_ ||
+      gamma != gamma_ || sim_thresh != sim_thresh_ || float_values != float_values_ ||
+      molecules.size() < fps_.size() ) {
+    return false;
+  }
+
+  // if the fingerprints have been rebuilt, they'll be new objects
+  for( int i = 0 , is = fps_.size() ; i < is ; ++i ) {
+    if( molecules[i]->get_fingerprint() != fps_[i] ) {
+      return false;
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+void GetRDKitSims::add_molecules( const vector<pMolRec> &molecules ) {
 
-  for( int i = 0 , is = static_cast<int>( molecules_.size() ) - 1 ; i < is ; ++i ) {
-    if( !molecules_[i]->get_fingerprint() ) {
+  int old_num_mols = fps_.size();
+  for( int i = old_num_mols , is = molecules.size() ; i < is ; ++i ) {
+    fps_.push_back( molecules[i]->get_fingerprint() );
+  }
+
+  if( float_values_ ) {
+    add_columns( old_num_mols , float_cols_ );
+  } else {
+    add_columns( old_num_mols , cols_ );
+  }
+
+}
+
+// ****************************************************************************
+template <typename T>
+void GetRDKitSims::add_columns( int old_num_mols , vector<vector<pair<int,T> > > &cols ) {
+
+  int num_mols = fps_.size();
+  cols.resize( num_mols );
+
+  // each new column is done by one thread, which keeps the elements for the rows of
+  // the earlier columns to one side. They're added afterwards in order of column, so
+  // the matrix is the same however many threads there are.
+  vector<vector<pair<int,T> > > new_rows( num_mols - old_num_mols );
+#pragma omp parallel for schedule(dynamic)
+  for( int j = old_num_mols ; j < num_mols ; ++j ) {
+    if( !fps_[j] ) {
       continue;
     }
-    for( int j = i + 1 , js = molecules_.size() ; j < js ; ++j ) {
-      if( !molecules_[j]->get_fingerprint() ) {
-        continue;
+    for( int i = 0 ; i < j ; ++i ) {
+      if( fps_[i] ) {
+        add_sims( i , j , cols[j] , new_rows[j - old_num_mols] );
       }
-      double sim = TverskySimilarity<ExplicitBitVect>( *(molecules_[i]->get_fingerprint()) ,
-                                                       *(molecules_[j]->get_fingerprint()) ,
-                                                       tversky_alpha_ , tversky_beta_ );
+    }
+  }
+
+  for( int j = old_num_mols ; j < num_mols ; ++j ) {
+    const vector<pair<int,T> > &row_j = new_rows[j - old_num_mols];
+    for( int k = 0 , ks = row_j.size() ; k < ks ; ++k ) {
+      cols[row_j[k].first].push_back( make_pair( j , row_j[k].second ) );
+    }
+  }
+
+}
+
+// ****************************************************************************
+template <typename T>
+void GetRDKitSims::add_sims( int i , int j , vector<pair<int,T> > &col_j ,
+                             vector<pair<int,T> > &row_j ) const {
+
+  double sim = TverskySimilarity<ExplicitBitVect>( *fps_[i] , *fps_[j] ,
+                                                   tversky_alpha_ , tversky_beta_ );
 #ifdef NOTYET
-      cout << i << " , " << j << " -> " << sim << endl;
+  cout << i << " , " << j << " -> " << sim << endl;
 #endif
-      sim = exp( -1.0 * gamma_ * ( sim - 1.0 ) * ( sim - 1.0 ) );
-      if( sim > sim_thresh_ ) {
-        sims_.push_back( make_tuple( i , j , sim ) );
-      }
+  sim = exp( -1.0 * gamma_ * ( sim - 1.0 ) * ( sim - 1.0 ) );
+  if( sim > sim_thresh_ ) {
+    row_j.push_back( make_pair( i , T( sim ) ) );
+  }
 
-      if( tversky_alpha_ == tversky_beta_ ) {
-        sims_.push_back( make_tuple( j , i , sim ) );
-      } else {
-        sim = TverskySimilarity<ExplicitBitVect>( *(molecules_[j]->get_fingerprint()) ,
-                                                  *(molecules_[i]->get_fingerprint()) ,
-                                                  tversky_alpha_ , tversky_beta_ );
+  if( tversky_alpha_ == tversky_beta_ ) {
+    col_j.push_back( make_pair( i , T( sim ) ) );
+  } else {
+    sim = TverskySimilarity<ExplicitBitVect>( *fps_[j] , *fps_[i] ,
+                                              tversky_alpha_ , tversky_beta_ );
 #ifdef NOTYET
-        cout << j << " , " << i << " -> " << sim << endl;
+    cout << j << " , " << i << " -> " << sim << endl;
 #endif
-        sims_.push_back( make_tuple( j , i , sim ) );
-      }
-    }
+    col_j.push_back( make_pair( i , T( sim ) ) );
   }
 
-  // dists must be sorted into ascending order of first value, so that it can be fed into the
-  // SVD functions correctly. Using the magic spell in boost_tuples_and_bind
-  sort( sims_.begin() , sims_.end() ,
-        bind( less<int>() ,
-              bind( &getTupleElement<0,MatrixEl> , _1 ) ,
-              bind( &getTupleElement<0,MatrixEl> , _2 ) ) );
-
 }
@@ -13,6 +13,9 @@
 #include "KMeansClustersDialog.H"
 #include "SVDClusSettings.H"
 
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDoubleValidator>
 #include <QFormLayout>
 #include <QFrame>
 #include <QIntValidator>
@@ -37,12 +40,37 @@ KMeansClustersDialog::KMeansClustersDialog( SVDClusSettings *initial_settings ,
 
 // ****************************************************************************
 void KMeansClustersDialog::get_settings( int &start_num_clus , int &stop_num_clus ,
-                                         int &num_clus_step ,  int &num_iters ) const {
+                                         int &num_clus_step ,  int &num_iters ,
+                                         KMEANS_SEEDING &seeding ,
+                                         int &batch_size ,
+                                         unsigned int &random_seed ,
+                                         bool &warm_sweep ,
+                                         bool &exact_sil ,
+                                         double &sil_sample_tol ) const {
 
   BuildClustersDialog::get_settings( start_num_clus , stop_num_clus , num_clus_step );
 
   num_iters = num_iters_->text().toInt();
 
+  switch( seeding_->currentIndex() ) {
+  case 0 :
+    seeding = RANDOM_SEEDS;
+    break;
+  case 1 :
+    seeding = KMEANS_PP_SEEDS;
+    break;
+  case 2 :
+    seeding = KMEANS_PARALLEL_SEEDS;
+    break;
+  }
+
+  batch_size = batch_size_->text().toInt();
+  random_seed = random_seed_->text().toUInt();
+  warm_sweep = warm_sweep_->isChecked();
+  exact_sil = exact_sil_->isChecked();
+  // greyed out means it wouldn't be used
+  sil_sample_tol = sil_sample_tol_->isEnabled() ? sil_sample_tol_->text().toDouble() : 0.0;
+
 }
 
 // ****************************************************************************
@@ -64,10 +92,57 @@ void KMeansClustersDialog::build_widget( SVDClusSettings *initial_settings ) {
 
   // still to do - make use of this validator
   QIntValidator *ncval = new QIntValidator( 0 , std::numeric_limits<int>::max() , this );
-  num_iters_ = new QLineEdit( QString( "%1" ).arg( 10 ) );
+  num_iters_ = new QLineEdit( QString( "%1" ).arg( initial_settings->k_means_iters() ) );
   num_iters_->setValidator( ncval );
   main_form_->addRow( "Num Iterations" , num_iters_ );
 
+  // in the same order as KMEANS_SEEDING
+  seeding_ = new QComboBox;
+  seeding_->addItem( "Random" );
+  seeding_->addItem( "K-Means++" );
+  seeding_->addItem( "K-Means||" );
+  seeding_->setCurrentIndex( initial_settings->k_means_seeding() );
+  main_form_->addRow( "Seeding" , seeding_ );
+
+  // 0 means use all the molecules each iteration
+  batch_size_ = new QLineEdit( QString( "%1" ).arg( initial_settings->k_means_batch_size() ) );
+  batch_size_->setValidator( ncval );
+  main_form_->addRow( "Mini-batch size" , batch_size_ );
+
+  random_seed_ = new QLineEdit( QString( "%1" ).arg( initial_settings->random_seed() ) );
+  random_seed_->setValidator( ncval );
+  main_form_->addRow( "Random seed" , random_seed_ );
+
+  warm_sweep_ = new QCheckBox;
+  warm_sweep_->setChecked( initial_settings->k_means_warm_sweep() );
+  main_form_->addRow( "Warm-start sweep" , warm_sweep_ );
+
+  exact_sil_ = new QCheckBox;
+  exact_sil_->setChecked( initial_settings->k_means_exact_sil() );
+  main_form_->addRow( "Exact silhouette" , exact_sil_ );
+
+  // 0 means the full score
+  sil_sample_tol_ = new QLineEdit( QString( "%1" ).arg( initial_settings->sil_sample_tol() ) );
+  sil_sample_tol_->setValidator( new QDoubleValidator( 0.0 , 1.0 , 4 , this ) );
+  main_form_->addRow( "Silhouette sample tolerance" , sil_sample_tol_ );
+
+  connect( batch_size_ , SIGNAL( textChanged( const QString & ) ) ,
+           this , SLOT( slot_batch_size_changed() ) );
+  connect( exact_sil_ , SIGNAL( toggled( bool ) ) ,
+           this , SLOT( slot_batch_size_changed() ) );
+  slot_batch_size_changed();
+
   setWindowTitle( "K-Means Clusters" );
 
 }
+
+// ****************************************************************************
+void KMeansClustersDialog::slot_batch_size_changed() {
+
+  bool full_k_means = batch_size_->text().toInt() <= 0;
+  warm_sweep_->setEnabled( full_k_means );
+  exact_sil_->setEnabled( full_k_means );
+  // only the exact silhouette is sampled
+  sil_sample_tol_->setEnabled( full_k_means && exact_sil_->isChecked() );
+
+}
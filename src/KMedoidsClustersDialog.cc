@@ -0,0 +1,96 @@
+//
+// file KMedoidsClustersDialog.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+
+#include "KMedoidsClustersDialog.H"
+#include "SVDClusSettings.H"
+
+#include <QDoubleValidator>
+#include <QFormLayout>
+#include <QIntValidator>
+#include <QLayout>
+#include <QLineEdit>
+
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+// ****************************************************************************
+KMedoidsClustersDialog::KMedoidsClustersDialog( SVDClusSettings *initial_settings ,
+                                                QWidget *parent , Qt::WindowFlags f ) :
+  BuildClustersDialog( initial_settings , parent , f ) {
+
+  build_widget( initial_settings );
+
+}
+
+// ****************************************************************************
+void KMedoidsClustersDialog::get_settings( int &start_num_clus , int &stop_num_clus ,
+                                           int &num_clus_step , double &tv_alpha ,
+                                           double &tv_beta , int &sample_size ,
+                                           int &num_samples ,
+                                           unsigned int &random_seed ) const {
+
+  BuildClustersDialog::get_settings( start_num_clus , stop_num_clus , num_clus_step );
+
+  tv_alpha = tv_alpha_->text().toDouble();
+  tv_beta = tv_beta_->text().toDouble();
+  sample_size = sample_size_->text().toInt();
+  num_samples = num_samples_->text().toInt();
+  random_seed = random_seed_->text().toUInt();
+
+}
+
+// ****************************************************************************
+void KMedoidsClustersDialog::build_widget( SVDClusSettings *initial_settings ) {
+
+  if( !main_vbox_ ) {
+    main_vbox_ = new QVBoxLayout;
+    setLayout( main_vbox_ );
+  }
+
+  if( !main_form_ ) {
+    main_form_ = new QFormLayout;
+    main_vbox_->addLayout( main_form_ );
+  }
+
+#ifdef NOTYET
+  cout << "KMedoidsClustersDialog::build_widget() : " << endl;
+#endif
+
+  QDoubleValidator *dval = new QDoubleValidator( 0.0 , 1.0 , 3 , this );
+  QIntValidator *ival = new QIntValidator( 0 , std::numeric_limits<int>::max() , this );
+
+  tv_alpha_ = new QLineEdit( QString( "%1" ).arg( initial_settings->tversky_alpha() ) );
+  tv_alpha_->setValidator( dval );
+  main_form_->addRow( "Tversky Alpha" , tv_alpha_ );
+
+  tv_beta_ = new QLineEdit( QString( "%1" ).arg( initial_settings->tversky_beta() ) );
+  tv_beta_->setValidator( dval );
+  main_form_->addRow( "Tversky Beta" , tv_beta_ );
+
+  // 0 means use all the molecules, however many there are
+  sample_size_ = new QLineEdit( QString( "%1" ).arg( initial_settings->k_medoids_sample_size() ) );
+  sample_size_->setValidator( ival );
+  main_form_->addRow( "Sample size" , sample_size_ );
+
+  num_samples_ = new QLineEdit( QString( "%1" ).arg( initial_settings->k_medoids_samples() ) );
+  num_samples_->setValidator( ival );
+  main_form_->addRow( "Num Samples" , num_samples_ );
+
+  random_seed_ = new QLineEdit( QString( "%1" ).arg( initial_settings->random_seed() ) );
+  random_seed_->setValidator( ival );
+  main_form_->addRow( "Random seed" , random_seed_ );
+
+  setWindowTitle( "K-Medoids Clusters" );
+
+}
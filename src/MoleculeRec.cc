@@ -9,10 +9,25 @@
 //  which is included in the file license.txt, found at the root
 //  of the source tree.
 
+#include "DenseMatrix.H"
 #include "MoleculeRec.H"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <GraphMol/RDKitBase.h>
+#include <GraphMol/Fingerprints/MorganFingerprints.h>
+#include <GraphMol/Fingerprints/Fingerprints.h>
+#include <GraphMol/SmilesParse/SmilesParse.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
 
 using namespace boost;
 using namespace std;
@@ -57,11 +72,79 @@ bool MoleculeRec::add_data( const string &data_name , float data_val , bool over
 }
 
 // ****************************************************************************
-// return the contents of each molecule's fingerprint as a vector of floats. Some
-// clustering algorithms such as k-means don't work with the bitstrings
+// return the contents of each molecule's fingerprint as a row of floats. Some
+// clustering algorithms such as k-means don't work with the bitstrings. Molecules
+// without a fingerprint don't get a row. The bits go into the columns given by
+// bit_cols, from select_fingerprint_bits, of which there are num_cols.
 void get_fingerprints_as_floats( const vector<pMolRec> &molecules ,
-                                 vector<vector<float> > &fps ) {
+                                 const vector<int> &bit_cols , int num_cols ,
+                                 DenseMatrix &fps ) {
+
+  int num_fps = 0;
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+    if( mol->get_fingerprint() ) {
+      ++num_fps;
+    }
+  }
+
+  fps.resize( num_fps , num_cols );
+  int row = 0;
+  vector<int> on_bits;
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+
+    pRD_FP fp = mol->get_fingerprint();
+    if( !fp ) {
+      continue;
+    }
+
+    float *fp_row = fps.row( row++ );
+    fp->getOnBits( on_bits );
+    map_fingerprint_bits( bit_cols , on_bits );
+    for( int i = 0 , is = on_bits.size() ; i < is ; ++i ) {
+      fp_row[on_bits[i]] = 1.0;
+    }
+
+  }
+
+}
+
+// ****************************************************************************
+// return the on bits of each molecule's fingerprint, which takes a lot less space
+// than the floats for sparse fingerprints. num_bits is the length of the longest
+// fingerprint.
+void get_fingerprints_as_on_bits( const vector<pMolRec> &molecules ,
+                                  vector<vector<int> > &on_bits ,
+                                  int &num_bits ) {
+
+  num_bits = 0;
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+
+    pRD_FP fp = mol->get_fingerprint();
+    if( !fp ) {
+      continue;
+    }
+
+    num_bits = max( num_bits , static_cast<int>( fp->getNumBits() ) );
+    on_bits.push_back( vector<int>() );
+    fp->getOnBits( on_bits.back() );
 
+  }
+
+}
+
+// ****************************************************************************
+// Pick the fingerprint bits worth clustering on. A bit that's on in none of the
+// fingerprints, or in all of them, adds the same to every distance so it makes no
+// difference to the clusters. If max_bits is more than 0, at most that many are
+// kept, the ones with the highest variance, which for a bit that's on in a
+// fraction p of the fingerprints is p( 1 - p ). bit_cols[b] is the column that
+// bit b goes into, or -1 if it's dropped, and num_cols is the number kept.
+void select_fingerprint_bits( const vector<pMolRec> &molecules , int max_bits ,
+                              vector<int> &bit_cols , int &num_cols ) {
+
+  vector<int> bit_counts;
+  vector<int> on_bits;
+  int num_fps = 0;
   BOOST_FOREACH( pMolRec mol , molecules ) {
 
     pRD_FP fp = mol->get_fingerprint();
@@ -69,15 +152,181 @@ void get_fingerprints_as_floats( const vector<pMolRec> &molecules ,
       continue;
     }
 
-    fps.push_back( vector<float>( fp->getNumBits() ) );
-    for( unsigned int i = 0 ; i < fp->getNumBits() ; ++i ) {
-      if( (*fp)[i] ) {
-        fps.back()[i] = 1.0;
+    ++num_fps;
+    if( int( fp->getNumBits() ) > int( bit_counts.size() ) ) {
+      bit_counts.resize( fp->getNumBits() , 0 );
+    }
+    fp->getOnBits( on_bits );
+    for( int i = 0 , is = on_bits.size() ; i < is ; ++i ) {
+      ++bit_counts[on_bits[i]];
+    }
+
+  }
+
+  // minus the variance, scaled by num_fps squared, so the sort puts the biggest first
+  vector<pair<double,int> > variances;
+  for( int b = 0 , bs = bit_counts.size() ; b < bs ; ++b ) {
+    if( bit_counts[b] && bit_counts[b] < num_fps ) {
+      variances.push_back( make_pair( -double( bit_counts[b] ) * ( num_fps - bit_counts[b] ) , b ) );
+    }
+  }
+  if( max_bits > 0 && max_bits < int( variances.size() ) ) {
+    sort( variances.begin() , variances.end() );
+    variances.erase( variances.begin() + max_bits , variances.end() );
+  }
+
+  // keep the bits in their original order
+  bit_cols = vector<int>( bit_counts.size() , -1 );
+  for( int i = 0 , is = variances.size() ; i < is ; ++i ) {
+    bit_cols[variances[i].second] = 0;
+  }
+  num_cols = 0;
+  for( int b = 0 , bs = bit_cols.size() ; b < bs ; ++b ) {
+    if( !bit_cols[b] ) {
+      bit_cols[b] = num_cols++;
+    }
+  }
+
+  if( !bit_counts.empty() ) {
+    cout << "Clustering on " << num_cols << " of " << bit_counts.size()
+         << " fingerprint bits, a reduction of "
+         << 100.0 * double( int( bit_counts.size() ) - num_cols ) / double( bit_counts.size() )
+         << "%." << endl;
+  }
+
+}
+
+// ****************************************************************************
+// move the on bits into their columns from select_fingerprint_bits, dropping the
+// ones that don't have one. The order is unchanged.
+void map_fingerprint_bits( const vector<int> &bit_cols , vector<int> &on_bits ) {
+
+  int num_kept = 0;
+  for( int i = 0 , is = on_bits.size() ; i < is ; ++i ) {
+    int col = bit_cols[on_bits[i]];
+    if( -1 != col ) {
+      on_bits[num_kept++] = col;
+    }
+  }
+  on_bits.resize( num_kept );
+
+}
+
+// ****************************************************************************
+void read_smiles_molecules( const string &smi_file , int num_mols_before ,
+                            vector<pMolRec> &new_mols ) {
+
+  ifstream ifs( smi_file.c_str() );
+  while( 1 ) {
+    string next_line , smi , name;
+    getline( ifs , next_line );
+    if( ifs.eof() || !ifs.good() ) {
+      break;
+    }
+
+    istringstream iss( next_line );
+    iss >> smi;
+    iss >> name;
+    if( iss.fail() ) {
+      name = string( "Str" ) + lexical_cast<string>( num_mols_before + new_mols.size() + 1 );
+    }
+    new_mols.push_back( pMolRec( new MoleculeRec( smi , name ) ) );
+  }
+
+}
+
+// ****************************************************************************
+void make_circular_fingerprints( const vector<pMolRec> &molecules , bool missing_only ) {
+
+#ifdef NOTYET
+  cout << "Building circular fingerprints" << endl;
+#endif
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+    if( missing_only && mol->get_fingerprint() ) {
+      continue;
+    }
+    RDKit::ROMol *newmol = RDKit::SmilesToMol( mol->smiles() );
+    mol->set_fingerprint( pRD_FP( RDKit::MorganFingerprints::getFingerprintAsBitVect( *newmol , 3 , 2048 ) ) );
+    delete newmol;
+  }
+
+}
+
+// ****************************************************************************
+void make_linear_fingerprints( const vector<pMolRec> &molecules , bool missing_only ) {
+
+#ifdef NOTYET
+  cout << "building linear fingerprints" << endl;
+#endif
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+    if( missing_only && mol->get_fingerprint() ) {
+      continue;
+    }
+    RDKit::ROMol *newmol = RDKit::SmilesToMol( mol->smiles() );
+    mol->set_fingerprint( pRD_FP( RDKit::RDKFingerprintMol( *newmol ) ) );
+    delete newmol;
+  }
+
+}
+
+// ****************************************************************************
+// The name can't contain whitespace. If more than one molecule has the name, the
+// first gets the fingerprint.
+void read_user_fingerprints( const string &fp_file , const vector<pMolRec> &molecules ) {
+
+#ifdef NOTYET
+  cout << "reading fingerprints from " << fp_file << endl;
+#endif
+  map<string,pMolRec> mols_by_name;
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+    mols_by_name.insert( make_pair( mol->name() , mol ) );
+  }
+
+  ifstream ifs( fp_file.c_str() );
+  while( 1 ) {
+    string next_line;
+    getline( ifs , next_line );
+    if( ifs.eof() || !ifs.good() ) {
+      break;
+    }
+    boost::trim( next_line );
+    if( next_line.empty() ) {
+      continue;
+    }
+    string::iterator i = next_line.begin();
+    string mol_name;
+    while( i != next_line.end() && !isspace( *i ) ) {
+      mol_name += *i;
+      ++i;
+    }
+
+    // find the right molecule
+    map<string,pMolRec>::iterator p = mols_by_name.find( mol_name );
+    if( p == mols_by_name.end() ) {
+      cout << "Error : molecule " << mol_name << " not found in dataset. Skipping." << endl;
+      continue;
+    }
+    vector<char> fp_bits;
+    for( ; i != next_line.end() ; ++i ) {
+      if( *i == '0' || *i == '1' ) {
+        fp_bits.push_back( *i );
+      } else if( isspace( *i ) ) {
+        continue;
       } else {
-        fps.back()[i] = 0.0;
+        break;
       }
     }
 
+#ifdef NOTYET
+    cout << mol_name << " : " << fp_bits.size() << endl;
+#endif
+    pRD_FP new_fp( new ExplicitBitVect( fp_bits.size() ) );
+    for( int j = 0 , js = fp_bits.size() ; j < js ; ++j ) {
+      if( '1' == fp_bits[j] ) {
+        new_fp->setBit( j );
+      }
+    }
+    p->second->set_fingerprint( new_fp );
   }
 
 }
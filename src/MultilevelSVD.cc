@@ -0,0 +1,428 @@
+//
+// file MultilevelSVD.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// Multilevel approximation of the SVD of the sparse similarity matrix, which is
+// quicker than svdLAS2 on the full matrix for large datasets. It starts from the
+// matrix that's already been built, so it doesn't save the time or memory of
+// calculating the similarities, just that of the decomposition. The similarity graph is coarsened repeatedly by heavy-edge matching,
+// each molecule (or super-node) being merged with the unmatched neighbour it's most
+// similar to, until there are only a few thousand super-nodes. If P is the
+// aggregation matrix of a level, with columns scaled to unit length, the next
+// level's matrix is P' K P. Only the coarsest matrix goes through svdLAS2. The
+// singular vectors are then taken back up through the levels, interpolated by P and
+// smoothed at each level by a couple of rounds of subspace iteration on that
+// level's matrix, finishing with a Rayleigh-Ritz step so that the singular values
+// and U and V vectors go together. The result is returned in an SVDRec in the
+// same form as svdLAS2 gives, so the rest of the clustering doesn't know the
+// difference.
+
+#include "SVDClusRDKitDefs.H"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+
+//SVDLIBC
+extern "C" {
+#include "svdlib.h"
+#include "svdutil.h"
+}
+
+using namespace std;
+
+// cols[i] holds the (row number, value) pairs of column i of a sparse matrix
+typedef vector<vector<pair<int,double> > > SparseCols;
+
+// number of rounds of subspace iteration at each level on the way back up
+static const int NUM_SMOOTHING_ITERS = 2;
+
+// *************************************************************************
+// coarse_map[i] is the super-node that node i goes into, coarse_sizes[c] the number
+// of nodes in super-node c. Returns the number of super-nodes.
+int heavy_edge_matching( const SparseCols &mat , boost::random::mt19937 &rng ,
+                         vector<int> &coarse_map , vector<int> &coarse_sizes ) {
+
+  int num_nodes = mat.size();
+
+  // the matrix might not be symmetric, so the neighbours of a node are in its
+  // column and its row.
+  SparseCols adj( num_nodes );
+  for( int i = 0 ; i < num_nodes ; ++i ) {
+    for( int j = 0 , js = mat[i].size() ; j < js ; ++j ) {
+      if( mat[i][j].first != i ) {
+        adj[i].push_back( mat[i][j] );
+        adj[mat[i][j].first].push_back( make_pair( i , mat[i][j].second ) );
+      }
+    }
+  }
+
+  // visit the nodes in random order, so the matching isn't biased by the order
+  // the molecules were read in.
+  vector<int> order( num_nodes );
+  for( int i = 0 ; i < num_nodes ; ++i ) {
+    order[i] = i;
+  }
+  for( int i = 0 ; i < num_nodes - 1 ; ++i ) {
+    boost::random::uniform_int_distribution<> dist( i , num_nodes - 1 );
+    swap( order[i] , order[dist( rng )] );
+  }
+
+  coarse_map = vector<int>( num_nodes , -1 );
+  coarse_sizes.clear();
+  vector<int> isolated;
+  for( int o = 0 ; o < num_nodes ; ++o ) {
+    int i = order[o];
+    if( -1 != coarse_map[i] ) {
+      continue;
+    }
+    if( adj[i].empty() ) {
+      isolated.push_back( i );
+      continue;
+    }
+    int best_nb = -1;
+    double best_wt = 0.0;
+    for( int j = 0 , js = adj[i].size() ; j < js ; ++j ) {
+      int nb = adj[i][j].first;
+      if( -1 == coarse_map[nb] && adj[i][j].second > best_wt ) {
+        best_nb = nb;
+        best_wt = adj[i][j].second;
+      }
+    }
+    coarse_map[i] = coarse_sizes.size();
+    if( -1 == best_nb ) {
+      coarse_sizes.push_back( 1 );
+    } else {
+      coarse_map[best_nb] = coarse_map[i];
+      coarse_sizes.push_back( 2 );
+    }
+  }
+
+  // nodes with no neighbours contribute nothing to the matrix, so pair them
+  // up with each other so they don't stop the coarsening.
+  for( int i = 0 , is = isolated.size() ; i < is ; i += 2 ) {
+    coarse_map[isolated[i]] = coarse_sizes.size();
+    if( i + 1 < is ) {
+      coarse_map[isolated[i + 1]] = coarse_sizes.size();
+      coarse_sizes.push_back( 2 );
+    } else {
+      coarse_sizes.push_back( 1 );
+    }
+  }
+
+  return coarse_sizes.size();
+
+}
+
+// *************************************************************************
+// coarse = P' fine P where P has a 1/sqrt(size) in row i, column coarse_map[i].
+void coarsen_matrix( const SparseCols &fine , const vector<int> &coarse_map ,
+                     const vector<int> &coarse_sizes , SparseCols &coarse ) {
+
+  int num_coarse = coarse_sizes.size();
+  coarse = SparseCols( num_coarse );
+
+  // accumulate each coarse column in a dense work vector, remembering which
+  // rows have been touched.
+  vector<double> work( num_coarse , 0.0 );
+  vector<int> touched;
+  vector<vector<int> > members( num_coarse );
+  for( int i = 0 , is = coarse_map.size() ; i < is ; ++i ) {
+    members[coarse_map[i]].push_back( i );
+  }
+
+  for( int c = 0 ; c < num_coarse ; ++c ) {
+    for( int m = 0 , ms = members[c].size() ; m < ms ; ++m ) {
+      const vector<pair<int,double> > &col = fine[members[c][m]];
+      for( int j = 0 , js = col.size() ; j < js ; ++j ) {
+        int r = coarse_map[col[j].first];
+        if( 0.0 == work[r] ) {
+          touched.push_back( r );
+        }
+        work[r] += col[j].second;
+      }
+    }
+    sort( touched.begin() , touched.end() );
+    for( int t = 0 , ts = touched.size() ; t < ts ; ++t ) {
+      int r = touched[t];
+      if( 0.0 != work[r] ) {
+        coarse[c].push_back( make_pair( r , work[r] / sqrt( double( coarse_sizes[r] * coarse_sizes[c] ) ) ) );
+      }
+      work[r] = 0.0;
+    }
+    touched.clear();
+  }
+
+}
+
+// *************************************************************************
+// out[k] = mat * in[k], or mat' * in[k] if transpose.
+void mat_times_vecs( const SparseCols &mat , bool transpose ,
+                     const vector<vector<double> > &in , vector<vector<double> > &out ) {
+
+  int num_vecs = in.size();
+  int n = mat.size();
+  out = vector<vector<double> >( num_vecs , vector<double>( n , 0.0 ) );
+
+#pragma omp parallel for schedule(static)
+  for( int k = 0 ; k < num_vecs ; ++k ) {
+    for( int i = 0 ; i < n ; ++i ) {
+      for( int j = 0 , js = mat[i].size() ; j < js ; ++j ) {
+        if( transpose ) {
+          out[k][i] += mat[i][j].second * in[k][mat[i][j].first];
+        } else {
+          out[k][mat[i][j].first] += mat[i][j].second * in[k][i];
+        }
+      }
+    }
+  }
+
+}
+
+// *************************************************************************
+// modified Gram-Schmidt. Vectors that are (nearly) in the span of the ones
+// before are dropped.
+void orthonormalise( vector<vector<double> > &vecs ) {
+
+  vector<vector<double> > ortho_vecs;
+  for( int k = 0 , ks = vecs.size() ; k < ks ; ++k ) {
+    vector<double> &v = vecs[k];
+    double orig_norm = 0.0;
+    for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+      orig_norm += v[i] * v[i];
+    }
+    for( int l = 0 , ls = ortho_vecs.size() ; l < ls ; ++l ) {
+      double dot = 0.0;
+      for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+        dot += v[i] * ortho_vecs[l][i];
+      }
+      for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+        v[i] -= dot * ortho_vecs[l][i];
+      }
+    }
+    double norm = 0.0;
+    for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+      norm += v[i] * v[i];
+    }
+    if( norm <= 1.0e-20 * orig_norm || 0.0 == norm ) {
+      continue;
+    }
+    norm = sqrt( norm );
+    for( int i = 0 , is = v.size() ; i < is ; ++i ) {
+      v[i] /= norm;
+    }
+    ortho_vecs.push_back( v );
+  }
+
+  vecs.swap( ortho_vecs );
+
+}
+
+// *************************************************************************
+SVDRec svd_of_sparse_cols( const SparseCols &mat , int num_sing_vals ) {
+
+  int num_vals = 0;
+  for( int i = 0 , is = mat.size() ; i < is ; ++i ) {
+    num_vals += mat[i].size();
+  }
+
+  SMat smat = svdNewSMat( mat.size() , mat.size() , num_vals );
+  for( int i = 0 , n = 0 , is = mat.size() ; i < is ; ++i ) {
+    smat->pointr[i] = n;
+    for( int j = 0 , js = mat[i].size() ; j < js ; ++j , ++n ) {
+      smat->rowind[n] = mat[i][j].first;
+      smat->value[n] = mat[i][j].second;
+    }
+  }
+  smat->pointr[smat->cols] = smat->vals;
+
+  int iterations = 0;
+  double las2end[2] = { -1.0e-30 , 1.0e-30 };
+  double kappa = 1.0e-6;
+  SVDRec ret_val = svdLAS2( smat , std::min( num_sing_vals , int( mat.size() ) ) ,
+                            iterations , las2end , kappa );
+  svdFreeSMat( smat );
+
+  return ret_val;
+
+}
+
+// *************************************************************************
+// given orthonormal bases for the left and right singular subspaces, find the
+// singular values and vectors of a matrix within them from the SVD of the small
+// matrix q_u' mat q_v. mat_q_v is the matrix times q_v.
+void rayleigh_ritz( const vector<vector<double> > &q_u , const vector<vector<double> > &q_v ,
+                    const vector<vector<double> > &mat_q_v ,
+                    vector<vector<double> > &u_vecs , vector<vector<double> > &v_vecs ,
+                    vector<double> &sing_vals ) {
+
+  int num_u = q_u.size() , num_v = q_v.size();
+  if( !num_u || !num_v ) {
+    u_vecs.clear();
+    v_vecs.clear();
+    sing_vals.clear();
+    return;
+  }
+  DMat small_mat = svdNewDMat( num_u , num_v );
+  for( int a = 0 ; a < num_u ; ++a ) {
+    for( int b = 0 ; b < num_v ; ++b ) {
+      double dot = 0.0;
+      for( int i = 0 , is = q_u[a].size() ; i < is ; ++i ) {
+        dot += q_u[a][i] * mat_q_v[b][i];
+      }
+      small_mat->value[a][b] = dot;
+    }
+  }
+  SMat small_smat = svdConvertDtoS( small_mat );
+  svdFreeDMat( small_mat );
+
+  int iterations = 0;
+  double las2end[2] = { -1.0e-30 , 1.0e-30 };
+  double kappa = 1.0e-6;
+  SVDRec small_res = svdLAS2( small_smat , std::min( num_u , num_v ) , iterations , las2end , kappa );
+  svdFreeSMat( small_smat );
+
+  int n = q_u.empty() ? 0 : q_u.front().size();
+  u_vecs = vector<vector<double> >( small_res->d , vector<double>( n , 0.0 ) );
+  v_vecs = vector<vector<double> >( small_res->d , vector<double>( n , 0.0 ) );
+  sing_vals = vector<double>( small_res->S , small_res->S + small_res->d );
+  for( int k = 0 ; k < small_res->d ; ++k ) {
+    for( int a = 0 ; a < num_u ; ++a ) {
+      double c = small_res->Ut->value[k][a];
+      for( int i = 0 ; i < n ; ++i ) {
+        u_vecs[k][i] += c * q_u[a][i];
+      }
+    }
+    for( int b = 0 ; b < num_v ; ++b ) {
+      double c = small_res->Vt->value[k][b];
+      for( int i = 0 ; i < n ; ++i ) {
+        v_vecs[k][i] += c * q_v[b][i];
+      }
+    }
+  }
+
+  svdFreeSVDRec( small_res );
+
+}
+
+// *************************************************************************
+void rayleigh_ritz( const SparseCols &mat ,
+                    const vector<vector<double> > &q_u , const vector<vector<double> > &q_v ,
+                    vector<vector<double> > &u_vecs , vector<vector<double> > &v_vecs ,
+                    vector<double> &sing_vals ) {
+
+  vector<vector<double> > mat_q_v;
+  mat_times_vecs( mat , false , q_v , mat_q_v );
+  rayleigh_ritz( q_u , q_v , mat_q_v , u_vecs , v_vecs , sing_vals );
+
+}
+
+// *************************************************************************
+// take the vectors from the coarse level to the fine one, and smooth them.
+void refine_svd( const SparseCols &mat , const vector<int> &coarse_map ,
+                 const vector<int> &coarse_sizes ,
+                 vector<vector<double> > &u_vecs , vector<vector<double> > &v_vecs ,
+                 vector<double> &sing_vals ) {
+
+  // the U vectors come from the V ones in the first round of smoothing, so only
+  // the V ones need interpolating.
+  int n = mat.size();
+  vector<vector<double> > q_u;
+  vector<vector<double> > q_v( v_vecs.size() , vector<double>( n , 0.0 ) );
+  for( int i = 0 ; i < n ; ++i ) {
+    double scale = 1.0 / sqrt( double( coarse_sizes[coarse_map[i]] ) );
+    for( int k = 0 , ks = v_vecs.size() ; k < ks ; ++k ) {
+      q_v[k][i] = v_vecs[k][coarse_map[i]] * scale;
+    }
+  }
+
+  orthonormalise( q_v );
+  for( int it = 0 ; it < NUM_SMOOTHING_ITERS ; ++it ) {
+    mat_times_vecs( mat , false , q_v , q_u );
+    orthonormalise( q_u );
+    mat_times_vecs( mat , true , q_u , q_v );
+    orthonormalise( q_v );
+  }
+
+  rayleigh_ritz( mat , q_u , q_v , u_vecs , v_vecs , sing_vals );
+
+}
+
+// *************************************************************************
+// sim_cols is the similarity matrix, as GetRDKitSims::cols() gives it, which is
+// used as the finest level as it is.
+SVDRec multilevel_svd( const SparseCols &sim_cols , int num_clusters , int coarsest_size ,
+                       boost::random::mt19937 &rng ) {
+
+  int matrix_size = sim_cols.size();
+  // levels[0] is sim_cols, the rest are in coarse_levels, a list so that adding
+  // one doesn't move the ones before.
+  list<SparseCols> coarse_levels;
+  vector<const SparseCols *> levels( 1 , &sim_cols );
+
+  // coarsen until small enough, or until the matching isn't achieving much
+  vector<vector<int> > coarse_maps , coarse_sizes;
+  while( int( levels.back()->size() ) > coarsest_size ) {
+    coarse_maps.push_back( vector<int>() );
+    coarse_sizes.push_back( vector<int>() );
+    int num_coarse = heavy_edge_matching( *levels.back() , rng , coarse_maps.back() ,
+                                         coarse_sizes.back() );
+    if( num_coarse > 0.95 * levels.back()->size() ) {
+      coarse_maps.pop_back();
+      coarse_sizes.pop_back();
+      break;
+    }
+    coarse_levels.push_back( SparseCols() );
+    coarsen_matrix( *levels.back() , coarse_maps.back() , coarse_sizes.back() ,
+                    coarse_levels.back() );
+    levels.push_back( &coarse_levels.back() );
+#ifdef NOTYET
+    cout << "Level " << levels.size() - 1 << " : " << levels.back()->size() << " super-nodes." << endl;
+#endif
+  }
+
+  SVDRec coarse_res = svd_of_sparse_cols( *levels.back() , num_clusters );
+  int coarse_n = levels.back()->size();
+  vector<double> sing_vals( coarse_res->S , coarse_res->S + coarse_res->d );
+  vector<vector<double> > u_vecs , v_vecs;
+  for( int k = 0 ; k < coarse_res->d ; ++k ) {
+    u_vecs.push_back( vector<double>( coarse_res->Ut->value[k] , coarse_res->Ut->value[k] + coarse_n ) );
+    v_vecs.push_back( vector<double>( coarse_res->Vt->value[k] , coarse_res->Vt->value[k] + coarse_n ) );
+  }
+  svdFreeSVDRec( coarse_res );
+
+  for( int l = int( levels.size() ) - 2 ; l >= 0 && !u_vecs.empty() ; --l ) {
+    refine_svd( *levels[l] , coarse_maps[l] , coarse_sizes[l] , u_vecs , v_vecs , sing_vals );
+  }
+
+  cout << "Multilevel SVD used " << levels.size() << " levels, coarsest with "
+       << coarse_n << " super-nodes, and gave " << sing_vals.size() << " singular vectors." << endl;
+
+  SVDRec ret_val = svdNewSVDRec();
+  ret_val->d = sing_vals.size();
+  ret_val->S = static_cast<double *>( calloc( max( ret_val->d , 1 ) , sizeof( double ) ) );
+  ret_val->Ut = svdNewDMat( ret_val->d , matrix_size );
+  ret_val->Vt = svdNewDMat( ret_val->d , matrix_size );
+  for( int k = 0 ; k < ret_val->d ; ++k ) {
+    ret_val->S[k] = sing_vals[k];
+    copy( u_vecs[k].begin() , u_vecs[k].end() , ret_val->Ut->value[k] );
+    copy( v_vecs[k].begin() , v_vecs[k].end() , ret_val->Vt->value[k] );
+  }
+
+  return ret_val;
+
+}
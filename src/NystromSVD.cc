@@ -0,0 +1,258 @@
+//
+// file NystromSVD.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// Nystrom approximation of the SVD of the Gaussian-filtered similarity matrix, for
+// datasets too large to build and decompose the full sparse matrix. A set of
+// landmark molecules is picked at random and only the similarities of all
+// molecules to the landmarks are calculated, so memory is linear in the number
+// of molecules. If K is the full matrix, C its columns for the landmarks, R its rows
+// for the landmarks and W the landmark-landmark block with SVD W = Uw Sw Vw', then
+// K ~= C W+ R, and the singular vectors of K are approximately C Vw Sw^-1 (left)
+// and R' Uw Sw^-1 (right). These are returned in an SVDRec in the same form as
+// svdLAS2 gives, so the rest of the clustering doesn't know the difference.
+// See Fowlkes et al., IEEE Trans. PAMI, 26, 214-225 (2004).
+
+#include "MoleculeRec.H"
+#include "PackedFingerprints.H"
+#include "SVDClusRDKitDefs.H"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+
+//SVDLIBC
+extern "C" {
+#include "svdlib.h"
+#include "svdutil.h"
+}
+
+using namespace std;
+
+// ****************************************************************************
+// pick the landmarks at random from the molecules that have fingerprints. Diversity
+// picking such as MaxMin isn't a good idea here - it gives landmarks that are
+// dissimilar to each other, so after the Gaussian filter and threshold the
+// landmark-landmark block of the matrix is almost all zeros.
+void pick_landmarks( const PackedFingerprints &packed_fps , int num_landmarks ,
+                     boost::random::mt19937 &rng , vector<int> &landmarks ) {
+
+  landmarks.clear();
+  for( int i = 0 , is = packed_fps.num_fps() ; i < is ; ++i ) {
+    if( packed_fps.has_fp( i ) ) {
+      landmarks.push_back( i );
+    }
+  }
+  if( int( landmarks.size() ) <= num_landmarks ) {
+    return;
+  }
+
+  // partial Fisher-Yates shuffle
+  for( int i = 0 ; i < num_landmarks ; ++i ) {
+    boost::random::uniform_int_distribution<> dist( i , landmarks.size() - 1 );
+    swap( landmarks[i] , landmarks[dist( rng )] );
+  }
+  landmarks.erase( landmarks.begin() + num_landmarks , landmarks.end() );
+  sort( landmarks.begin() , landmarks.end() );
+
+}
+
+// ****************************************************************************
+// c_block is num_mols rows by num_landmarks columns, sim of molecule to landmark,
+// r_block is num_landmarks rows by num_mols columns, sim of landmark to molecule,
+// and is only filled if the similarity is asymmetric.
+void calc_landmark_sims( const PackedFingerprints &packed_fps ,
+                         double tversky_alpha , double tversky_beta ,
+                         const vector<int> &landmarks ,
+                         vector<float> &c_block , vector<float> &r_block ) {
+
+  int num_mols = packed_fps.num_fps();
+  int num_landmarks = landmarks.size();
+  c_block = vector<float>( size_t( num_mols ) * num_landmarks , 0.0F );
+  if( tversky_alpha != tversky_beta ) {
+    r_block = vector<float>( size_t( num_mols ) * num_landmarks , 0.0F );
+  }
+
+#pragma omp parallel for schedule(static)
+  for( int i = 0 ; i < num_mols ; ++i ) {
+    if( !packed_fps.has_fp( i ) ) {
+      continue;
+    }
+    for( int l = 0 ; l < num_landmarks ; ++l ) {
+      c_block[size_t( i ) * num_landmarks + l] = packed_fps.tversky( i , landmarks[l] ,
+                                                                     tversky_alpha , tversky_beta );
+      if( !r_block.empty() ) {
+        r_block[size_t( l ) * num_mols + i] = packed_fps.tversky( landmarks[l] , i ,
+                                                                  tversky_alpha , tversky_beta );
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// apply the same Gaussian transformation and threshold to the similarities that
+// GetRDKitSims does. Molecules aren't similar to themselves in the full matrix,
+// so the landmarks' self-similarities are zeroed, too.
+void gauss_filter_landmark_sims( const PackedFingerprints &packed_fps ,
+                                 const vector<int> &landmarks ,
+                                 double gamma , double sim_thresh ,
+                                 vector<float> &c_block , vector<float> &r_block ) {
+
+  int num_mols = packed_fps.num_fps();
+  int num_landmarks = landmarks.size();
+  for( int i = 0 ; i < num_mols ; ++i ) {
+    if( !packed_fps.has_fp( i ) ) {
+      continue;
+    }
+    for( int l = 0 ; l < num_landmarks ; ++l ) {
+      float &c = c_block[size_t( i ) * num_landmarks + l];
+      c = exp( -1.0 * gamma * ( c - 1.0 ) * ( c - 1.0 ) );
+      if( c <= sim_thresh || i == landmarks[l] ) {
+        c = 0.0F;
+      }
+      if( !r_block.empty() ) {
+        float &r = r_block[size_t( l ) * num_mols + i];
+        r = exp( -1.0 * gamma * ( r - 1.0 ) * ( r - 1.0 ) );
+        if( r <= sim_thresh || i == landmarks[l] ) {
+          r = 0.0F;
+        }
+      }
+    }
+  }
+
+}
+
+// ****************************************************************************
+// extend the singular vectors of the landmark block to all the molecules, normalise
+// them and put them in descending order of the corresponding approximate singular
+// values.
+SVDRec extend_landmark_svd( int num_mols , int num_landmarks ,
+                            const vector<float> &c_block , const vector<float> &r_block ,
+                            SVDRec land_res ) {
+
+  // drop any vanishingly small singular values, as they'd blow up on division
+  int rank = 0;
+  while( rank < land_res->d && land_res->S[rank] > 1.0e-10 * land_res->S[0] ) {
+    ++rank;
+  }
+
+  vector<vector<double> > u_vecs( rank , vector<double>( num_mols , 0.0 ) );
+  vector<vector<double> > v_vecs( rank , vector<double>( num_mols , 0.0 ) );
+
+#pragma omp parallel for schedule(static)
+  for( int i = 0 ; i < num_mols ; ++i ) {
+    const float *c_row = &c_block[0] + size_t( i ) * num_landmarks;
+    for( int k = 0 ; k < rank ; ++k ) {
+      double u = 0.0 , v = 0.0;
+      for( int l = 0 ; l < num_landmarks ; ++l ) {
+        u += c_row[l] * land_res->Vt->value[k][l];
+        if( r_block.empty() ) {
+          v += c_row[l] * land_res->Ut->value[k][l];
+        } else {
+          v += r_block[size_t( l ) * num_mols + i] * land_res->Ut->value[k][l];
+        }
+      }
+      u_vecs[k][i] = u / land_res->S[k];
+      v_vecs[k][i] = v / land_res->S[k];
+    }
+  }
+
+  // the extended vectors aren't unit length. The singular value of K that goes with
+  // the normalised vectors absorbs both lengths.
+  vector<pair<double,int> > sing_vals;
+  for( int k = 0 ; k < rank ; ++k ) {
+    double u_norm = 0.0 , v_norm = 0.0;
+    for( int i = 0 ; i < num_mols ; ++i ) {
+      u_norm += u_vecs[k][i] * u_vecs[k][i];
+      v_norm += v_vecs[k][i] * v_vecs[k][i];
+    }
+    u_norm = sqrt( u_norm );
+    v_norm = sqrt( v_norm );
+    if( 0.0 == u_norm || 0.0 == v_norm ) {
+      continue;
+    }
+    for( int i = 0 ; i < num_mols ; ++i ) {
+      u_vecs[k][i] /= u_norm;
+      v_vecs[k][i] /= v_norm;
+    }
+    sing_vals.push_back( make_pair( land_res->S[k] * u_norm * v_norm , k ) );
+  }
+  sort( sing_vals.begin() , sing_vals.end() , greater<pair<double,int> >() );
+
+  SVDRec ret_val = svdNewSVDRec();
+  ret_val->d = sing_vals.size();
+  ret_val->S = static_cast<double *>( calloc( max( ret_val->d , 1 ) , sizeof( double ) ) );
+  ret_val->Ut = svdNewDMat( ret_val->d , num_mols );
+  ret_val->Vt = svdNewDMat( ret_val->d , num_mols );
+  for( int k = 0 ; k < ret_val->d ; ++k ) {
+    ret_val->S[k] = sing_vals[k].first;
+    copy( u_vecs[sing_vals[k].second].begin() , u_vecs[sing_vals[k].second].end() ,
+          ret_val->Ut->value[k] );
+    copy( v_vecs[sing_vals[k].second].begin() , v_vecs[sing_vals[k].second].end() ,
+          ret_val->Vt->value[k] );
+  }
+
+  return ret_val;
+
+}
+
+// ****************************************************************************
+SVDRec nystrom_svd( const vector<pMolRec> &molecules ,
+                    float tversky_alpha , float tversky_beta ,
+                    float gamma , double sim_thresh ,
+                    int num_clusters , int num_landmarks ,
+                    boost::random::mt19937 &rng ) {
+
+  PackedFingerprints packed_fps( molecules );
+  int num_mols = packed_fps.num_fps();
+
+  vector<int> landmarks;
+  pick_landmarks( packed_fps , num_landmarks , rng , landmarks );
+  // there might have been fewer molecules with fingerprints than landmarks asked for
+  num_landmarks = landmarks.size();
+
+  vector<float> c_block , r_block;
+  calc_landmark_sims( packed_fps , tversky_alpha , tversky_beta , landmarks ,
+                      c_block , r_block );
+  gauss_filter_landmark_sims( packed_fps , landmarks , gamma , sim_thresh ,
+                              c_block , r_block );
+
+  DMat land_mat = svdNewDMat( num_landmarks , num_landmarks );
+  for( int l1 = 0 ; l1 < num_landmarks ; ++l1 ) {
+    for( int l2 = 0 ; l2 < num_landmarks ; ++l2 ) {
+      land_mat->value[l1][l2] = c_block[size_t( landmarks[l1] ) * num_landmarks + l2];
+    }
+  }
+  SMat land_smat = svdConvertDtoS( land_mat );
+  svdFreeDMat( land_mat );
+
+  int iterations = 0;
+  double las2end[2] = { -1.0e-30 , 1.0e-30 };
+  double kappa = 1.0e-6;
+  SVDRec land_res = svdLAS2( land_smat , std::min( num_clusters , num_landmarks ) ,
+                             iterations , las2end , kappa );
+  svdFreeSMat( land_smat );
+
+  SVDRec ret_val = extend_landmark_svd( num_mols , num_landmarks , c_block , r_block , land_res );
+  svdFreeSVDRec( land_res );
+
+  cout << "Nystrom approximation with " << num_landmarks << " landmarks gave "
+       << ret_val->d << " singular vectors." << endl;
+
+  return ret_val;
+
+}
@@ -0,0 +1,121 @@
+//
+// file PackedFingerprints.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+
+#include "MoleculeRec.H"
+#include "PackedFingerprints.H"
+
+#include <DataStructs/ExplicitBitVect.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// ****************************************************************************
+PackedFingerprints::PackedFingerprints( const vector<pMolRec> &molecules ) :
+  num_bits_( 0 ) , num_words_( 0 ) {
+
+  // the fingerprints should all be the same length, but take the longest just in case
+  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
+    pRD_FP fp = molecules[i]->get_fingerprint();
+    if( fp ) {
+      num_bits_ = std::max( num_bits_ , static_cast<int>( fp->getNumBits() ) );
+    }
+  }
+  num_words_ = ( num_bits_ + 63 ) / 64;
+
+  // always at least 1 word so that fp() is safe on an empty set
+  words_ = vector<boost::uint64_t>( std::max( size_t( 1 ) , molecules.size() * num_words_ ) , 0 );
+  num_on_bits_ = vector<int>( molecules.size() , 0 );
+  has_fp_ = vector<char>( molecules.size() , 0 );
+
+  IntVect on_bits;
+  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
+    pRD_FP fp = molecules[i]->get_fingerprint();
+    if( !fp ) {
+      continue;
+    }
+    has_fp_[i] = 1;
+    fp->getOnBits( on_bits );
+    boost::uint64_t *this_fp = &words_[0] + i * num_words_;
+    for( int j = 0 , js = on_bits.size() ; j < js ; ++j ) {
+      this_fp[on_bits[j] / 64] |= boost::uint64_t( 1 ) << ( on_bits[j] % 64 );
+    }
+    num_on_bits_[i] = on_bits.size();
+  }
+
+}
+
+// ****************************************************************************
+void PackedFingerprints::write( ostream &os ) const {
+
+  os << num_fps() << " " << num_bits_ << endl;
+  ios_base::fmtflags old_flags = os.flags();
+  os << hex;
+  for( int i = 0 , is = num_fps() ; i < is ; ++i ) {
+    if( !has_fp_[i] ) {
+      os << "-" << endl;
+      continue;
+    }
+    const boost::uint64_t *this_fp = fp( i );
+    for( int j = 0 ; j < num_words_ ; ++j ) {
+      os << ( j ? " " : "" ) << static_cast<unsigned long long>( this_fp[j] );
+    }
+    os << endl;
+  }
+  os.flags( old_flags );
+
+}
+
+// ****************************************************************************
+bool PackedFingerprints::read( istream &is ) {
+
+  int num_fps;
+  is >> num_fps >> num_bits_;
+  if( is.fail() || num_fps < 0 || num_bits_ < 0 ) {
+    return false;
+  }
+  num_words_ = ( num_bits_ + 63 ) / 64;
+  words_ = vector<boost::uint64_t>( std::max( 1 , num_fps * num_words_ ) , 0 );
+  num_on_bits_ = vector<int>( num_fps , 0 );
+  has_fp_ = vector<char>( num_fps , 0 );
+
+  for( int i = 0 ; i < num_fps ; ++i ) {
+    string first;
+    is >> first;
+    if( is.fail() ) {
+      return false;
+    }
+    if( "-" == first ) {
+      continue;
+    }
+    has_fp_[i] = 1;
+    boost::uint64_t *this_fp = &words_[0] + i * num_words_;
+    for( int j = 0 ; j < num_words_ ; ++j ) {
+      unsigned long long w = 0;
+      if( j ) {
+        is >> hex >> w >> dec;
+      } else {
+        w = strtoull( first.c_str() , 0 , 16 );
+      }
+      if( is.fail() ) {
+        return false;
+      }
+      this_fp[j] = w;
+      num_on_bits_[i] += popcount64( w );
+    }
+  }
+
+  return true;
+
+}
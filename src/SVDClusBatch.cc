@@ -0,0 +1,295 @@
+//
+// file SVDClusBatch.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// The command-line jobs for --batch, done without building any windows so
+// that they'll run on a machine with no display, in a pipeline for example.
+// The molecules and fingerprints are read or made as they are for the GUI,
+// the clusters from each clustering asked for go to standard output, and the
+// assignments to an SVD model go to the assignments file, or standard output
+// if there isn't one.
+
+#include "DenseMatrix.H"
+#include "MoleculeRec.H"
+#include "SVDClusRDKitDefs.H"
+#include "SVDClusSettings.H"
+#include "SVDCluster.H"
+#include "SVDModel.H"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+// in eponymous file
+void DoSVDCluster( const vector<pMolRec> &molecules ,
+                   float tversky_alpha , float tversky_beta ,
+                   float gamma , int num_clusters ,
+                   double clus_thresh , double sim_thresh ,
+                   bool overlapping_clusters , int num_landmarks , int coarsest_size ,
+                   bool float_matrix , bool float_accuracy_report ,
+                   double sil_sample_tol , unsigned int random_seed ,
+                   pGetRDKitSims &sim_matrix ,
+                   vector<pSVDCluster> &u_clusters , float &u_sil_score ,
+                   vector<pSVDCluster> &v_clusters , float &v_sil_score ,
+                   pSVDModel &svd_model );
+// in eponymous file
+void DoKMeansCluster( const vector<pMolRec> &molecules ,
+                      int num_clusters , int num_iters , KMEANS_SEEDING seeding ,
+                      unsigned int random_seed , double change_tol ,
+                      int max_bits , bool exact_sil , double sil_sample_tol ,
+                      DenseMatrix &warm_centroids ,
+                      vector<pSVDCluster> &clusters , float &sil_score );
+// in eponymous file
+void DoMiniBatchKMeansCluster( const vector<pMolRec> &molecules ,
+                               int num_clusters , int num_iters , int batch_size ,
+                               KMEANS_SEEDING seeding , unsigned int random_seed ,
+                               int max_bits ,
+                               vector<pSVDCluster> &clusters , float &sil_score );
+// in DoMiniBatchKMeansCluster.cc
+void warn_mini_batch_ignored( bool warm_sweep , bool exact_sil , double change_tol ,
+                              double sil_sample_tol );
+// in DoKMeansCluster.cc
+void warn_sil_sample_tol_ignored( bool exact_sil , double sil_sample_tol );
+// in eponymous file
+void DoFuzzyKMeansCluster( const vector<pMolRec> &molecules ,
+                           int num_clusters , int num_iters , double clus_thresh ,
+                           float m , unsigned int random_seed , int max_bits ,
+                           int top_r , double sil_sample_tol ,
+                           vector<pSVDCluster> &clusters , float &sil_score );
+// in eponymous file
+void DoKMedoidsCluster( const vector<pMolRec> &molecules ,
+                        int num_clusters , double tversky_alpha , double tversky_beta ,
+                        int sample_size , int num_samples , unsigned int random_seed ,
+                        vector<pSVDCluster> &clusters , float &sil_score );
+// in file ClusterWindow.cc
+void write_clusters( ostream &os , const vector<pSVDCluster> &clusters );
+
+// ****************************************************************************
+// the same labels as SVDClusRDKit::fingerprint_label, which go into SVD models
+string batch_fingerprint_label( FP_TYPE fp_type ) {
+
+  switch( fp_type ) {
+  case CIRCULAR_FPS : return string( "Circular" );
+  case LINEAR_FPS : return string( "Linear" );
+  case USER_FPS : return string( "User" );
+  default : return string( "Unknown" );
+  }
+
+}
+
+// ****************************************************************************
+void write_batch_clusters( const string &label , const vector<pSVDCluster> &clusters ,
+                           float sil_score ) {
+
+  cout << label << " : " << clusters.size() << " clusters, silhouette score = "
+       << sil_score << endl;
+  write_clusters( cout , clusters );
+
+}
+
+// ****************************************************************************
+// last_svd_model is the model from the last number of clusters, for saving
+void batch_svd_clustering( const SVDClusSettings &settings ,
+                           const vector<pMolRec> &molecules , const string &fp_label ,
+                           pSVDModel &last_svd_model ) {
+
+  pGetRDKitSims sim_matrix;
+  for( int dims = settings.start_num_clus() ; dims <= settings.stop_num_clus() ;
+       dims += settings.clus_num_step() ) {
+    vector<pSVDCluster> u_clusters , v_clusters;
+    float u_sil_score , v_sil_score;
+    pSVDModel svd_model;
+    DoSVDCluster( molecules , settings.tversky_alpha() , settings.tversky_beta() ,
+                  settings.gamma() , dims , settings.clus_thresh() , settings.sim_thresh() ,
+                  true , settings.nystrom_landmarks() , settings.multilevel_coarsest_size() ,
+                  settings.float_matrix() , settings.float_accuracy_report() ,
+                  settings.sil_sample_tol() , settings.random_seed() , sim_matrix ,
+                  u_clusters , u_sil_score , v_clusters , v_sil_score , svd_model );
+    write_batch_clusters( "SVD U Clusters" , u_clusters , u_sil_score );
+    if( settings.tversky_alpha() != settings.tversky_beta() ) {
+      write_batch_clusters( "SVD V Clusters" , v_clusters , v_sil_score );
+    }
+    if( svd_model ) {
+      svd_model->set_fp_label( fp_label );
+      last_svd_model = svd_model;
+    }
+  }
+
+}
+
+// ****************************************************************************
+// returns false if something went wrong, having said what
+bool batch_assign_to_svd_model( const SVDClusSettings &settings ,
+                                const vector<pMolRec> &molecules , const string &fp_label ) {
+
+  SVDModel svd_model;
+  if( !svd_model.read( settings.svd_model_file() ) ) {
+    cerr << "Error - couldn't read SVD model from " << settings.svd_model_file() << endl;
+    return false;
+  }
+  if( svd_model.fp_label() != fp_label ) {
+    cerr << "Warning - SVD model was built with " << svd_model.fp_label()
+         << " fingerprints, these are " << fp_label << "." << endl;
+  }
+
+  vector<vector<double> > conts;
+  if( !svd_model.project_molecules( molecules , conts ) ) {
+    cerr << "Error - fingerprints aren't the same length as the SVD model's "
+         << svd_model.num_bits() << " bits." << endl;
+    return false;
+  }
+
+  if( settings.assignments_file().empty() ) {
+    svd_model.write_assignments( cout , molecules , conts );
+    return true;
+  }
+  ofstream ofs( settings.assignments_file().c_str() );
+  if( !ofs.good() ) {
+    cerr << "Error - couldn't open " << settings.assignments_file() << " for writing." << endl;
+    return false;
+  }
+  svd_model.write_assignments( ofs , molecules , conts );
+  return true;
+
+}
+
+// ****************************************************************************
+void batch_k_means_clustering( const SVDClusSettings &settings ,
+                               const vector<pMolRec> &molecules ) {
+
+  DenseMatrix warm_centroids;
+  if( settings.k_means_batch_size() > 0 ) {
+    warn_mini_batch_ignored( settings.k_means_warm_sweep() , settings.k_means_exact_sil() ,
+                             settings.k_means_change_tol() , settings.sil_sample_tol() );
+  } else {
+    warn_sil_sample_tol_ignored( settings.k_means_exact_sil() , settings.sil_sample_tol() );
+  }
+  for( int num_clus = settings.start_num_clus() ; num_clus <= settings.stop_num_clus() ;
+       num_clus += settings.clus_num_step() ) {
+    vector<pSVDCluster> clusters;
+    float sil_score;
+    if( !settings.k_means_warm_sweep() ) {
+      warm_centroids.clear();
+    }
+    if( settings.k_means_batch_size() > 0 ) {
+      DoMiniBatchKMeansCluster( molecules , num_clus , settings.k_means_iters() ,
+                                settings.k_means_batch_size() , settings.k_means_seeding() ,
+                                settings.random_seed() , settings.dense_max_bits() ,
+                                clusters , sil_score );
+      write_batch_clusters( "Mini-Batch K-Means" , clusters , sil_score );
+    } else {
+      DoKMeansCluster( molecules , num_clus , settings.k_means_iters() ,
+                       settings.k_means_seeding() , settings.random_seed() ,
+                       settings.k_means_change_tol() , settings.dense_max_bits() ,
+                       settings.k_means_exact_sil() , settings.sil_sample_tol() ,
+                       warm_centroids , clusters , sil_score );
+      write_batch_clusters( "K-Means" , clusters , sil_score );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// The clusterings are done in the same order as SVDClusRDKit::parse_args does
+// them. Returns the program's exit status, 1 if anything went wrong.
+int run_batch( const SVDClusSettings &settings ) {
+
+  vector<pMolRec> molecules;
+  if( !settings.smi_file().empty() ) {
+    read_smiles_molecules( settings.smi_file() , 0 , molecules );
+  }
+
+  FP_TYPE fp_type = NO_FPS;
+  if( !settings.fps_file().empty() ) {
+    read_user_fingerprints( settings.fps_file() , molecules );
+    fp_type = USER_FPS;
+  }
+  if( settings.circular_fps() ) {
+    make_circular_fingerprints( molecules , false );
+    fp_type = CIRCULAR_FPS;
+  }
+  if( settings.linear_fps() ) {
+    make_linear_fingerprints( molecules , false );
+    fp_type = LINEAR_FPS;
+  }
+  string fp_label = batch_fingerprint_label( fp_type );
+
+  int num_fps = 0;
+  BOOST_FOREACH( pMolRec mol , molecules ) {
+    if( mol->get_fingerprint() ) {
+      ++num_fps;
+    }
+  }
+  if( !num_fps ) {
+    cerr << "Error - no fingerprints, so nothing to do." << endl;
+    return 1;
+  }
+
+  if( settings.start_num_clus() < 0
+      && ( settings.do_svd_clus() || settings.do_k_means_clus()
+           || settings.do_fuzzy_k_means_clus() || settings.do_k_medoids_clus() ) ) {
+    cerr << "Error - number of clusters not specified." << endl;
+    return 1;
+  }
+
+  bool ok = true;
+  pSVDModel last_svd_model;
+  if( settings.do_svd_clus() ) {
+    batch_svd_clustering( settings , molecules , fp_label , last_svd_model );
+  }
+  if( !settings.save_svd_model_file().empty() ) {
+    if( !last_svd_model ) {
+      cerr << "Error - no SVD clustering done, so no model to save." << endl;
+      ok = false;
+    } else if( !last_svd_model->write( settings.save_svd_model_file() ) ) {
+      cerr << "Error - couldn't write SVD model to " << settings.save_svd_model_file() << endl;
+      ok = false;
+    }
+  }
+  if( !settings.svd_model_file().empty() ) {
+    ok = batch_assign_to_svd_model( settings , molecules , fp_label ) && ok;
+  }
+  if( settings.do_k_means_clus() ) {
+    batch_k_means_clustering( settings , molecules );
+  }
+  if( settings.do_fuzzy_k_means_clus() ) {
+    for( int num_clus = settings.start_num_clus() ; num_clus <= settings.stop_num_clus() ;
+         num_clus += settings.clus_num_step() ) {
+      vector<pSVDCluster> clusters;
+      float sil_score;
+      DoFuzzyKMeansCluster( molecules , num_clus , settings.fuzzy_k_means_iters() , 1.0e-6 ,
+                            settings.fuzzy_k_means_m() ,
+                            settings.random_seed() , settings.dense_max_bits() ,
+                            settings.fuzzy_k_means_top_r() , settings.sil_sample_tol() ,
+                            clusters , sil_score );
+      write_batch_clusters( "Fuzzy K-Means" , clusters , sil_score );
+    }
+  }
+  if( settings.do_k_medoids_clus() ) {
+    for( int num_clus = settings.start_num_clus() ; num_clus <= settings.stop_num_clus() ;
+         num_clus += settings.clus_num_step() ) {
+      vector<pSVDCluster> clusters;
+      float sil_score;
+      DoKMedoidsCluster( molecules , num_clus , settings.tversky_alpha() ,
+                         settings.tversky_beta() , settings.k_medoids_sample_size() ,
+                         settings.k_medoids_samples() , settings.random_seed() ,
+                         clusters , sil_score );
+      write_batch_clusters( "K-Medoids" , clusters , sil_score );
+    }
+  }
+
+  return ok ? 0 : 1;
+
+}
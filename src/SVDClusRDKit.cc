@@ -20,8 +20,10 @@
 #include "ClustersTableModel.H"
 #include "ClustersTableView.H"
 #include "ClusterWindow.H"
+#include "DenseMatrix.H"
 #include "FuzzyKMeansClustersDialog.H"
 #include "KMeansClustersDialog.H"
+#include "KMedoidsClustersDialog.H"
 #include "MoleculeRec.H"
 #include "MoleculeTableModel.H"
 #include "MoleculeTableView.H"
@@ -32,6 +34,7 @@
 #include "SVDClusterMember.H"
 #include "SVDClustersDialog.H"
 #include "SVDClusRDKit.H"
+#include "SVDModel.H"
 #include "QTHelpViewer.H"
 
 #include <fstream>
@@ -46,9 +49,6 @@
 #include <boost/lexical_cast.hpp>
 
 #include <GraphMol/RDKitBase.h>
-#include <GraphMol/Fingerprints/MorganFingerprints.h>
-#include <GraphMol/Fingerprints/Fingerprints.h>
-#include <GraphMol/SmilesParse/SmilesParse.h>
 
 #include <QAction>
 #include <QApplication>
@@ -73,24 +73,50 @@ void DoSVDCluster( const vector<pMolRec> &molecules ,
                    float tversky_alpha , float tversky_beta ,
                    float gamma , int num_clusters ,
                    double clus_thresh , double sim_thresh ,
-                   bool overlapping_clusters ,
+                   bool overlapping_clusters , int num_landmarks , int coarsest_size ,
+                   bool float_matrix , bool float_accuracy_report ,
+                   double sil_sample_tol , unsigned int random_seed ,
+                   pGetRDKitSims &sim_matrix ,
                    vector<pSVDCluster> &u_clusters , float &u_sil_score ,
-                   vector<pSVDCluster> &v_clusters , float &v_sil_score );
+                   vector<pSVDCluster> &v_clusters , float &v_sil_score ,
+                   pSVDModel &svd_model );
 
 // in eponymous file
 void DoKMeansCluster( const vector<pMolRec> &molecules ,
-                      int num_clusters , int num_iters ,
+                      int num_clusters , int num_iters , KMEANS_SEEDING seeding ,
+                      unsigned int random_seed , double change_tol ,
+                      int max_bits , bool exact_sil , double sil_sample_tol ,
+                      DenseMatrix &warm_centroids ,
                       vector<pSVDCluster> &clusters , float &sil_score );
 void DoKMeansCluster2( const vector<pMolRec> &molecules ,
                        int num_clusters , int num_iters ,
                        vector<pSVDCluster> &clusters , float &sil_score );
 
+// in eponymous file
+void DoMiniBatchKMeansCluster( const vector<pMolRec> &molecules ,
+                               int num_clusters , int num_iters , int batch_size ,
+                               KMEANS_SEEDING seeding , unsigned int random_seed ,
+                               int max_bits ,
+                               vector<pSVDCluster> &clusters , float &sil_score );
+// in DoMiniBatchKMeansCluster.cc
+void warn_mini_batch_ignored( bool warm_sweep , bool exact_sil , double change_tol ,
+                              double sil_sample_tol );
+// in DoKMeansCluster.cc
+void warn_sil_sample_tol_ignored( bool exact_sil , double sil_sample_tol );
+
 // in eponymous file
 void DoFuzzyKMeansCluster( const vector<pMolRec> &molecules ,
                            int num_clusters , int num_iters , double clus_thresh ,
-                           float m ,
+                           float m , unsigned int random_seed , int max_bits ,
+                           int top_r , double sil_sample_tol ,
                            vector<pSVDCluster> &clusters , float &sil_score );
 
+// in eponymous file
+void DoKMedoidsCluster( const vector<pMolRec> &molecules ,
+                        int num_clusters , double tversky_alpha , double tversky_beta ,
+                        int sample_size , int num_samples , unsigned int random_seed ,
+                        vector<pSVDCluster> &clusters , float &sil_score );
+
 // in file ClusterWindow.cc
 void write_clusters( ostream &os , const vector<pSVDCluster> &clusters );
 
@@ -101,7 +127,7 @@ namespace RDKit {
 // *************************************************************************
 SVDClusRDKit::SVDClusRDKit( int argc , char **argv ) :
   svd_clusters_dialog_( 0 ) , kmeans_clusters_dialog_( 0 ) ,
-  fuzzy_kmeans_clusters_dialog_( 0 ) , last_dir_( QString( "." ) ) ,
+  fuzzy_kmeans_clusters_dialog_( 0 ) , kmedoids_clusters_dialog_( 0 ) , last_dir_( QString( "." ) ) ,
   fp_type_( NO_FPS ) {
 
   build_widget();
@@ -188,6 +214,11 @@ void SVDClusRDKit::build_actions() {
   connect( file_read_smiles_ , SIGNAL( triggered() ) , this , SLOT( slot_read_smiles() ) );
   file_read_data_ = new QAction( "Read Data" , this );
   connect( file_read_data_ , SIGNAL( triggered() ) , this , SLOT( slot_read_data_file() ) );
+  file_save_svd_model_ = new QAction( "Save SVD Model" , this );
+  connect( file_save_svd_model_ , SIGNAL( triggered() ) , this , SLOT( slot_save_svd_model() ) );
+  file_assign_to_svd_model_ = new QAction( "Assign To SVD Model" , this );
+  connect( file_assign_to_svd_model_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_assign_to_svd_model() ) );
 
   file_quit_ = new QAction( "Quit" , this );
   file_quit_->setShortcut( QString( "Ctrl+Q"  ) );
@@ -205,6 +236,10 @@ void SVDClusRDKit::build_actions() {
   connect( build_fuzzy_k_means_clusters_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_build_fuzzy_k_means_clusters() ) );
 
+  build_k_medoids_clusters_ = new QAction( "Build K-Medoids" , this );
+  connect( build_k_medoids_clusters_ , SIGNAL( triggered() ) ,
+           this , SLOT( slot_build_k_medoids_clusters() ) );
+
   circular_fps_ = new QAction( "Circular (ECFP-like)" , this );
   connect( circular_fps_ , SIGNAL( triggered() ) ,
            this , SLOT( slot_circular_fps() ) );
@@ -232,6 +267,9 @@ void SVDClusRDKit::build_menubar() {
   menu->addAction( file_read_smiles_ );
   menu->addAction( file_read_data_ );
   menu->addSeparator();
+  menu->addAction( file_save_svd_model_ );
+  menu->addAction( file_assign_to_svd_model_ );
+  menu->addSeparator();
   menu->addAction( file_quit_ );
 
   menu = menuBar()->addMenu( "Fingerprints" );
@@ -243,6 +281,7 @@ void SVDClusRDKit::build_menubar() {
   menu->addAction( build_svd_clusters_ );
   menu->addAction( build_k_means_clusters_ );
   menu->addAction( build_fuzzy_k_means_clusters_ );
+  menu->addAction( build_k_medoids_clusters_ );
 
   build_windows_menu();
 
@@ -293,14 +332,14 @@ void SVDClusRDKit::parse_args( int argc , char **argv ) {
     if( mol_table_->count_fingerprints() ) {
       cerr << "Warning - already have fingerprints. Previous ones will be over-written." << endl;
     }
-    build_circular_fingerprints();
+    build_circular_fingerprints( false );
   }
 
   if( settings_->linear_fps() ) {
     if( mol_table_->count_fingerprints() ) {
       cerr << "Warning - already have fingerprints. Previous ones will be over-written." << endl;
     }
-    build_linear_fingerprints();
+    build_linear_fingerprints( false );
   }
 
   vector<string> data_files = settings_->data_files();
@@ -317,7 +356,32 @@ void SVDClusRDKit::parse_args( int argc , char **argv ) {
       do_svd_clustering( settings_->tversky_alpha() , settings_->tversky_beta() ,
                          settings_->start_num_clus() , settings_->stop_num_clus() , settings_->clus_num_step() ,
                          settings_->gamma() , settings_->sim_thresh() ,
-                         settings_->clus_thresh() , true );
+                         settings_->clus_thresh() , true , settings_->nystrom_landmarks() ,
+                         settings_->multilevel_coarsest_size() , settings_->float_matrix() ,
+                         settings_->float_accuracy_report() , settings_->sil_sample_tol() );
+    }
+  }
+
+  if( !settings_->save_svd_model_file().empty() ) {
+    if( !last_svd_model_ ) {
+      cerr << "Error - no SVD clustering done, so no model to save." << endl;
+    } else if( !last_svd_model_->write( settings_->save_svd_model_file() ) ) {
+      cerr << "Error - couldn't write SVD model to " << settings_->save_svd_model_file() << endl;
+    }
+  }
+
+  if( !settings_->svd_model_file().empty() ) {
+    pSVDModel svd_model( new SVDModel );
+    if( !svd_model->read( settings_->svd_model_file() ) ) {
+      cerr << "Error - couldn't read SVD model from " << settings_->svd_model_file() << endl;
+    } else if( !mol_table_->count_fingerprints() ) {
+      cerr << "Error - can't assign molecules to SVD model, no fingerprints." << endl;
+    } else {
+      if( !assign_to_svd_model( svd_model , settings_->svd_model_file().c_str() ,
+                                settings_->assignments_file() ) ) {
+        cerr << "Error - fingerprints aren't the same length as the SVD model's "
+             << svd_model->num_bits() << " bits." << endl;
+      }
     }
   }
 
@@ -326,7 +390,10 @@ void SVDClusRDKit::parse_args( int argc , char **argv ) {
       cerr << "Error - can't do K-Means clustering, no fingerprints." << endl;
     } else {
       do_k_means_clustering( settings_->start_num_clus() , settings_->stop_num_clus() ,
-                             settings_->clus_num_step() , 10 );
+                             settings_->clus_num_step() , settings_->k_means_iters() ,
+                             settings_->k_means_seeding() , settings_->k_means_batch_size() ,
+                             settings_->random_seed() , settings_->k_means_warm_sweep() ,
+                             settings_->k_means_exact_sil() , settings_->sil_sample_tol() );
     }
   }
 
@@ -335,7 +402,21 @@ void SVDClusRDKit::parse_args( int argc , char **argv ) {
       cerr << "Error - can't do Fuzzy K-Means clustering, no fingerprints." << endl;
     } else {
       do_fuzzy_k_means_clustering( settings_->start_num_clus() , settings_->stop_num_clus() ,
-                                   settings_->clus_num_step() , 2 , settings_->fuzzy_k_means_m() );
+                                   settings_->clus_num_step() , settings_->fuzzy_k_means_iters() ,
+                                   settings_->fuzzy_k_means_m() ,
+                                   settings_->random_seed() , settings_->fuzzy_k_means_top_r() ,
+                                   settings_->sil_sample_tol() );
+    }
+  }
+
+  if( settings_->do_k_medoids_clus() ) {
+    if( !mol_table_->count_fingerprints() ) {
+      cerr << "Error - can't do K-Medoids clustering, no fingerprints." << endl;
+    } else {
+      do_k_medoids_clustering( settings_->start_num_clus() , settings_->stop_num_clus() ,
+                               settings_->clus_num_step() , settings_->tversky_alpha() ,
+                               settings_->tversky_beta() , settings_->k_medoids_sample_size() ,
+                               settings_->k_medoids_samples() , settings_->random_seed() );
     }
   }
 
@@ -344,26 +425,15 @@ void SVDClusRDKit::parse_args( int argc , char **argv ) {
 // *************************************************************************
 void SVDClusRDKit::read_smiles_file( const string &smi_file ) {
 
-  ifstream ifs( smi_file.c_str() );
-
   vector<pMolRec> new_mols;
-  while( 1 ) {
-    string next_line , smi , name;
-    getline( ifs , next_line );
-    if( ifs.eof() || !ifs.good() ) {
-      break;
-    }
-
-    istringstream iss( next_line );
-    iss >> smi;
-    iss >> name;
-    if( iss.fail() ) {
-      name = string( "Str" ) + boost::lexical_cast<string>( mol_table_->rowCount() + 1 );
-    }
-    new_mols.push_back( pMolRec( new MoleculeRec( smi , name ) ) );
-  }
+  read_smiles_molecules( smi_file , mol_table_->rowCount() , new_mols );
 
   mol_table_->add_molecules( new_mols );
+  // molecules appended to ones that already have fingerprints need the same
+  // sort. User fingerprints have to be read again by hand.
+  if( !new_mols.empty() && ( CIRCULAR_FPS == fp_type_ || LINEAR_FPS == fp_type_ ) ) {
+    build_fingerprints( true );
+  }
   mol_table_view_->resizeColumnsToContents();
   mol_table_view_->resizeRowsToContents();
   mdi_area_->tileSubWindows();
@@ -456,7 +526,10 @@ void SVDClusRDKit::read_data_file( const string &data_file ) {
 void SVDClusRDKit::do_svd_clustering( double tv_alpha , double tv_beta , int start_num_clus ,
                                       int stop_num_clus , int num_clus_step ,
                                       double gamma , double sim_thresh ,
-                                      double clus_thresh , bool overlapping_clusters ) {
+                                      double clus_thresh , bool overlapping_clusters ,
+                                      int num_landmarks , int coarsest_size ,
+                                      bool float_matrix , bool float_accuracy_report ,
+                                      double sil_sample_tol ) {
 
   if( start_num_clus < 0 || stop_num_clus < 0 ) {
     QMessageBox::warning( this , "Bad cluster number" , "Number of clusters not specified." );
@@ -470,19 +543,33 @@ void SVDClusRDKit::do_svd_clustering( double tv_alpha , double tv_beta , int sta
 
     std::vector<pSVDCluster> u_clusters , v_clusters;
     float u_sil_score , v_sil_score;
+    pSVDModel svd_model;
 
     chrono2.start();
     DoSVDCluster( mol_table_->molecules() , tv_alpha , tv_beta , gamma , dims ,
-                  clus_thresh , sim_thresh , overlapping_clusters ,
-                  u_clusters , u_sil_score , v_clusters , v_sil_score );
+                  clus_thresh , sim_thresh , overlapping_clusters , num_landmarks ,
+                  coarsest_size , float_matrix , float_accuracy_report ,
+                  sil_sample_tol , settings_->random_seed() , sim_matrix_ , u_clusters , u_sil_score , v_clusters , v_sil_score , svd_model );
     chrono2.stop();
 
+    if( svd_model ) {
+      svd_model->set_fp_label( fingerprint_label().toStdString() );
+      last_svd_model_ = svd_model;
+    }
+
 #ifdef NOTYET
     write_clusters( cout , u_clusters );
 #endif
 
     QString label = QString( "U Clusters : Num. Clusters = %1, FPs = %8, Alpha = %2 , Beta = %3 , Gamma = %4 , Clus. Thresh = %5 , Sim. Thresh = %6 , Overlapping = %7" )
         .arg( dims ).arg( tv_alpha ).arg( tv_beta ).arg( gamma ).arg( clus_thresh ).arg( sim_thresh ).arg( overlapping_clusters ).arg( fingerprint_label() );
+    if( num_landmarks > 0 ) {
+      label += QString( " , Nystrom Landmarks = %1" ).arg( num_landmarks );
+    } else if( coarsest_size > 0 ) {
+      label += QString( " , Multilevel Coarsest Size = %1" ).arg( coarsest_size );
+    } else if( float_matrix ) {
+      label += QString( " , Single Precision" );
+    }
 
     ClusterWindow *new_win = new ClusterWindow( u_clusters , overlapping_clusters , mol_draw_del_ , label );
     new_win->connect_selection( this );
@@ -495,6 +582,13 @@ void SVDClusRDKit::do_svd_clustering( double tv_alpha , double tv_beta , int sta
       // the v clusters will be different, so show those, too
       QString label = QString( "V Clusters : Num. Clusters = %1, FPs = %8, Alpha = %2 , Beta = %3 , Gamma = %4 , Clus. Thresh = %5 , Sim. Thresh = %6 , Overlapping = %7" )
           .arg( dims ).arg( tv_alpha ).arg( tv_beta ).arg( gamma ).arg( clus_thresh ).arg( clus_thresh ).arg( overlapping_clusters ).arg( fingerprint_label() );
+      if( num_landmarks > 0 ) {
+        label += QString( " , Nystrom Landmarks = %1" ).arg( num_landmarks );
+      } else if( coarsest_size > 0 ) {
+        label += QString( " , Multilevel Coarsest Size = %1" ).arg( coarsest_size );
+      } else if( float_matrix ) {
+        label += QString( " , Single Precision" );
+      }
       ClusterWindow *new_win = new ClusterWindow( v_clusters , overlapping_clusters , mol_draw_del_ , label );
       new_win->connect_selection( this );
       mdi_area_->addSubWindow( new_win );
@@ -514,7 +608,10 @@ void SVDClusRDKit::do_svd_clustering( double tv_alpha , double tv_beta , int sta
 
 // *************************************************************************
 void SVDClusRDKit::do_k_means_clustering( int start_num_clus , int stop_num_clus ,
-                                          int clus_num_step , int num_iters ) {
+                                          int clus_num_step , int num_iters ,
+                                          KMEANS_SEEDING seeding , int batch_size ,
+                                          unsigned int random_seed , bool warm_sweep ,
+                                          bool exact_sil , double sil_sample_tol ) {
 
   if( start_num_clus < 0 || stop_num_clus < 0 ) {
     QMessageBox::warning( this , "Bad cluster number" , "Number of clusters not specified." );
@@ -523,20 +620,42 @@ void SVDClusRDKit::do_k_means_clustering( int start_num_clus , int stop_num_clus
 
   QApplication::setOverrideCursor( Qt::WaitCursor );
 
+  // the centroids of the last clustering, for a warm-started sweep
+  DenseMatrix warm_centroids;
+  if( batch_size > 0 ) {
+    warn_mini_batch_ignored( warm_sweep , exact_sil , settings_->k_means_change_tol() ,
+                             sil_sample_tol );
+  } else {
+    warn_sil_sample_tol_ignored( exact_sil , sil_sample_tol );
+  }
+
   for( int num_clus = start_num_clus ; num_clus <= stop_num_clus ; num_clus += clus_num_step ) {
 
     cout << "clusters : " << num_clus << " of " << start_num_clus << " to " << stop_num_clus << endl;
     vector<pSVDCluster> clusters;
     float sil_score;
+    if( !warm_sweep ) {
+      warm_centroids.clear();
+    }
 
     Chronograph chrono1;
     chrono1.start();
-    DoKMeansCluster( mol_table_->molecules() , num_clus , num_iters , clusters , sil_score );
+    if( batch_size > 0 ) {
+      DoMiniBatchKMeansCluster( mol_table_->molecules() , num_clus , num_iters , batch_size ,
+                                seeding , random_seed , settings_->dense_max_bits() ,
+                                clusters , sil_score );
+    } else {
+      DoKMeansCluster( mol_table_->molecules() , num_clus , num_iters , seeding ,
+                       random_seed , settings_->k_means_change_tol() ,
+                       settings_->dense_max_bits() , exact_sil ,
+                       sil_sample_tol , warm_centroids ,
+                       clusters , sil_score );
+    }
     chrono1.stop();
 
     QString fp_lab = fingerprint_label();
-    QString label( QString( "K-Means Clustering. FPs = %2, Num. clusters = %1." ).arg( clusters.size() )
-                   .arg( fingerprint_label() ) );
+    QString label( QString( "%3K-Means Clustering. FPs = %2, Num. clusters = %1." ).arg( clusters.size() )
+                   .arg( fingerprint_label() ).arg( batch_size > 0 ? "Mini-Batch " : "" ) );
     ClusterWindow *new_win = new ClusterWindow( clusters , false , mol_draw_del_ , label );
     new_win->connect_selection( this );
     mdi_area_->addSubWindow( new_win );
@@ -554,7 +673,8 @@ void SVDClusRDKit::do_k_means_clustering( int start_num_clus , int stop_num_clus
 // *************************************************************************
 void SVDClusRDKit::do_fuzzy_k_means_clustering( int start_num_clus , int stop_num_clus ,
                                                 int clus_num_step , int num_iters ,
-                                                float m ) {
+                                                float m , unsigned int random_seed ,
+                                                int top_r , double sil_sample_tol ) {
 
   if( start_num_clus < 0 || stop_num_clus < 0 ) {
     QMessageBox::warning( this , "Bad cluster number" , "Number of clusters not specified." );
@@ -571,7 +691,8 @@ void SVDClusRDKit::do_fuzzy_k_means_clustering( int start_num_clus , int stop_nu
     Chronograph chrono1;
     chrono1.start();
     DoFuzzyKMeansCluster( mol_table_->molecules() , num_clus , num_iters , 1.0e-6 ,
-                          m , clusters , sil_score );
+                          m , random_seed , settings_->dense_max_bits() , top_r ,
+                          sil_sample_tol , clusters , sil_score );
     chrono1.stop();
 
     QString fp_lab = fingerprint_label();
@@ -591,6 +712,102 @@ void SVDClusRDKit::do_fuzzy_k_means_clustering( int start_num_clus , int stop_nu
 
 }
 
+// *************************************************************************
+void SVDClusRDKit::do_k_medoids_clustering( int start_num_clus , int stop_num_clus ,
+                                            int clus_num_step , double tv_alpha ,
+                                            double tv_beta , int sample_size ,
+                                            int num_samples , unsigned int random_seed ) {
+
+  if( start_num_clus < 0 || stop_num_clus < 0 ) {
+    QMessageBox::warning( this , "Bad cluster number" , "Number of clusters not specified." );
+    return;
+  }
+
+  QApplication::setOverrideCursor( Qt::WaitCursor );
+
+  for( int num_clus = start_num_clus ; num_clus <= stop_num_clus ; num_clus += clus_num_step ) {
+
+    vector<pSVDCluster> clusters;
+    float sil_score;
+
+    Chronograph chrono1;
+    chrono1.start();
+    DoKMedoidsCluster( mol_table_->molecules() , num_clus , tv_alpha , tv_beta ,
+                       sample_size , num_samples , random_seed , clusters , sil_score );
+    chrono1.stop();
+
+    QString label( QString( "K-Medoids Clustering. FPs = %2, Num. clusters = %1." ).arg( clusters.size() )
+                   .arg( fingerprint_label() ) );
+    ClusterWindow *new_win = new ClusterWindow( clusters , false , mol_draw_del_ , label );
+    new_win->connect_selection( this );
+    mdi_area_->addSubWindow( new_win );
+    new_win->show();
+    mdi_area_->tileSubWindows();
+
+    report_clus_statistics( new_win , clusters , sil_score , false , chrono1 );
+
+  }
+
+  QApplication::restoreOverrideCursor();
+
+}
+
+// *************************************************************************
+// assignments_file of "-" means standard output
+bool SVDClusRDKit::assign_to_svd_model( const pSVDModel &svd_model , const QString &model_name ,
+                                        const string &assignments_file ) {
+
+  if( svd_model->fp_label() != fingerprint_label().toStdString() ) {
+    cerr << "Warning - SVD model was built with " << svd_model->fp_label()
+         << " fingerprints, these are " << fingerprint_label().toStdString() << "." << endl;
+  }
+
+  QApplication::setOverrideCursor( Qt::WaitCursor );
+
+  Chronograph chrono;
+  chrono.start();
+  vector<vector<double> > conts;
+  if( !svd_model->project_molecules( mol_table_->molecules() , conts ) ) {
+    QApplication::restoreOverrideCursor();
+    return false;
+  }
+  vector<pSVDCluster> clusters;
+  svd_model->build_clusters( mol_table_->molecules() , conts , clusters );
+  chrono.stop();
+
+  if( "-" == assignments_file ) {
+    svd_model->write_assignments( cout , mol_table_->molecules() , conts );
+  } else if( !assignments_file.empty() ) {
+    ofstream ofs( assignments_file.c_str() );
+    if( ofs.good() ) {
+      svd_model->write_assignments( ofs , mol_table_->molecules() , conts );
+    } else {
+      cerr << "Error - couldn't open " << assignments_file << " for writing." << endl;
+    }
+  }
+
+  QString label = QString( "Assigned to SVD Model %1 : Num. Clusters = %2, FPs = %3 , Clus. Thresh = %4" )
+      .arg( model_name ).arg( svd_model->num_clusters() ).arg( fingerprint_label() )
+      .arg( svd_model->clus_thresh() );
+  ClusterWindow *new_win = new ClusterWindow( clusters , true , mol_draw_del_ , label );
+  new_win->connect_selection( this );
+  mdi_area_->addSubWindow( new_win );
+  new_win->show();
+  mdi_area_->tileSubWindows();
+
+  // the silhouette score needs distances between the new molecules and the
+  // clusters they'd have been in originally, so isn't available.
+  QString text = QString( "Assigned %1 molecules to clusters of model of %2 molecules.\n" )
+      .arg( mol_table_->count_fingerprints() ).arg( svd_model->num_molecules() );
+  text += QString( "Time to assign = %1s.\n" ).arg( chrono.elapsed() );
+  new_win->slot_text_to_show( text );
+
+  QApplication::restoreOverrideCursor();
+
+  return true;
+
+}
+
 // *************************************************************************
 pMolRec SVDClusRDKit::get_molecule( const string &mol_name ) {
 
@@ -672,11 +889,11 @@ void SVDClusRDKit::report_clus_statistics( ClusterWindow *clus_win , const vecto
 }
 
 // *************************************************************************
-void SVDClusRDKit::build_fingerprints() {
+void SVDClusRDKit::build_fingerprints( bool missing_only ) {
 
   switch( fp_type_ ) {
-  case CIRCULAR_FPS : build_circular_fingerprints(); break;
-  case LINEAR_FPS : build_linear_fingerprints(); break;
+  case CIRCULAR_FPS : build_circular_fingerprints( missing_only ); break;
+  case LINEAR_FPS : build_linear_fingerprints( missing_only ); break;
   case USER_FPS : slot_user_fps(); break;
   case NO_FPS : break; // to stop the compiler whinging
   }
@@ -684,98 +901,32 @@ void SVDClusRDKit::build_fingerprints() {
 }
 
 // *************************************************************************
-void SVDClusRDKit::build_circular_fingerprints() {
-
-#ifdef NOTYET
-  cout << "Building circular fingerprints" << endl;
-#endif
-  BOOST_FOREACH( pMolRec mol , mol_table_->molecules() ) {
-    RDKit::ROMol *newmol = RDKit::SmilesToMol( mol->smiles() );
-    mol->set_fingerprint( pRD_FP( RDKit::MorganFingerprints::getFingerprintAsBitVect( *newmol , 3 , 2048 ) ) );
-    delete newmol;
-  }
+// if missing_only is true, the fingerprints are already circular and only
+// molecules added since they were built need them. Keeping the old ones means
+// the similarity matrix can be extended rather than re-made.
+void SVDClusRDKit::build_circular_fingerprints( bool missing_only ) {
 
+  make_circular_fingerprints( mol_table_->molecules() , missing_only );
   fp_type_ = CIRCULAR_FPS;
 
 }
 
 // *************************************************************************
-void SVDClusRDKit::build_linear_fingerprints() {
-
-#ifdef NOTYET
-  cout << "building linear fingerprints" << endl;
-#endif
-  BOOST_FOREACH( pMolRec mol , mol_table_->molecules() ) {
-    RDKit::ROMol *newmol = RDKit::SmilesToMol( mol->smiles() );
-    mol->set_fingerprint( pRD_FP( RDKit::RDKFingerprintMol( *newmol ) ) );
-    delete newmol;
-  }
+// as for circular fingerprints, only the missing ones are built if
+// missing_only is true.
+void SVDClusRDKit::build_linear_fingerprints( bool missing_only ) {
 
+  make_linear_fingerprints( mol_table_->molecules() , missing_only );
   fp_type_ = LINEAR_FPS;
 
 }
 
 // *************************************************************************
-// read a file of user-generated fingerprints, assumed to be a name followed by
-// an stream of 0 and 1, possibly with whitespace inbetween. The name can't contain
-// whitespace.
+// read a file of user-generated fingerprints, in the format described in
+// MoleculeRec.H
 void SVDClusRDKit::read_user_fingerprints( const QString &fp_file ) {
 
-#ifdef NOTYET
-  cout << "reading fingerprints from " << fp_file.toStdString() << endl;
-#endif
-  ifstream ifs( fp_file.toLocal8Bit().data() );
-  while( 1 ) {
-    string next_line;
-    getline( ifs , next_line );
-    if( ifs.eof() || !ifs.good() ) {
-      break;
-    }
-    boost::trim( next_line );
-    if( next_line.empty() ) {
-      continue;
-    }
-    string::iterator i = next_line.begin();
-    string mol_name;
-    while( !isspace( *i ) && i != next_line.end() ) {
-      mol_name += *i;
-      ++i;
-    }
-
-    // find the right molecule
-    pMolRec mol = get_molecule( mol_name );
-    if( mol ) {
-      vector<char> fp_bits;
-      for( ; i != next_line.end() ; ++i ) {
-        if( *i == '0' || *i == '1' ) {
-          fp_bits.push_back( *i );
-        } else if( isspace( *i ) ) {
-          continue;
-        } else {
-          break;
-        }
-      }
-
-#ifdef NOTYET
-      cout << mol_name << " : " << fp_bits.size() << endl;
-#endif
-      pRD_FP new_fp( new ExplicitBitVect( fp_bits.size() ) );
-      for( int i = 0 , is = fp_bits.size() ; i < is ; ++i ) {
-        if( '1' == fp_bits[i] ) {
-          new_fp->setBit( i );
-        }
-      }
-#ifdef NOTYET
-      cout << "Num on bits : " << new_fp->getNumOnBits() << " and off " << new_fp->getNumOffBits() << endl;
-      cout << "Count of input bits : " << count( fp_bits.begin() , fp_bits.end() , '1' ) << endl;
-#endif
-      mol->set_fingerprint( new_fp );
-    } else {
-      cout << "Error : molecule " << mol_name << " not found in dataset. Skipping." << endl;
-    }
-
-  }
-
+  ::read_user_fingerprints( string( fp_file.toLocal8Bit().data() ) , mol_table_->molecules() );
   fp_type_ = USER_FPS;
 
 }
@@ -891,6 +1042,62 @@ void SVDClusRDKit::slot_read_smiles() {
 
 }
 
+// *************************************************************************
+void SVDClusRDKit::slot_save_svd_model() {
+
+  if( !last_svd_model_ ) {
+    QMessageBox::warning( this , "No SVD model" , "No SVD clustering done yet, so no model to save." );
+    return;
+  }
+
+  QString model_file = QFileDialog::getSaveFileName( this , "SVD model file" , last_dir_ ,
+                                                     "SVD models (*.svdm)" );
+  if( model_file.isEmpty() ) {
+    return;
+  }
+
+  if( !last_svd_model_->write( model_file.toLocal8Bit().data() ) ) {
+    QMessageBox::warning( this , "Couldn't write file." ,
+                          QString( "Couldn't write SVD model to %1." ).arg( model_file ) );
+    return;
+  }
+
+  QFileInfo fi( model_file );
+  last_dir_ = fi.absolutePath();
+
+}
+
+// *************************************************************************
+void SVDClusRDKit::slot_assign_to_svd_model() {
+
+  if( !check_fingerprints_for_clustering() ) {
+    return;
+  }
+
+  QString model_file = QFileDialog::getOpenFileName( this , "SVD model file" , last_dir_ ,
+                                                     "SVD models (*.svdm)" );
+  if( model_file.isEmpty() ) {
+    return;
+  }
+  QFileInfo fi( model_file );
+  last_dir_ = fi.absolutePath();
+
+  pSVDModel svd_model( new SVDModel );
+  if( !svd_model->read( model_file.toLocal8Bit().data() ) ) {
+    QMessageBox::warning( this , "Couldn't read file." ,
+                          QString( "Couldn't read SVD model from %1." ).arg( model_file ) );
+    return;
+  }
+
+  QString assignments_file = QFileDialog::getSaveFileName( this , "Assignments file (Cancel for none)" ,
+                                                           last_dir_ , "Text files (*.txt)" );
+  if( !assign_to_svd_model( svd_model , fi.fileName() , assignments_file.toLocal8Bit().data() ) ) {
+    QMessageBox::warning( this , "Fingerprint mismatch" ,
+                          QString( "The fingerprints are a different length from those in SVD model %1." ).arg( model_file ) );
+  }
+
+}
+
 // *************************************************************************
 void SVDClusRDKit::slot_read_data_file() {
 
@@ -921,15 +1128,19 @@ void SVDClusRDKit::slot_build_svd_clusters() {
     return;
   }
 
-  double tv_alpha , tv_beta , gamma , sim_thresh , clus_thresh;
+  double tv_alpha , tv_beta , gamma , sim_thresh , clus_thresh , sil_sample_tol;
   int start_num_clus , stop_num_clus , num_clus_step;
-  bool overlapping_clusters;
+  int num_landmarks , coarsest_size;
+  bool overlapping_clusters , float_matrix , float_accuracy_report;
   svd_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step ,
                                       tv_alpha , tv_beta , gamma ,
-                                      sim_thresh , clus_thresh , overlapping_clusters );
+                                      sim_thresh , clus_thresh , overlapping_clusters ,
+                                      num_landmarks , coarsest_size , float_matrix ,
+                                      float_accuracy_report , sil_sample_tol );
 
   do_svd_clustering( tv_alpha , tv_beta , start_num_clus , stop_num_clus , num_clus_step ,
-                     gamma , sim_thresh , clus_thresh , overlapping_clusters );
+                     gamma , sim_thresh , clus_thresh , overlapping_clusters , num_landmarks ,
+                     coarsest_size , float_matrix , float_accuracy_report , sil_sample_tol );
 
 }
 
@@ -949,8 +1160,17 @@ void SVDClusRDKit::slot_build_k_means_clusters() {
   }
 
   int start_num_clus , stop_num_clus , num_clus_step , num_iters;
-  kmeans_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step , num_iters );
-  do_k_means_clustering( start_num_clus , stop_num_clus , num_clus_step , num_iters );
+  int batch_size;
+  unsigned int random_seed;
+  bool warm_sweep , exact_sil;
+  double sil_sample_tol;
+  KMEANS_SEEDING seeding;
+  kmeans_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step ,
+                                         num_iters , seeding , batch_size , random_seed ,
+                                         warm_sweep , exact_sil , sil_sample_tol );
+  do_k_means_clustering( start_num_clus , stop_num_clus , num_clus_step , num_iters ,
+                         seeding , batch_size , random_seed , warm_sweep , exact_sil ,
+                         sil_sample_tol );
 
 }
 
@@ -971,8 +1191,39 @@ void SVDClusRDKit::slot_build_fuzzy_k_means_clusters() {
 
   int start_num_clus , stop_num_clus , num_clus_step , num_iters;
   float m;
-  fuzzy_kmeans_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step , num_iters , m );
-  do_fuzzy_k_means_clustering( start_num_clus , stop_num_clus , num_clus_step , num_iters , m );
+  unsigned int random_seed;
+  int top_r;
+  double sil_sample_tol;
+  fuzzy_kmeans_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step , num_iters ,
+                                               m , random_seed , top_r , sil_sample_tol );
+  do_fuzzy_k_means_clustering( start_num_clus , stop_num_clus , num_clus_step , num_iters , m ,
+                               random_seed , top_r , sil_sample_tol );
+
+}
+
+// *************************************************************************
+void SVDClusRDKit::slot_build_k_medoids_clusters() {
+
+  if( !check_fingerprints_for_clustering() ) {
+    return;
+  }
+
+  if( !kmedoids_clusters_dialog_ ) {
+    kmedoids_clusters_dialog_ = new KMedoidsClustersDialog( settings_ , this );
+  }
+
+  if( QDialog::Accepted != kmedoids_clusters_dialog_->exec() ) {
+    return;
+  }
+
+  int start_num_clus , stop_num_clus , num_clus_step , sample_size , num_samples;
+  double tv_alpha , tv_beta;
+  unsigned int random_seed;
+  kmedoids_clusters_dialog_->get_settings( start_num_clus , stop_num_clus , num_clus_step ,
+                                           tv_alpha , tv_beta , sample_size , num_samples ,
+                                           random_seed );
+  do_k_medoids_clustering( start_num_clus , stop_num_clus , num_clus_step , tv_alpha , tv_beta ,
+                           sample_size , num_samples , random_seed );
 
 }
 
@@ -1017,9 +1268,10 @@ void SVDClusRDKit::slot_set_active_sub_window( QWidget *window ) {
 // ***************************************************************************
 void SVDClusRDKit::slot_circular_fps() {
 
+  // build_circular_fingerprints sets fp_type_, so that all the old ones of
+  // another type are replaced
   if( fp_type_ != CIRCULAR_FPS ) {
-    fp_type_ = CIRCULAR_FPS;
-    build_fingerprints();
+    build_circular_fingerprints( false );
   }
 
 }
@@ -1028,8 +1280,7 @@ void SVDClusRDKit::slot_circular_fps() {
 void SVDClusRDKit::slot_linear_fps() {
 
   if( fp_type_ != LINEAR_FPS ) {
-    fp_type_ = LINEAR_FPS;
-    build_fingerprints();
+    build_linear_fingerprints( false );
   }
 
 }
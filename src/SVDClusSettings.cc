@@ -25,10 +25,19 @@ namespace po = boost::program_options;
 SVDClusSettings::SVDClusSettings( int argc , char **argv ) :
   gamma_( 10.0 ) , sim_thresh_( 0.01 ) , clus_thresh_( 0.01 ) ,
   tversky_alpha_( 1.0 ) , tversky_beta_( 1.0 ) , start_num_clus_( -1 ) ,
-  stop_num_clus_( -1 ) , clus_num_step_( 1 ) ,
+  stop_num_clus_( -1 ) , clus_num_step_( 1 ) , nystrom_landmarks_( 0 ) ,
+  multilevel_coarsest_size_( 0 ) , float_matrix_( false ) ,
+  float_accuracy_report_( false ) , k_means_iters_( 10 ) ,
+  k_means_seeding_( "random" ) , k_means_batch_size_( 0 ) , random_seed_( 1 ) ,
+  k_means_change_tol_( 0.0 ) , k_means_warm_sweep_( false ) , k_means_exact_sil_( false ) ,
+  dense_max_bits_( 0 ) , sil_sample_tol_( 0.0 ) ,
+  k_medoids_sample_size_( 2000 ) , k_medoids_samples_( 5 ) ,
   do_svd_clus_( false ) , do_k_means_clus_( false ) ,
-  do_fuzzy_k_means_clus_( false ) ,
-  circular_fps_( false ) , linear_fps_( false ) , fuzzy_k_means_m_( 1.05 ) {
+  do_fuzzy_k_means_clus_( false ) , do_k_medoids_clus_( false ) ,
+  circular_fps_( false ) , linear_fps_( false ) , fuzzy_k_means_iters_( 2 ) ,
+  fuzzy_k_means_m_( 1.05 ) ,
+  fuzzy_k_means_top_r_( 0 ) ,
+  batch_( false ) {
 
   po::options_description desc( "Allowed Options" );
   build_program_options( desc );
@@ -42,12 +51,31 @@ SVDClusSettings::SVDClusSettings( int argc , char **argv ) :
     exit( 1 );
   }
 
+  if( "random" != k_means_seeding_ && "k-means++" != k_means_seeding_
+      && "k-means||" != k_means_seeding_ ) {
+    cerr << "Error - unknown K-Means seeding " << k_means_seeding_ << "." << endl
+         << desc << endl;
+    exit( 1 );
+  }
+
   ostringstream oss;
   oss << desc;
   usage_text_ = oss.str();
 
 }
 
+// ***************************************************************************
+KMEANS_SEEDING SVDClusSettings::k_means_seeding() const {
+
+  if( "k-means++" == k_means_seeding_ ) {
+    return KMEANS_PP_SEEDS;
+  } else if( "k-means||" == k_means_seeding_ ) {
+    return KMEANS_PARALLEL_SEEDS;
+  }
+  return RANDOM_SEEDS;
+
+}
+
 // ***************************************************************************
 void SVDClusSettings::print_usage( ostream &os ) const {
 
@@ -69,14 +97,36 @@ void SVDClusSettings::build_program_options( po::options_description &desc ) {
       ( "start-num-clusters,N" , po::value<int>( &start_num_clus_ ) , "Number of clusters to start with." )
       ( "stop-num-clusters" , po::value<int>( &stop_num_clus_ ) , "Final number of clusters. ")
       ( "cluster-number-step" , po::value<int>( &clus_num_step_ ) , "Step for number of clusters." )
+      ( "nystrom-landmarks" , po::value<int>( &nystrom_landmarks_ ) , "Number of landmark molecules for Nystrom approximation of SVD clustering (default 0, full SVD)." )
+      ( "multilevel-coarsest-size" , po::value<int>( &multilevel_coarsest_size_ ) , "Number of super-nodes to coarsen the similarity graph down to for multilevel SVD clustering, which speeds up the SVD of the full similarity matrix once it's built (default 0, full SVD)." )
+      ( "float-matrix" , po::value<bool>( &float_matrix_ )->zero_tokens() , "Hold the SVD similarity matrix values in single precision." )
+      ( "float-accuracy-report" , po::value<bool>( &float_accuracy_report_ )->zero_tokens() , "Compare single precision SVD results with double precision ones." )
       ( "tversky-alpha,A" , po::value<double>( &tversky_alpha_ ) , "Tversky alpha value (default 1.0).")
       ( "tversky-beta,B" , po::value<double>( &tversky_beta_ ) , "Tversky beta value (default 1.0).")
       ( "do-svd-clusters" , po::value<bool>( &do_svd_clus_ )->zero_tokens() , "Do SVD clustering on program start." )
       ( "do-k-means-clusters" , po::value<bool>( &do_k_means_clus_ )->zero_tokens() , "Do K-Means clustering on program start." )
+      ( "k-means-iterations" , po::value<int>( &k_means_iters_ ) , "Number of K-Means clustering runs, keeping the best (default 10)." )
+      ( "k-means-seeding" , po::value<string>( &k_means_seeding_ ) , "How to pick the starting centroids for K-Means clustering, random, k-means++ or k-means|| (default random)." )
+      ( "k-means-batch-size" , po::value<int>( &k_means_batch_size_ ) , "Do mini-batch K-Means clustering with batches of this many molecules (default 0, full K-Means)." )
+      ( "k-means-change-tolerance" , po::value<double>( &k_means_change_tol_ ) , "Stop K-Means iterations when no more than this fraction of the molecules change cluster (default 0.0)." )
+      ( "k-means-warm-sweep" , po::value<bool>( &k_means_warm_sweep_ )->zero_tokens() , "Start each K-Means clustering in a sweep over numbers of clusters from the previous one, splitting its worst clusters." )
+      ( "k-means-exact-silhouette" , po::value<bool>( &k_means_exact_sil_ )->zero_tokens() , "Score K-Means clusterings with the exact silhouette, from the mean distances to the cluster members, rather than the distances to the centroids. Not for mini-batch K-Means." )
+      ( "dense-max-bits" , po::value<int>( &dense_max_bits_ ) , "Use at most this many of the most variable fingerprint bits for K-Means and Fuzzy K-Means clustering (default 0, all the bits that aren't the same in every molecule)." )
+      ( "silhouette-sample-tolerance" , po::value<double>( &sil_sample_tol_ ) , "Estimate the silhouette scores of SVD, Fuzzy K-Means and exact-silhouette K-Means clusterings from samples of the molecules, growing them until the 95% confidence interval is narrower than this (default 0.0, the full scores). Not for mini-batch K-Means." )
+      ( "random-seed" , po::value<unsigned int>( &random_seed_ ) , "Seed for the random numbers in K-Means, Fuzzy K-Means and K-Medoids clustering, the Nystrom, multilevel and single precision SVD modes and the silhouette samples, the same seed giving the same clusters (default 1)." )
       ( "do-fuzzy-k-means-clusters" , po::value<bool>( &do_fuzzy_k_means_clus_ )->zero_tokens() , "Do Fuzzy K-Means clustering on program start." )
+      ( "do-k-medoids-clusters" , po::value<bool>( &do_k_medoids_clus_ )->zero_tokens() , "Do K-Medoids clustering on Tversky distances on program start." )
+      ( "k-medoids-sample-size" , po::value<int>( &k_medoids_sample_size_ ) , "Find the K-Medoids on random samples of this many molecules if there are more (default 2000, 0 means always use all the molecules)." )
+      ( "k-medoids-samples" , po::value<int>( &k_medoids_samples_ ) , "Number of random samples to find the K-Medoids on, keeping the best (default 5)." )
       ( "circular-fingerprints" , po::value<bool>( &circular_fps_ )->zero_tokens() , "Build circular (ECFP-type) fingerprints." )
       ( "linear-fingerprints" , po::value<bool>( &linear_fps_ )->zero_tokens() , "Build linear (Daylight-like) fingerprints." )
-      ( "fuzzy-k-means-m,M" , po::value<float>( &fuzzy_k_means_m_ ) , "M for fuzzy k-means clustering." );
+      ( "fuzzy-k-means-iterations" , po::value<int>( &fuzzy_k_means_iters_ ) , "Number of Fuzzy K-Means clustering runs, keeping the best (default 2)." )
+      ( "fuzzy-k-means-m,M" , po::value<float>( &fuzzy_k_means_m_ ) , "M for fuzzy k-means clustering." )
+      ( "fuzzy-k-means-top-r" , po::value<int>( &fuzzy_k_means_top_r_ ) , "Keep only each molecule's this many biggest memberships, at least 2, during Fuzzy K-Means clustering, to save memory with a lot of clusters (default 0, keep them all)." )
+      ( "save-svd-model" , po::value<string>( &save_svd_model_file_ ) , "File to save the model of the last SVD clustering to, for assigning new molecules later." )
+      ( "svd-model" , po::value<string>( &svd_model_file_ ) , "Assign the molecules to the clusters of this saved SVD model." )
+      ( "assignments-file" , po::value<string>( &assignments_file_ ) , "File to write the SVD model assignments to." )
+      ( "batch" , po::value<bool>( &batch_ )->zero_tokens() , "Do the command-line jobs without opening any windows, then exit. The clusters go to standard output, as do the SVD model assignments if there's no assignments file." );
 
 }
 
@@ -16,6 +16,7 @@
 #include <QDoubleValidator>
 #include <QFormLayout>
 #include <QFrame>
+#include <QIntValidator>
 #include <QLabel>
 #include <QLayout>
 #include <QLineEdit>
@@ -40,7 +41,10 @@ void SVDClustersDialog::get_settings( int &start_num_clus , int &stop_num_clus ,
                                       int &num_clus_step , double &tv_alpha , double &tv_beta ,
                                       double &gamma ,
                                       double &sim_thresh , double &clus_thresh ,
-                                      bool &overlapping_clusters ) const {
+                                      bool &overlapping_clusters , int &num_landmarks ,
+                                      int &coarsest_size , bool &float_matrix ,
+                                      bool &float_accuracy_report ,
+                                      double &sil_sample_tol ) const {
 
   BuildClustersDialog::get_settings( start_num_clus , stop_num_clus , num_clus_step );
 
@@ -50,6 +54,11 @@ void SVDClustersDialog::get_settings( int &start_num_clus , int &stop_num_clus ,
   sim_thresh = sim_thresh_->text().toDouble();
   clus_thresh = clus_thresh_->text().toDouble();
   overlapping_clusters = overlap_clusters_->isChecked();
+  num_landmarks = num_landmarks_->text().toInt();
+  coarsest_size = coarsest_size_->text().toInt();
+  float_matrix = float_matrix_->isChecked();
+  float_accuracy_report = float_accuracy_report_->isChecked();
+  sil_sample_tol = sil_sample_tol_->text().toDouble();
 
 }
 
@@ -94,6 +103,26 @@ void SVDClustersDialog::build_widget( SVDClusSettings *initial_settings ) {
   overlap_clusters_->setChecked( true );
   main_form_->addRow( "Overlapping clusters" , overlap_clusters_ );
 
+  num_landmarks_ = new QLineEdit( QString( "%1" ).arg( initial_settings->nystrom_landmarks() ) );
+  num_landmarks_->setValidator( new QIntValidator( 0 , numeric_limits<int>::max() , this ) );
+  main_form_->addRow( "Nystrom landmarks (0 for full SVD)" , num_landmarks_ );
+
+  coarsest_size_ = new QLineEdit( QString( "%1" ).arg( initial_settings->multilevel_coarsest_size() ) );
+  coarsest_size_->setValidator( new QIntValidator( 0 , numeric_limits<int>::max() , this ) );
+  main_form_->addRow( "Multilevel coarsest size (0 for full SVD)" , coarsest_size_ );
+
+  float_matrix_ = new QCheckBox;
+  float_matrix_->setChecked( initial_settings->float_matrix() );
+  main_form_->addRow( "Single precision matrix" , float_matrix_ );
+
+  float_accuracy_report_ = new QCheckBox;
+  float_accuracy_report_->setChecked( initial_settings->float_accuracy_report() );
+  main_form_->addRow( "Report single precision accuracy" , float_accuracy_report_ );
+
+  sil_sample_tol_ = new QLineEdit( QString( "%1" ).arg( initial_settings->sil_sample_tol() ) );
+  sil_sample_tol_->setValidator( new QDoubleValidator( 0.0 , 1.0 , 4 , this ) );
+  main_form_->addRow( "Silhouette sample tolerance (0 for full score)" , sil_sample_tol_ );
+
   setWindowTitle( "SVD Clusters" );
 
 }
@@ -0,0 +1,269 @@
+//
+// file SVDModel.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+
+#include "MoleculeRec.H"
+#include "SVDCluster.H"
+#include "SVDClusterMember.H"
+#include "SVDModel.H"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+// ****************************************************************************
+SVDModel::SVDModel() :
+  tversky_alpha_( 1.0 ) , tversky_beta_( 1.0 ) , gamma_( 10.0 ) ,
+  sim_thresh_( 0.01 ) , clus_thresh_( 0.01 ) {
+
+}
+
+// ****************************************************************************
+SVDModel::SVDModel( const vector<pMolRec> &molecules ,
+                    double tversky_alpha , double tversky_beta ,
+                    double gamma , double sim_thresh , double clus_thresh ,
+                    SVDRec svd_res ) :
+  tversky_alpha_( tversky_alpha ) , tversky_beta_( tversky_beta ) ,
+  gamma_( gamma ) , sim_thresh_( sim_thresh ) , clus_thresh_( clus_thresh ) ,
+  packed_fps_( molecules ) {
+
+  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
+    mol_names_.push_back( molecules[i]->name() );
+  }
+
+  for( int k = 0 ; k < svd_res->d ; ++k ) {
+    sing_vals_.push_back( svd_res->S[k] );
+    u_vecs_.push_back( vector<double>( svd_res->Ut->value[k] ,
+                                       svd_res->Ut->value[k] + svd_res->Ut->cols ) );
+    v_vecs_.push_back( vector<double>( svd_res->Vt->value[k] ,
+                                       svd_res->Vt->value[k] + svd_res->Vt->cols ) );
+  }
+
+}
+
+// ****************************************************************************
+bool SVDModel::read( const string &filename ) {
+
+  ifstream ifs( filename.c_str() );
+  if( !ifs.good() ) {
+    return false;
+  }
+
+  string line;
+  getline( ifs , line );
+  if( line != "SVDClus Model 1" ) {
+    return false;
+  }
+
+  int num_mols , num_clus;
+  ifs >> fp_label_ >> tversky_alpha_ >> tversky_beta_ >> gamma_
+      >> sim_thresh_ >> clus_thresh_ >> num_mols;
+  if( ifs.fail() || num_mols < 0 ) {
+    return false;
+  }
+
+  mol_names_ = vector<string>( num_mols );
+  for( int i = 0 ; i < num_mols ; ++i ) {
+    ifs >> mol_names_[i];
+  }
+  if( ifs.fail() || !packed_fps_.read( ifs ) || packed_fps_.num_fps() != num_mols ) {
+    return false;
+  }
+
+  ifs >> num_clus;
+  if( ifs.fail() || num_clus < 0 ) {
+    return false;
+  }
+  sing_vals_ = vector<double>( num_clus , 0.0 );
+  u_vecs_ = vector<vector<double> >( num_clus , vector<double>( num_mols , 0.0 ) );
+  v_vecs_ = u_vecs_;
+  for( int k = 0 ; k < num_clus ; ++k ) {
+    ifs >> sing_vals_[k];
+  }
+  for( int k = 0 ; k < num_clus ; ++k ) {
+    for( int i = 0 ; i < num_mols ; ++i ) {
+      ifs >> u_vecs_[k][i];
+    }
+  }
+  for( int k = 0 ; k < num_clus ; ++k ) {
+    for( int i = 0 ; i < num_mols ; ++i ) {
+      ifs >> v_vecs_[k][i];
+    }
+  }
+
+  return !ifs.fail();
+
+}
+
+// ****************************************************************************
+bool SVDModel::write( const string &filename ) const {
+
+  ofstream ofs( filename.c_str() );
+  if( !ofs.good() ) {
+    return false;
+  }
+
+  ofs.precision( numeric_limits<double>::digits10 + 2 );
+  ofs << "SVDClus Model 1" << endl
+      << ( fp_label_.empty() ? string( "Unknown" ) : fp_label_ ) << endl
+      << tversky_alpha_ << " " << tversky_beta_ << " " << gamma_ << " "
+      << sim_thresh_ << " " << clus_thresh_ << endl
+      << mol_names_.size() << endl;
+  for( int i = 0 , is = mol_names_.size() ; i < is ; ++i ) {
+    ofs << mol_names_[i] << endl;
+  }
+  packed_fps_.write( ofs );
+
+  ofs << sing_vals_.size() << endl;
+  for( int k = 0 , ks = sing_vals_.size() ; k < ks ; ++k ) {
+    ofs << ( k ? " " : "" ) << sing_vals_[k];
+  }
+  ofs << endl;
+  for( int k = 0 , ks = u_vecs_.size() ; k < ks ; ++k ) {
+    for( int i = 0 , is = u_vecs_[k].size() ; i < is ; ++i ) {
+      ofs << ( i ? " " : "" ) << u_vecs_[k][i];
+    }
+    ofs << endl;
+  }
+  for( int k = 0 , ks = v_vecs_.size() ; k < ks ; ++k ) {
+    for( int i = 0 , is = v_vecs_[k].size() ; i < is ; ++i ) {
+      ofs << ( i ? " " : "" ) << v_vecs_[k][i];
+    }
+    ofs << endl;
+  }
+
+  return ofs.good();
+
+}
+
+// ****************************************************************************
+// If the similarity matrix is K = U S V', a new row of K, k, has the projection
+// k V S^-1 onto the left singular vectors. The similarities of the new molecule
+// to the clustered ones go through the same Gaussian filter and threshold as the
+// original matrix did. The matrix has no diagonal, so a new molecule with the same
+// name as a clustered one is taken to be that molecule and not compared with it,
+// which means re-assigning the original molecules gives their original clusters.
+bool SVDModel::project_molecules( const vector<pMolRec> &new_mols ,
+                                  vector<vector<double> > &conts ) const {
+
+  PackedFingerprints new_fps( new_mols );
+  int num_new = new_fps.num_fps();
+  int num_clus = num_clusters();
+  conts = vector<vector<double> >( num_clus , vector<double>( num_new , 0.0 ) );
+
+  if( new_fps.num_bits() != num_bits() ) {
+    return false;
+  }
+
+#pragma omp parallel for schedule(dynamic,16)
+  for( int j = 0 ; j < num_new ; ++j ) {
+    if( !new_fps.has_fp( j ) ) {
+      continue;
+    }
+    for( int i = 0 , is = num_molecules() ; i < is ; ++i ) {
+      if( !packed_fps_.has_fp( i ) || new_mols[j]->name() == mol_names_[i] ) {
+        continue;
+      }
+      double sim = packed_fps_.tversky( i , new_fps , j , tversky_alpha_ , tversky_beta_ );
+      sim = exp( -1.0 * gamma_ * ( sim - 1.0 ) * ( sim - 1.0 ) );
+      if( sim <= sim_thresh_ ) {
+        continue;
+      }
+      for( int k = 0 ; k < num_clus ; ++k ) {
+        conts[k][j] += sim * v_vecs_[k][i];
+      }
+    }
+    for( int k = 0 ; k < num_clus ; ++k ) {
+      conts[k][j] /= sing_vals_[k];
+    }
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+void SVDModel::build_clusters( const vector<pMolRec> &new_mols ,
+                               const vector<vector<double> > &conts ,
+                               vector<pSVDCluster> &clusters ) const {
+
+  clusters.clear();
+  for( int k = 0 , ks = conts.size() ; k < ks ; ++k ) {
+    clusters.push_back( pSVDCluster( new SVDCluster( sing_vals_[k] , clus_thresh_ ) ) );
+    for( int j = 0 , js = new_mols.size() ; j < js ; ++j ) {
+      clusters.back()->add_member( pSVDClusMem( new SVDClusterMember( new_mols[j] ,
+                                                                      fabs( conts[k][j] ) ) ) ,
+                                   false );
+    }
+    clusters.back()->sort_members();
+  }
+
+}
+
+// ****************************************************************************
+void SVDModel::write_assignments( ostream &os , const vector<pMolRec> &new_mols ,
+                                  const vector<vector<double> > &conts ) const {
+
+  os << "Molecule name : Best cluster : Contribution : Next cluster : Contribution" << endl;
+  for( int j = 0 , js = new_mols.size() ; j < js ; ++j ) {
+    int best = -1 , next = -1;
+    for( int k = 0 , ks = conts.size() ; k < ks ; ++k ) {
+      if( fabs( conts[k][j] ) <= clus_thresh_ ) {
+        continue;
+      }
+      if( -1 == best || fabs( conts[k][j] ) > fabs( conts[best][j] ) ) {
+        next = best;
+        best = k;
+      } else if( -1 == next || fabs( conts[k][j] ) > fabs( conts[next][j] ) ) {
+        next = k;
+      }
+    }
+    os << new_mols[j]->name();
+    if( -1 == best ) {
+      os << " : none" << endl;
+      continue;
+    }
+    os << " : " << cluster_name( best ) << " : " << fabs( conts[best][j] );
+    if( -1 != next ) {
+      os << " : " << cluster_name( next ) << " : " << fabs( conts[next][j] );
+    }
+    os << endl;
+  }
+
+}
+
+// ****************************************************************************
+// cluster number, which is the number of the singular vector counting from 1,
+// and the name of the molecule in the original clustering with the largest
+// contribution to it. The number is the same as in the ClusterWindow of the
+// assigned molecules, as build_clusters keeps every cluster, but it may not be
+// in the window of the original clustering if that wasn't overlapping, as the
+// empty clusters were taken out of that; the molecule name identifies it there.
+string SVDModel::cluster_name( int k ) const {
+
+  int top_mol = 0;
+  for( int i = 1 , is = u_vecs_[k].size() ; i < is ; ++i ) {
+    if( fabs( u_vecs_[k][i] ) > fabs( u_vecs_[k][top_mol] ) ) {
+      top_mol = i;
+    }
+  }
+
+  string ret_val = boost::lexical_cast<string>( k + 1 );
+  if( !mol_names_.empty() ) {
+    ret_val += "(" + mol_names_[top_mol] + ")";
+  }
+  return ret_val;
+
+}
@@ -25,11 +25,8 @@
 #include <limits>
 #include <vector>
 
-#include "MoleculeRec.H"
-#include "SVDClusRDKitDefs.H"
-
-#include <DataStructs/SparseIntVect.h>
-#include <DataStructs/BitOps.h>
+#include "DenseMatrix.H"
+#include "PackedFingerprints.H"
 
 #include <boost/foreach.hpp>
 #include <boost/lambda/bind.hpp>
@@ -41,21 +38,23 @@ namespace bl = boost::lambda;
 
 // ****************************************************************************
 // for each fingerprint, calculate the mean distance for it to each cluster, using
-// a tversky similarity. These can then be used in crisp_silhouette_score.
+// a tversky similarity. These can then be used in crisp_silhouette_score. The
+// similarities are from the bit counts of the packed fingerprints, and the
+// molecules are done in parallel.
 void calc_molecule_cluster_dists( const vector<vector<int> > &clus ,
-                                  const vector<pMolRec> &molecules ,
+                                  const PackedFingerprints &packed_fps ,
                                   float tversky_alpha ,
                                   float tversky_beta ,
-                                  vector<vector<float> > &mol_clus_dists ) {
+                                  DenseMatrix &mol_clus_dists ) {
 
   // need to calculate the mean distance from each fingerprint to other members
-  // in each cluster.  Start by calculating sum of distances of each fingerprint
-  // to clusters.
+  // in each cluster.
 
   // however, not all fingerprints will necessarily be in a cluster. This is certainly true
   // for the spectral clustering. Calculating distances for them is a waste of time.
-  vector<char> in_clus( molecules.size() , 0 );
-  BOOST_FOREACH( vector<int> c , clus ) {
+  int num_mols = packed_fps.num_fps();
+  vector<char> in_clus( num_mols , 0 );
+  BOOST_FOREACH( const vector<int> &c , clus ) {
     BOOST_FOREACH( int cm , c ) {
       in_clus[cm] = 1;
     }
@@ -64,30 +63,26 @@ void calc_molecule_cluster_dists( const vector<vector<int> > &clus ,
   // dists - rows are fingerprints, columns are clusters. We don't want the distance
   // of fp i to itself in the cluster, but this will be 0.0 so it doesn't matter that
   // we calculate it anyway. It prevents a lot of testing if we do.
-  mol_clus_dists = vector<vector<float> >( molecules.size() , vector<float>( clus.size() , 0.0F ) );
+  mol_clus_dists.resize( num_mols , clus.size() );
 
-  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
+#pragma omp parallel for schedule(dynamic,16)
+  for( int i = 0 ; i < num_mols ; ++i ) {
     if( !in_clus[i] ) {
       continue;
     }
+    float *dists_i = mol_clus_dists.row( i );
     for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+      double sum_dists = 0.0;
       for( int k = 0 , ks = clus[j].size() ; k < ks ; ++k ) {
         int mem = clus[j][k];
-        float dist = 1.0 - TverskySimilarity<ExplicitBitVect>( *(molecules[i]->get_fingerprint()) ,
-                                                               *(molecules[mem]->get_fingerprint()) ,
-                                                               tversky_alpha , tversky_beta );
+        double dist = 1.0 - packed_fps.tversky( i , mem , tversky_alpha , tversky_beta );
 #ifdef NOTYET
         cout << i << " to " << mem << " dist = " << dist << endl;
 #endif
-        mol_clus_dists[i][j] += dist;
+        sum_dists += dist;
       }
-    }
-  }
-
-  // now take the means
-  for( int i = 0 , is = molecules.size() ; i < is ; ++i ) {
-    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
-      mol_clus_dists[i][j] /= float( clus[j].size() );
+      // now take the mean
+      dists_i[j] = sum_dists / float( clus[j].size() );
     }
   }
 
@@ -99,20 +94,20 @@ void calc_molecule_cluster_dists( const vector<vector<int> > &clus ,
 // well each molecule fits into a cluster compared with the next nearest
 // cluster it might be in.
 float crisp_silhouette_score( const vector<vector<int> > &clus ,
-                              const vector<vector<float> > dists ,
+                              const DenseMatrix &dists ,
                               vector<float> &sil_scores ) {
 
   float css = 0.0;
 
 #ifdef NOTYET
-  for( int i = 0 , is = dists.size() ; i < is ; ++i ) {
+  for( int i = 0 , is = dists.num_rows() ; i < is ; ++i ) {
     cout << i << " : ";
-    for_each( dists[i].begin() , dists[i].end() , cout << bl::_1 << " " );
+    for_each( dists.row( i ) , dists.row( i ) + dists.num_cols() , cout << bl::_1 << " " );
     cout << endl;
   }
 #endif
 
-  sil_scores = vector<float>( dists.size() , 0.0F );
+  sil_scores = vector<float>( dists.num_rows() , 0.0F );
   int num_clus_mems = 0;
   for( int i = 0 , is = clus.size() ; i < is ; ++i ) {
 #ifdef NOTYET
@@ -130,13 +125,13 @@ float crisp_silhouette_score( const vector<vector<int> > &clus ,
         int mem = clus[i][j];
         for( int k = 0 , ks = clus.size() ; k < ks ; ++k ) {
 #ifdef NOTYET
-          cout << mem << " to cluster " << k << " : " << dists[mem][k] << endl;
+          cout << mem << " to cluster " << k << " : " << dists( mem , k ) << endl;
 #endif
           if( i == k ) {
-            ai = dists[mem][k];
+            ai = dists( mem , k );
           } else {
-            if( dists[mem][k] < bi ) {
-              bi = dists[mem][k];
+            if( dists( mem , k ) < bi ) {
+              bi = dists( mem , k );
             }
           }
         }
@@ -45,3 +45,16 @@ float fuzzy_silhouette_score( const vector<float> &crisp_sil_scores ,
   return fs / normaliser;
 
 }
+
+// ****************************************************************************
+// the weight of each molecule in the fuzzy silhouette score, for
+// sampled_silhouette_score to use
+void fuzzy_silhouette_weights( const vector<TOP_PAIR> &top_pairs ,
+                               vector<float> &weights ) {
+
+  weights.resize( top_pairs.size() );
+  for( int i = 0 , is = top_pairs.size() ; i < is ; ++i ) {
+    weights[i] = top_pairs[i].get<0>() - top_pairs[i].get<2>();
+  }
+
+}
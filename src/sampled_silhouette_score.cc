@@ -0,0 +1,228 @@
+//
+// file sampled_silhouette_score.cc
+//
+//  Copyright (C) 2014 AstraZeneca, David Cosgrove
+//
+//   @@ All Rights Reserved @@
+//  This file is part of SVDClus.
+//  The contents are covered by the terms of the BSD license
+//  which is included in the file license.txt, found at the root
+//  of the source tree.
+//
+// Estimates the silhouette score from a sample, for big datasets where working
+// it out in full takes longer than the clustering. The molecules are sampled
+// stratified by cluster, in proportion to the cluster sizes, and each sampled
+// molecule's silhouette is worked out exactly, from its distances to all the
+// clustered molecules, so the sample costs its size times the number of
+// molecules rather than the square of the number of molecules. For the Hamming
+// distances of k-means and fuzzy k-means, ClusterBitsSilDistance gets them from
+// the clusters' bit fractions instead, so it's the sample size times the number
+// of clusters, against the number of molecules times that for the exact score
+// from the same fractions. Resampling the
+// sampled molecules of each cluster (the bootstrap) then gives a 95% confidence
+// interval for the score itself, and the sample is doubled until that's narrower
+// than the tolerance asked for, or every molecule is in it.
+
+#include "SilhouetteDistance.H"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+
+using namespace std;
+
+// in DoKMeansCluster.cc
+unsigned int run_seed( unsigned int master_seed , int run_num );
+
+// molecules sampled in the first round
+static const int SIL_START_SAMPLES = 256;
+static const int SIL_BOOTSTRAPS = 200;
+
+// ****************************************************************************
+// The silhouette of molecule mol, as crisp_silhouette_score does it, from the mean
+// distances to the members of each cluster. mol_clus[i] is the cluster molecule i
+// is in, -1 if none. If self_in_own_mean is true, mol counts as a member of its
+// own cluster at distance 0 in the mean, which is what the full SVD and Fuzzy
+// K-Means scores do, otherwise it's left out, as Rousseeuw has it.
+float sampled_mol_silhouette( const vector<vector<int> > &clus ,
+                              const vector<int> &mol_clus , int mol ,
+                              bool self_in_own_mean ,
+                              const SilhouetteDistance &sil_dist ) {
+
+  int own_clus = mol_clus[mol];
+  int own_size = clus[own_clus].size();
+  if( own_size < 2 ) {
+    return 0.0F;
+  }
+
+  vector<double> sum_dists( clus.size() , 0.0 );
+  sil_dist.add_cluster_dists( mol , mol_clus , sum_dists );
+
+  float ai = sum_dists[own_clus] / ( self_in_own_mean ? own_size : own_size - 1 );
+  float bi = numeric_limits<float>::max();
+  for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+    if( j != own_clus && !clus[j].empty() ) {
+      bi = std::min( bi , float( sum_dists[j] / clus[j].size() ) );
+    }
+  }
+
+  if( ai != bi ) {
+    return ( bi - ai ) / std::max( bi , ai );
+  }
+  return 0.0F;
+
+}
+
+// ****************************************************************************
+// The 95% confidence interval of the estimate, by resampling the sampled terms
+// of each cluster with replacement. A cluster that's been sampled completely is
+// known exactly, so it isn't resampled.
+void bootstrap_interval( const vector<vector<int> > &clus ,
+                         const vector<vector<double> > &terms ,
+                         double normaliser , boost::random::mt19937 &rng ,
+                         float &ci_low , float &ci_high ) {
+
+  vector<double> boot_scores( SIL_BOOTSTRAPS );
+  for( int b = 0 ; b < SIL_BOOTSTRAPS ; ++b ) {
+    double total = 0.0;
+    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+      int num_terms = terms[j].size();
+      if( !num_terms ) {
+        continue;
+      }
+      double sum_terms = 0.0;
+      if( num_terms == int( clus[j].size() ) ) {
+        sum_terms = accumulate( terms[j].begin() , terms[j].end() , 0.0 );
+      } else {
+        boost::random::uniform_int_distribution<int> pick( 0 , num_terms - 1 );
+        for( int n = 0 ; n < num_terms ; ++n ) {
+          sum_terms += terms[j][pick( rng )];
+        }
+      }
+      total += clus[j].size() * sum_terms / num_terms;
+    }
+    boot_scores[b] = total / normaliser;
+  }
+
+  sort( boot_scores.begin() , boot_scores.end() );
+  ci_low = boot_scores[int( 0.025 * ( SIL_BOOTSTRAPS - 1 ) + 0.5 )];
+  ci_high = boot_scores[int( 0.975 * ( SIL_BOOTSTRAPS - 1 ) + 0.5 )];
+
+}
+
+// ****************************************************************************
+// clus are the crisp clusters of num_mols molecules, each in no more than one of
+// them. If weights is empty, the estimate is of the crisp silhouette score, the
+// mean of s_i over the molecules in the clusters. Otherwise it's of
+// sum w_i s_i / sum w_i over all the molecules, s_i being 0 for those not in a
+// cluster, which is the fuzzy silhouette score if the weights are from
+// fuzzy_silhouette_weights. self_in_own_mean is as for sampled_mol_silhouette,
+// to match the full score being estimated. ci_tol is the width of the confidence
+// interval to stop at. sil_scores gets s_i for the sampled molecules and 0 for
+// the rest. Nothing is written out, as it may be one of several being done in
+// parallel; report_silhouette_estimate does that.
+float sampled_silhouette_score( const vector<vector<int> > &clus , int num_mols ,
+                                const SilhouetteDistance &sil_dist ,
+                                const vector<float> &weights , bool self_in_own_mean ,
+                                double ci_tol , unsigned int random_seed ,
+                                vector<float> &sil_scores ,
+                                SilhouetteEstimate &estimate ) {
+
+  estimate = SilhouetteEstimate();
+  sil_scores = vector<float>( num_mols , 0.0F );
+  vector<int> mol_clus( num_mols , -1 );
+  int num_clus_mems = 0;
+  for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+    num_clus_mems += clus[j].size();
+    for( int k = 0 , ks = clus[j].size() ; k < ks ; ++k ) {
+      mol_clus[clus[j][k]] = j;
+    }
+  }
+  estimate.num_clus_mems_ = num_clus_mems;
+  double normaliser = weights.empty() ? double( num_clus_mems ) :
+                                        accumulate( weights.begin() , weights.end() , 0.0 );
+  if( !num_clus_mems || normaliser <= 0.0 ) {
+    return 0.0F;
+  }
+
+  // each cluster's members in random order, the sample of it being the first
+  // terms[j].size() of them
+  boost::random::mt19937 rng( run_seed( random_seed , num_mols ) );
+  vector<vector<int> > orders( clus );
+  for( int j = 0 , js = orders.size() ; j < js ; ++j ) {
+    for( int k = 0 , ks = orders[j].size() ; k < ks - 1 ; ++k ) {
+      boost::random::uniform_int_distribution<int> pick( k , ks - 1 );
+      swap( orders[j][k] , orders[j][pick( rng )] );
+    }
+  }
+
+  // w_i s_i for the sampled molecules of each cluster
+  vector<vector<double> > terms( clus.size() );
+  int target = std::min( SIL_START_SAMPLES , num_clus_mems );
+  int num_sampled = 0;
+  while( true ) {
+
+    // enough new molecules from each cluster to bring it up to its share of
+    // target, and at least 1
+    vector<pair<int,int> > new_mols;
+    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+      int clus_size = clus[j].size();
+      int share = int( double( target ) * clus_size / num_clus_mems + 0.5 );
+      share = std::min( clus_size , std::max( 1 , share ) );
+      for( int k = terms[j].size() ; k < share ; ++k ) {
+        new_mols.push_back( make_pair( j , orders[j][k] ) );
+      }
+    }
+
+    vector<float> new_scores( new_mols.size() );
+#pragma omp parallel for schedule(dynamic)
+    for( int n = 0 ; n < int( new_mols.size() ) ; ++n ) {
+      new_scores[n] = sampled_mol_silhouette( clus , mol_clus , new_mols[n].second ,
+                                              self_in_own_mean , sil_dist );
+    }
+
+    for( int n = 0 , ns = new_mols.size() ; n < ns ; ++n ) {
+      int mol = new_mols[n].second;
+      sil_scores[mol] = new_scores[n];
+      terms[new_mols[n].first].push_back( weights.empty() ? new_scores[n] : weights[mol] * new_scores[n] );
+    }
+    num_sampled += new_mols.size();
+
+    double total = 0.0;
+    for( int j = 0 , js = clus.size() ; j < js ; ++j ) {
+      if( !terms[j].empty() ) {
+        total += clus[j].size() * accumulate( terms[j].begin() , terms[j].end() , 0.0 ) / terms[j].size();
+      }
+    }
+    estimate.score_ = total / normaliser;
+    estimate.num_sampled_ = num_sampled;
+    bootstrap_interval( clus , terms , normaliser , rng , estimate.ci_low_ , estimate.ci_high_ );
+#ifdef NOTYET
+    cout << num_sampled << " sampled : " << estimate.score_ << " ( " << estimate.ci_low_
+         << " , " << estimate.ci_high_ << " )" << endl;
+#endif
+    if( estimate.ci_high_ - estimate.ci_low_ <= ci_tol || num_sampled == num_clus_mems ) {
+      break;
+    }
+    target = std::min( 2 * target , num_clus_mems );
+
+  }
+
+  return estimate.score_;
+
+}
+
+// ****************************************************************************
+void report_silhouette_estimate( const SilhouetteEstimate &estimate ) {
+
+  cout << "Sampled silhouette score : " << estimate.score_ << ", 95% confidence interval "
+       << estimate.ci_low_ << " to " << estimate.ci_high_ << " from "
+       << estimate.num_sampled_ << " of " << estimate.num_clus_mems_
+       << " clustered molecules." << endl;
+
+}
@@ -10,12 +10,23 @@ SOURCES += SVDClustersDialog.cc SVDClusRDKit.cc \
     KMeansClustersDialog.cc \
     crisp_silhouette_score.cc \
     fuzzy_silhouette_score.cc \
+    sampled_silhouette_score.cc \
     BuildClustersDialog.cc \
     MoleculeTableModel.cc \
     QTHelpViewer.cc \
     DoFuzzyKMeansCluster.cc \
     FuzzyKMeansClustersDialog.cc \
-    ClustersTableView.cc
+    ClustersTableView.cc \
+    PackedFingerprints.cc \
+    NystromSVD.cc \
+    SVDModel.cc \
+    MultilevelSVD.cc \
+    FloatSVD.cc \
+    DoMiniBatchKMeansCluster.cc \
+    DenseMatrix.cc \
+    DoKMedoidsCluster.cc \
+    KMedoidsClustersDialog.cc \
+    SVDClusBatch.cc
 
 HEADERS += SVDClustersDialog.H SVDClusSettings.H \
 ClustersTableModel.H RDKitMolDrawDelegate.H SVDCluster.H \
@@ -29,7 +40,14 @@ GetRDKitSims.H SVDClusRDKit.H \
     MoleculeTableModel.H \
     MoleculeTableView.H \
     QTHelpViewer.H \
-    FuzzyKMeansClustersDialog.H
+    FuzzyKMeansClustersDialog.H \
+    PackedFingerprints.H \
+    SVDModel.H \
+    KMeansKernels.H \
+    FuzzyKernels.H \
+    DenseMatrix.H \
+    KMedoidsClustersDialog.H \
+    SilhouetteDistance.H
 
 TARGET = svdclus
 
@@ -40,6 +58,9 @@ CONFIG(debug, debug|release) {
 
 QT += widgets
 
+QMAKE_CXXFLAGS += -fopenmp
+QMAKE_LFLAGS += -fopenmp
+
 INCLUDEPATH += ${RDBASE}/Code ${BOOST_ROOT}/include ${SVDLIBC_HOME}
 
 RD_STATIC_LIBS = -lSmilesParse_static -lFingerprints_static \
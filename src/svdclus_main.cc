@@ -13,30 +13,37 @@
 // fingerprints and 2D molecule display.
 
 #include "SVDClusRDKit.H"
+#include "SVDClusSettings.H"
 
 #include <RDGeneral/versions.h>
 
 #include <QApplication>
-
-#include <boost/random/mersenne_twister.hpp>
+#include <QCoreApplication>
 
 #include <iostream>
 
-// global random number generator, so we only have 1 on the go
-boost::random::mt19937 gen;
+// in SVDClusBatch.cc
+int run_batch( const SVDClusSettings &settings );
 
 // ****************************************************************************
 int main( int argc , char **argv ) {
 
-  QApplication a( argc , argv );
-
   std::cout << "\nSVDClus\n\nCopyright (C) 2014 AstraZeneca\n\n"
 	    << "Built using RDKit version " << RDKit::rdkitVersion << "\n"
 	    << "and Qt version " << QT_VERSION_STR << ".\n"
 	    << "Running with Qt version " << qVersion() << "\n\n";
 
-  SVDClusRDKit *w = new SVDClusRDKit( argc , argv );
+  // the batch jobs are done before there's a QApplication or any widgets, so
+  // they don't need a display
+  SVDClusSettings settings( argc , argv );
+  if( settings.batch() ) {
+    QCoreApplication a( argc , argv );
+    return run_batch( settings );
+  }
 
+  QApplication a( argc , argv );
+
+  SVDClusRDKit *w = new SVDClusRDKit( argc , argv );
   w->setWindowTitle( "Spectral Clustering with RDKit" );
   w->setGeometry( 50 , 50 , 700 , 650 );
   w->show();